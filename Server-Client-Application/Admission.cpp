@@ -0,0 +1,33 @@
+#include "Admission.h"
+#include <algorithm>
+
+AdmissionControl::AdmissionControl(const TimeSource& clock)
+    : clock(clock), sessionsPerSecond(admission::SESSIONS_PER_SECOND),
+    sessions(clock, admission::SESSIONS_PER_SECOND, admission::SESSIONS_PER_SECOND * admission::SESSION_BURST_SECONDS),
+    nextSlot(clock.now()) {
+}
+
+void AdmissionControl::configure(double rate) {
+    sessionsPerSecond = rate;
+    sessions.setRate(rate, rate * admission::SESSION_BURST_SECONDS);
+    nextSlot = clock.now();
+}
+
+bool AdmissionControl::admit(std::chrono::milliseconds& retryAfter) {
+    if (sessionsPerSecond <= 0 || sessions.tryTake(1)) {
+        return true;
+    }
+    auto now = clock.now();
+    auto slot = std::chrono::duration_cast<TimeSource::time_point::duration>(
+        std::chrono::duration<double>(1.0 / sessionsPerSecond));
+    auto refilled = now + std::chrono::duration_cast<TimeSource::time_point::duration>(
+        std::chrono::duration<double>(sessions.secondsUntil(1)));
+    nextSlot = std::max(nextSlot, refilled);
+    // Round up, so the client never comes back a moment too early.
+    retryAfter = std::chrono::ceil<std::chrono::milliseconds>(nextSlot - now);
+    if (retryAfter < admission::MAX_RETRY_AFTER) {
+        nextSlot += slot;
+    }
+    retryAfter = std::min<std::chrono::milliseconds>(retryAfter, admission::MAX_RETRY_AFTER);
+    return false;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include "Environment.h"
+#include "RateLimiter.h"
+
+namespace admission {
+    // Connections taken off the listen queue per event loop iteration; the
+    // rest wait for the next one, so sessions keep running during a storm.
+    constexpr int ACCEPTS_PER_TICK{ 64 };
+    // listen() backlog; 0 asks Winsock for its maximum.
+    constexpr int DEFAULT_BACKLOG{ 0 };
+    // New sessions admitted per second, and how many may arrive at once.
+    // 0 admits everything.
+    constexpr double SESSIONS_PER_SECOND{ 200.0 };
+    constexpr double SESSION_BURST_SECONDS{ 2.0 };
+    constexpr std::chrono::seconds MAX_RETRY_AFTER{ 30 };
+    // How long a deferred connection stays open for its hint to arrive.
+    constexpr std::chrono::seconds DEFER_LINGER{ 1 };
+}
+
+// Rate-limits new sessions. A connection over the rate is told when to come
+// back instead of being admitted; the hints are handed out one admission slot
+// apart, so a storm of refused clients returns at the rate the server takes
+// them rather than all at once.
+class AdmissionControl {
+public:
+    explicit AdmissionControl(const TimeSource& clock);
+    void configure(double sessionsPerSecond);
+    // false: refuse the connection and send `retryAfter` as the hint.
+    bool admit(std::chrono::milliseconds& retryAfter);
+
+private:
+    const TimeSource& clock;
+    double sessionsPerSecond;
+    TokenBucket sessions;
+    TimeSource::time_point nextSlot;
+};
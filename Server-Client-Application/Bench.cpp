@@ -0,0 +1,136 @@
+#include "Bench.h"
+#include "Admission.h"
+#include "Client.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+    struct Transport {
+        const char* name;
+        bool local;
+        bool sharedMemory;
+    };
+
+    // Reads notifications until the ping run's report or its throttling.
+    std::string awaitPingReport(Client& client) {
+        bool ended = false;
+        while (client.isLinked() && !ended) {
+            std::string shown = client.fetchCommunication(ended);
+            // A throttled run shows its partial report too; it does not count.
+            if (shown.find("THROTTLED") != std::string::npos) {
+                throw std::runtime_error("The server throttled the ping run");
+            }
+            size_t report = shown.find("PING ");
+            if (report != std::string::npos) {
+                return shown.substr(report + 5, shown.find('\n', report) - report - 5);
+            }
+        }
+        throw std::runtime_error("The server closed the connection during the ping run");
+    }
+
+    // A registered session that never speaks again. Replies are left unread;
+    // the socket is non-blocking so stillOpen() can peek at it.
+    SOCKET openIdleSession(const std::string& listeningPort, int index) {
+        SOCKET session = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (session == INVALID_SOCKET) {
+            return INVALID_SOCKET;
+        }
+        sockaddr_in addressOfServer{};
+        addressOfServer.sin_family = AF_INET;
+        addressOfServer.sin_addr.s_addr = inet_addr(bench::LOOPBACK);
+        addressOfServer.sin_port = htons(atoi(listeningPort.c_str()));
+        std::string command = "$register idle" + std::to_string(index);
+        uint32_t SizeOfMsg = static_cast<uint32_t>(command.size());
+        std::string frame(sizeof(SizeOfMsg), '\0');
+        memcpy(&frame[0], &SizeOfMsg, sizeof(SizeOfMsg));
+        frame += command;
+        u_long nonBlocking = 1;
+        if (connect(session, (SOCKADDR*)&addressOfServer, sizeof(addressOfServer)) == SOCKET_ERROR ||
+            send(session, frame.data(), static_cast<int>(frame.size()), 0) != static_cast<int>(frame.size()) ||
+            ioctlsocket(session, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+            closesocket(session);
+            return INVALID_SOCKET;
+        }
+        return session;
+    }
+
+    bool stillOpen(SOCKET session) {
+        char byte;
+        int received = recv(session, &byte, 1, MSG_PEEK);
+        return received > 0 || (received == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK);
+    }
+
+    int countOpen(const std::vector<SOCKET>& sessions) {
+        int open = 0;
+        for (SOCKET session : sessions) {
+            open += stillOpen(session) ? 1 : 0;
+        }
+        return open;
+    }
+}
+
+void runTransportBenchmark(const std::string& listeningPort, bool lowLatency) {
+    const Transport transports[] = { { "tcp", false, false }, { "local", true, false }, { "shm", true, true } };
+    for (const Transport& transport : transports) {
+        Client client;
+        client.setLowLatency(lowLatency);
+        if (transport.local) {
+            client.connectToLocal(local::socketPath(listeningPort));
+        }
+        else {
+            client.connectToServer(bench::LOOPBACK, listeningPort.c_str());
+        }
+        client.enrollUser(std::string("bench-") + transport.name);
+        if (transport.sharedMemory && !client.requestSharedMemory()) {
+            std::cout << "TRANSPORT " << transport.name << " refused" << std::endl;
+            continue;
+        }
+        auto begin = std::chrono::steady_clock::now();
+        client.ping(bench::TRANSPORT_PINGS);
+        std::string report = awaitPingReport(client);
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << "TRANSPORT " << transport.name << " " << report
+            << " round_trips_per_s=" << static_cast<long long>(bench::TRANSPORT_PINGS / elapsed) << std::endl;
+    }
+}
+
+void runHandoverBenchmark(const std::string& listeningPort, int sessions) {
+    // Connects first: it also starts Winsock for the raw sessions.
+    Client probe;
+    probe.connectToServer(bench::LOOPBACK, listeningPort.c_str());
+    probe.enrollUser("bench-probe");
+
+    std::vector<SOCKET> idle;
+    auto spacing = std::chrono::duration<double>(1.0 / admission::SESSIONS_PER_SECOND);
+    for (int i = 0; i < sessions; i++) {
+        SOCKET session = openIdleSession(listeningPort, i);
+        if (session != INVALID_SOCKET) {
+            idle.push_back(session);
+        }
+        std::this_thread::sleep_for(spacing);
+    }
+    // Sessions refused at the door have been closed by now.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    int openBefore = countOpen(idle);
+    std::cout << "HANDOVER " << openBefore << " idle sessions open; start \"server " << listeningPort
+        << " --takeover\" within " << bench::HANDOVER_WINDOW.count() << "s" << std::endl;
+
+    LatencyHistogram roundTrips;
+    auto end = std::chrono::steady_clock::now() + bench::HANDOVER_WINDOW;
+    while (std::chrono::steady_clock::now() < end) {
+        auto sent = std::chrono::steady_clock::now();
+        probe.ping(1);
+        awaitPingReport(probe);
+        roundTrips.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent));
+        std::this_thread::sleep_for(bench::PROBE_INTERVAL);
+    }
+    std::cout << "HANDOVER sessions_before=" << openBefore << " sessions_after=" << countOpen(idle)
+        << " probe " << roundTrips.report() << std::endl;
+    for (SOCKET session : idle) {
+        closesocket(session);
+    }
+}
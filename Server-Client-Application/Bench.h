@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+namespace bench {
+    // Round trips per transport; within the ping bucket's burst, so a run is
+    // never throttled.
+    constexpr int TRANSPORT_PINGS{ 1000 };
+    constexpr const char* LOOPBACK{ "127.0.0.1" };
+    constexpr int HANDOVER_SESSIONS{ 10000 };
+    // How long the probe keeps timing round trips once the sessions are in;
+    // the successor must be started within it.
+    constexpr std::chrono::seconds HANDOVER_WINDOW{ 60 };
+    constexpr std::chrono::milliseconds PROBE_INTERVAL{ 10 };
+}
+
+// Benchmarks against a real server on this machine, for what the simulated
+// network cannot stand in for.
+//
+// Times TRANSPORT_PINGS "$ping" round trips over loopback TCP, the local
+// socket and shared memory, one fresh session each, and prints each
+// transport's percentiles and round trips per second. lowLatency tunes the
+// TCP session as "client --low-latency" does.
+void runTransportBenchmark(const std::string& listeningPort, bool lowLatency);
+// Holds `sessions` idle registered sessions on a server on this machine, paced
+// at its default admission rate, then times a probe's round trips for
+// HANDOVER_WINDOW while "server <port> --takeover" is started. Prints the
+// probe's distribution, whose maximum is the pause clients saw, and how many
+// idle sessions survived. Both servers print the handover time itself.
+void runHandoverBenchmark(const std::string& listeningPort, int sessions);
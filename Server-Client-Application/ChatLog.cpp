@@ -0,0 +1,206 @@
+#include "ChatLog.h"
+#include <iostream>
+#include <filesystem>
+#include <ctime>
+#include <cstdio>
+#include <vector>
+
+#pragma warning(disable: 4996)
+
+ChatLog::ChatLog(const std::string& logPath)
+    : logPath(logPath), indexPath(logPath + ".idx"), recordCount(0), logSize(0) {
+}
+
+void ChatLog::open() {
+    std::error_code error;
+    logSize = std::filesystem::exists(logPath, error) ? std::filesystem::file_size(logPath, error) : 0;
+    uint64_t indexSize = std::filesystem::exists(indexPath, error) ? std::filesystem::file_size(indexPath, error) : 0;
+
+    // A torn trailing record is dropped; the tail scan below re-indexes it.
+    recordCount = indexSize / sizeof(LogIndexRecord);
+    if (indexSize % sizeof(LogIndexRecord) != 0) {
+        std::filesystem::resize_file(indexPath, recordCount * sizeof(LogIndexRecord), error);
+    }
+
+    uint64_t indexedEnd = 0;
+    LogIndexRecord last{};
+    if (recordCount > 0 && readRecord(recordCount - 1, last)) {
+        indexedEnd = last.offset + last.length;
+    }
+    if (indexedEnd > logSize) {
+        // The log was truncated or replaced behind our back; start the index over.
+        std::cerr << "Chat log index does not match the log, rebuilding it." << std::endl;
+        std::filesystem::resize_file(indexPath, 0, error);
+        recordCount = 0;
+        indexedEnd = 0;
+    }
+    indexReader.close();
+
+    logStream.open(logPath, std::ios::binary | std::ios::app);
+    indexStream.open(indexPath, std::ios::binary | std::ios::app);
+    if (!logStream.good() || !indexStream.good()) {
+        std::cerr << "Error opening log file." << std::endl;
+        return;
+    }
+    if (indexedEnd < logSize) {
+        indexTail(indexedEnd);
+    }
+}
+
+uint64_t ChatLog::append(const std::string& notification) {
+    std::time_t now = std::time(nullptr);
+    std::tm* CurrentTime = std::localtime(&now);
+    char holdTime[80];
+    std::strftime(holdTime, sizeof(holdTime), "[%Y-%m-%d %H:%M:%S]", CurrentTime);
+    std::string line = std::string(holdTime) + " " + notification + "\n";
+
+    logStream.write(line.data(), line.size());
+    logStream.flush();
+    if (!logStream.good()) {
+        std::cerr << "Error writing log file." << std::endl;
+        return 0;
+    }
+
+    // Log first, index second: a crash in between leaves a tail that open() re-indexes.
+    LogIndexRecord record{ logSize, static_cast<uint32_t>(line.size()), static_cast<uint32_t>(now) };
+    indexStream.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    indexStream.flush();
+    logSize += line.size();
+    return ++recordCount;
+}
+
+uint64_t ChatLog::lastSequence() const {
+    return recordCount;
+}
+
+uint64_t ChatLog::sizeInBytes() const {
+    return logSize;
+}
+
+bool ChatLog::findBySequence(uint64_t sequence, LogIndexRecord& record) {
+    if (sequence == 0 || sequence > recordCount) {
+        return false;
+    }
+    return readRecord(sequence - 1, record);
+}
+
+// Binary search over the index timestamps for the first record logged at or
+// after `since`. Returns lastSequence() + 1 when nothing is that recent.
+uint64_t ChatLog::sequenceSince(std::time_t since) {
+    uint64_t low = 0;
+    uint64_t high = recordCount;
+    LogIndexRecord record{};
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (!readRecord(middle, record)) {
+            return recordCount + 1;
+        }
+        if (static_cast<std::time_t>(record.timestamp) < since) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low + 1;
+}
+
+// Where a record starts in the log; the end of the log past the last one.
+uint64_t ChatLog::offsetOf(uint64_t sequence) {
+    LogIndexRecord record{};
+    if (sequence == 0) {
+        return 0;
+    }
+    if (!findBySequence(sequence, record)) {
+        return logSize;
+    }
+    return record.offset;
+}
+
+std::string ChatLog::read(uint64_t fromOffset, uint64_t toOffset) const {
+    if (fromOffset >= toOffset) {
+        return std::string();
+    }
+    std::ifstream logDescriptor(logPath, std::ios::binary);
+    if (!logDescriptor.good()) {
+        std::cerr << "Error opening log file." << std::endl;
+        return std::string();
+    }
+    std::string content(static_cast<size_t>(toOffset - fromOffset), '\0');
+    logDescriptor.seekg(static_cast<std::streamoff>(fromOffset));
+    logDescriptor.read(&content[0], content.size());
+    content.resize(static_cast<size_t>(logDescriptor.gcount()));
+    return content;
+}
+
+// Splits log text back into records, using the same rule as indexTail.
+std::vector<std::string> ChatLog::splitRecords(const std::string& content) {
+    std::vector<std::string> records;
+    size_t position = 0;
+    while (position < content.size()) {
+        size_t lineEnd = content.find('\n', position);
+        lineEnd = lineEnd == std::string::npos ? content.size() : lineEnd + 1;
+        std::string line = content.substr(position, lineEnd - position);
+        uint32_t timestamp = 0;
+        if (parseTimestamp(line, timestamp) || records.empty()) {
+            records.emplace_back();
+        }
+        records.back() += line;
+        position = lineEnd;
+    }
+    return records;
+}
+
+bool ChatLog::readRecord(uint64_t position, LogIndexRecord& record) {
+    if (!indexReader.is_open()) {
+        indexReader.open(indexPath, std::ios::binary);
+    }
+    indexReader.clear();
+    indexReader.seekg(static_cast<std::streamoff>(position * sizeof(LogIndexRecord)));
+    indexReader.read(reinterpret_cast<char*>(&record), sizeof(record));
+    return indexReader.gcount() == sizeof(record);
+}
+
+// Indexes log lines that were written after the last index entry. Normally that
+// is at most one line; on the first start against an old log it is all of it.
+// A new entry starts at every line beginning with a "[YYYY-MM-DD HH:MM:SS]"
+// stamp, continuation lines (e.g. "\nCHAT" payloads) belong to the one before.
+void ChatLog::indexTail(uint64_t fromOffset) {
+    std::ifstream logDescriptor(logPath, std::ios::binary);
+    logDescriptor.seekg(static_cast<std::streamoff>(fromOffset));
+
+    std::vector<LogIndexRecord> recovered;
+    uint64_t position = fromOffset;
+    std::string line;
+    while (std::getline(logDescriptor, line)) {
+        uint64_t lineLength = line.size() + (logDescriptor.eof() ? 0 : 1);
+        uint32_t timestamp = 0;
+        if (parseTimestamp(line, timestamp) || recovered.empty()) {
+            recovered.push_back({ position, 0, timestamp });
+        }
+        recovered.back().length += static_cast<uint32_t>(lineLength);
+        position += lineLength;
+    }
+
+    for (const auto& record : recovered) {
+        indexStream.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    indexStream.flush();
+    recordCount += recovered.size();
+    std::cout << "Indexed " << recovered.size() << " chat log entries" << std::endl;
+}
+
+bool ChatLog::parseTimestamp(const std::string& line, uint32_t& timestamp) {
+    std::tm stamp{};
+    char closing = 0;
+    if (line.size() < 21 || line[0] != '[' ||
+        std::sscanf(line.c_str(), "[%4d-%2d-%2d %2d:%2d:%2d%c", &stamp.tm_year, &stamp.tm_mon, &stamp.tm_mday,
+            &stamp.tm_hour, &stamp.tm_min, &stamp.tm_sec, &closing) != 7 || closing != ']') {
+        return false;
+    }
+    stamp.tm_year -= 1900;
+    stamp.tm_mon -= 1;
+    stamp.tm_isdst = -1;
+    timestamp = static_cast<uint32_t>(std::mktime(&stamp));
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <ctime>
+
+namespace history {
+    // "$resume" replays at most this many records; a client further behind is
+    // told how many it missed and asks again with "all" if it wants them.
+    constexpr uint64_t RESUME_LIMIT{ 1000 };
+}
+
+// One fixed-size entry per logged line in Record_of_chat.txt.idx. The record
+// number is the message sequence (first record is sequence 1), so the last
+// entry doubles as the checkpoint: it holds the last sequence and where the
+// indexed part of the log ends.
+struct LogIndexRecord {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t timestamp;
+};
+static_assert(sizeof(LogIndexRecord) == 16, "index records must stay 16 bytes");
+
+// Append-only chat log with a sidecar index. Startup only reads the last index
+// entry and whatever log bytes were written after it, so boot time does not
+// depend on how large the history has grown.
+class ChatLog {
+public:
+    explicit ChatLog(const std::string& logPath);
+    void open();
+    uint64_t append(const std::string& notification);
+    uint64_t lastSequence() const;
+    uint64_t sizeInBytes() const;
+    bool findBySequence(uint64_t sequence, LogIndexRecord& record);
+    uint64_t sequenceSince(std::time_t since);
+    uint64_t offsetOf(uint64_t sequence);
+    std::string read(uint64_t fromOffset, uint64_t toOffset) const;
+    static std::vector<std::string> splitRecords(const std::string& content);
+
+private:
+    bool readRecord(uint64_t position, LogIndexRecord& record);
+    void indexTail(uint64_t fromOffset);
+    static bool parseTimestamp(const std::string& line, uint32_t& timestamp);
+    std::string logPath;
+    std::string indexPath;
+    std::ofstream logStream;
+    std::ofstream indexStream;
+    std::ifstream indexReader;
+    uint64_t recordCount;
+    uint64_t logSize;
+};
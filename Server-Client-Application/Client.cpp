@@ -1,22 +1,43 @@
 #include "Client.h"
 #include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <cstring>
+#include <sstream>
+#include <afunix.h>
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #pragma warning(disable: 4996)
 
-Client::Client() : logPath("connected_clients.txt"), isActive(false) {
+Client::Client() : logPath("connected_clients.txt"), isActive(false), peerLink(false), compressionCodec(compression::NONE),
+    sessionLimits(Environment::system().clock), localLink(false), chargedInputBytes(0), serverSide(false), rosterVersion(0),
+    lowLatency(false), pingRun(std::make_unique<PingRun>()) {
     initializeWinsock();
     createTcpSocket();
     createUdpSocket();
     configureUdpSocket();
 }
 
+// A session on the server: wraps the accepted socket and opens nothing else,
+// so an idle connection costs little more than this object. Its rate limits
+// run on the server's clock.
+Client::Client(SOCKET acceptedSocket, const TimeSource& clock) : soc_Client(acceptedSocket), udpClientEndpoint(INVALID_SOCKET), isActive(false),
+    peerLink(false), compressionCodec(compression::NONE), sessionLimits(clock), localLink(false), chargedInputBytes(0), serverSide(true), rosterVersion(0),
+    lowLatency(false) {
+}
+
 Client::~Client() {
+    if (serverSide) {
+        return;
+    }
     if (isActive) {
         terminateLink();
     }
+    if (uploader.joinable()) {
+        uploader.join();
+    }
     closesocket(udpClientEndpoint);
     cleanupWinsock();
 }
@@ -122,6 +143,9 @@ void Client::connectToServer(const char* hostIP, const char* listeningPort) {
     addressOfServer.sin_addr.s_addr = inet_addr(hostIP);
     addressOfServer.sin_port = htons(atoi(listeningPort));
 
+    if (lowLatency) {
+        Environment::system().sockets.tuneForLatency(soc_Client);
+    }
     int finalOutput = connect(soc_Client, (SOCKADDR*)&addressOfServer, sizeof(addressOfServer));
     if (finalOutput == SOCKET_ERROR) {
         throw std::runtime_error("[Error] Failed to connect to server. Code: " + std::to_string(WSAGetLastError()));
@@ -130,6 +154,58 @@ void Client::connectToServer(const char* hostIP, const char* listeningPort) {
     isActive = true;
 }
 
+// Same-host clients skip the TCP stack through the server's AF_UNIX listener.
+void Client::connectToLocal(const std::string& socketPath) {
+    closesocket(soc_Client);
+    soc_Client = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (soc_Client == INVALID_SOCKET) {
+        handleError("Failed to create local socket");
+    }
+    sockaddr_un addressOfServer{};
+    addressOfServer.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addressOfServer.sun_path)) {
+        throw std::runtime_error("[Error] Local socket path is too long: " + socketPath);
+    }
+    memcpy(addressOfServer.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    int finalOutput = connect(soc_Client, (SOCKADDR*)&addressOfServer, sizeof(addressOfServer));
+    if (finalOutput == SOCKET_ERROR) {
+        throw std::runtime_error("[Error] Failed to connect to local server. Code: " + std::to_string(WSAGetLastError()));
+    }
+
+    isActive = true;
+    localLink = true;
+}
+
+// Asks for the shared-memory transport. Must run before the reader thread
+// starts: frames that arrive ahead of the answer are printed here, and
+// everything after it comes through the rings.
+bool Client::requestSharedMemory()
+{
+    checkConnection();
+    if (!localLink)
+    {
+        return false;
+    }
+    std::string command = "$shm";
+    sendFrame(command);
+    for (;;)
+    {
+        std::string notification = receiveFrame();
+        if (notification.find("SHM ") == 0)
+        {
+            channel = SharedChannel::open(notification.substr(4), soc_Client);
+            return true;
+        }
+        if (notification.find("SHM_REFUSED") == 0)
+        {
+            return false;
+        }
+        bool indicator = false;
+        std::cout << processMessage(notification, indicator);
+    }
+}
+
 void Client::processServerResponse(const std::string& responseConst)
 {
     std::string response = responseConst; // Create a non-const copy
@@ -164,6 +240,15 @@ void Client::processServerResponse(const std::string& responseConst)
         i++;
     }
 
+    // A busy server turned the connection away with a framed "SERVER_BUSY <ms>".
+    size_t busy = response.find("SERVER_BUSY ");
+    if (busy != std::string::npos)
+    {
+        long long retryAfter = std::atoll(response.c_str() + busy + 12);
+        terminateLink();
+        throw std::runtime_error("[Error] Server is busy. Please try again in " + std::to_string((retryAfter + 999) / 1000) + " seconds.");
+    }
+
     if (serverLimitReached)
     {
         terminateLink();
@@ -195,15 +280,107 @@ void Client::setUserAlias(std::string _username)
     this->userAlias = _username;
 }
 
+void Client::markPeerLink()
+{
+    peerLink = true;
+}
+bool Client::isPeerLink() const
+{
+    return peerLink;
+}
+void Client::setPeerNode(const std::string& nodeId)
+{
+    peerNode = nodeId;
+}
+std::string Client::getPeerNode() const
+{
+    return peerNode;
+}
+void Client::setCompression(compression::Codec codec)
+{
+    compressionCodec = codec;
+}
+compression::Codec Client::getCompression() const
+{
+    return compressionCodec;
+}
+SessionLimits& Client::limits()
+{
+    return sessionLimits;
+}
+std::string& Client::inputBuffer()
+{
+    return pendingInput;
+}
+void Client::markLocal()
+{
+    localLink = true;
+}
+bool Client::isLocal() const
+{
+    return localLink;
+}
+void Client::setRemoteHost(const std::string& host)
+{
+    remoteAddress = host;
+}
+const std::string& Client::remoteHost() const
+{
+    return remoteAddress;
+}
+void Client::attachSharedChannel(std::unique_ptr<SharedChannel> transport)
+{
+    channel = std::move(transport);
+}
+SharedChannel* Client::sharedChannel() const
+{
+    return channel.get();
+}
+Outbox* Client::outbox() const
+{
+    return pendingOutput.get();
+}
+Outbox& Client::ensureOutbox()
+{
+    if (!pendingOutput)
+    {
+        pendingOutput.reset(new Outbox());
+    }
+    return *pendingOutput;
+}
+void Client::releaseOutbox()
+{
+    pendingOutput.reset();
+}
+size_t& Client::chargedInput()
+{
+    return chargedInputBytes;
+}
+std::unique_ptr<Upload>& Client::upload()
+{
+    return incomingUpload;
+}
+std::deque<std::unique_ptr<Download>>& Client::downloads()
+{
+    return outgoingFiles;
+}
+bool Client::transmitting() const
+{
+    return !outgoingFiles.empty() && outgoingFiles.front()->pending();
+}
+
 void Client::enrollUser(std::string userAlias)
 {
     checkConnection();
 
     this->userAlias = userAlias;
     std::string CommandOfRegister = "$register " + userAlias;
+    if (compressionCodec != compression::NONE)
+    {
+        CommandOfRegister += " " + std::string(compression::codecName(compressionCodec));
+    }
 
-    sendCommandSize(CommandOfRegister);
-    sendCommand(CommandOfRegister);
+    sendFrame(CommandOfRegister);
 
     std::string response = receiveServerResponse();
     processServerResponse(response);
@@ -220,16 +397,31 @@ void Client::checkConnection()
 void Client::sendCommandSize(const std::string& command)
 {
     int lengthOfCommand = static_cast<int>(command.length());
-    int finalOutput = send(soc_Client, reinterpret_cast<char*>(&lengthOfCommand), sizeof(lengthOfCommand), 0);
-    if (finalOutput == SOCKET_ERROR)
-    {
-        throw std::runtime_error("[Error] Failed to send command size. Code: " + std::to_string(WSAGetLastError()));
-    }
+    transmitBytes(reinterpret_cast<char*>(&lengthOfCommand), sizeof(lengthOfCommand));
 }
 
 void Client::sendCommand(const std::string& command)
 {
-    int finalOutput = send(soc_Client, command.c_str(), command.length(), 0);
+    transmitBytes(command.c_str(), static_cast<int>(command.length()));
+}
+
+// The size and the body go out under one lock, so an upload streaming from its
+// own thread never splits a frame typed at the prompt.
+void Client::sendFrame(const std::string& command)
+{
+    std::lock_guard<std::mutex> lock(sendMutex);
+    sendCommandSize(command);
+    sendCommand(command);
+}
+
+void Client::transmitBytes(const char* bytes, int length)
+{
+    if (channel)
+    {
+        channel->send(bytes, length);
+        return;
+    }
+    int finalOutput = send(soc_Client, bytes, length, 0);
     if (finalOutput == SOCKET_ERROR)
     {
         throw std::runtime_error("[Error] Failed to send command. Code: " + std::to_string(WSAGetLastError()));
@@ -252,22 +444,273 @@ std::string Client::receiveServerResponse()
 void Client::runInstruction(std::string command)
 {
     checkConnection();
-    sendCommandSize(command);
-    sendCommand(command);
+    sendFrame(command);
     std::cout << "[Executed] " << command << std::endl;
 }
 
+void Client::fetchFile(const std::string& digest)
+{
+    std::string token;
+    {
+        std::lock_guard<std::mutex> lock(tokenMutex);
+        auto found = fetchTokens.find(digest);
+        if (found != fetchTokens.end()) {
+            token = found->second;
+        }
+    }
+    runInstruction(token.empty() ? "$fetch " + digest : "$fetch " + digest + " " + token);
+}
+
 void Client::sendMessage(std::string notification)
 {
     checkConnection();
     std::string chatCommand = "$chat " + notification;
-    sendCommandSize(chatCommand);
-    sendCommand(chatCommand);
+    sendFrame(chatCommand);
     std::cout << "[Sent out] " << notification << std::endl;
 }
 
+// "$send <alias|all> <file>": announces the upload and streams it from a
+// background thread so the prompt stays usable. Every chunk is its own frame,
+// so chat typed meanwhile goes out between two of them.
+void Client::sendFile(const std::string& recipient, const std::string& path)
+{
+    checkConnection();
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        throw std::runtime_error("[Error] Unable to open " + path);
+    }
+    uint64_t size = static_cast<uint64_t>(file.tellg());
+    {
+        std::lock_guard<std::mutex> lock(uploadProgress.mutex);
+        if (!uploadProgress.finished)
+        {
+            throw std::runtime_error("[Error] An upload is already in progress.");
+        }
+    }
+    // The previous upload's thread may still be on its way out; it must not
+    // see the fresh state.
+    if (uploader.joinable())
+    {
+        uploader.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(uploadProgress.mutex);
+        uploadProgress.acknowledged = 0;
+        uploadProgress.accepted = false;
+        uploadProgress.finished = false;
+    }
+    sendFrame("$upload " + recipient + " " + std::to_string(size) + " " + attachment::baseName(path));
+    uploader = std::thread(&Client::streamUpload, this, path, size);
+    std::cout << "[Sending] " << path << " (" << size << " bytes) to " << recipient << std::endl;
+}
+
+// Waits for SEND_READY, then keeps at most WINDOW_CHUNKS chunks beyond the
+// last SEND_ACK in flight. An empty chunk tells the server to discard the upload.
+void Client::streamUpload(std::string path, uint64_t size)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string chunk;
+    uint64_t sent = 0;
+    try
+    {
+        while (sent < size)
+        {
+            {
+                std::unique_lock<std::mutex> lock(uploadProgress.mutex);
+                uploadProgress.changed.wait(lock, [&]() {
+                    return uploadProgress.finished || (uploadProgress.accepted &&
+                        sent - uploadProgress.acknowledged < attachment::WINDOW_CHUNKS * attachment::CHUNK_SIZE);
+                    });
+                if (uploadProgress.finished)
+                {
+                    return;
+                }
+            }
+            size_t length = static_cast<size_t>(std::min<uint64_t>(attachment::CHUNK_SIZE, size - sent));
+            chunk.assign("$chunk ");
+            chunk.resize(7 + length);
+            if (!file.read(&chunk[7], length))
+            {
+                std::cerr << "Error: " << path << " changed while it was being sent" << std::endl;
+                sendFrame("$chunk ");
+                break;
+            }
+            sendFrame(chunk);
+            sent += length;
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Error: " << ex.what() << std::endl;
+    }
+    if (sent < size)
+    {
+        std::lock_guard<std::mutex> lock(uploadProgress.mutex);
+        uploadProgress.finished = true;
+    }
+}
+
+void Client::setLowLatency(bool enabled)
+{
+    lowLatency = enabled;
+}
+
+void Client::ping(int count)
+{
+    checkConnection();
+    std::lock_guard<std::mutex> lock(pingRun->mutex);
+    if (pingRun->remaining > 0)
+    {
+        throw std::runtime_error("[Error] A ping run is already in progress.");
+    }
+    pingRun->roundTrips = LatencyHistogram();
+    pingRun->remaining = std::max(count, 1);
+    pingRun->sentAt = std::chrono::steady_clock::now();
+    sendFrame("$ping " + std::to_string(pingRun->remaining));
+}
+
+// "PONG <n>" answers the ping sent with n runs left; anything else is stale.
+std::string Client::trackPing(const std::string& notification)
+{
+    auto arrived = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(pingRun->mutex);
+    if (pingRun->remaining == 0 || std::atoi(notification.c_str() + 4) != pingRun->remaining)
+    {
+        return "";
+    }
+    pingRun->roundTrips.record(std::chrono::duration_cast<std::chrono::microseconds>(arrived - pingRun->sentAt));
+    if (--pingRun->remaining > 0)
+    {
+        pingRun->sentAt = std::chrono::steady_clock::now();
+        sendFrame("$ping " + std::to_string(pingRun->remaining));
+        return "";
+    }
+    return "\033[2K\rPING " + pingRun->roundTrips.report() + "\nEnter command or notification: ";
+}
+
+// The server throttled the run: no PONG is coming for the ping in flight.
+std::string Client::stopPing(const std::string& notification)
+{
+    std::lock_guard<std::mutex> lock(pingRun->mutex);
+    pingRun->remaining = 0;
+    std::string shown = "\033[2K\r" + notification;
+    if (pingRun->roundTrips.count() > 0)
+    {
+        shown += "\nPING " + pingRun->roundTrips.report();
+    }
+    return shown + "\nEnter command or notification: ";
+}
+
+void Client::trackUpload(const std::string& notification)
+{
+    std::lock_guard<std::mutex> lock(uploadProgress.mutex);
+    if (notification.find("SEND_READY") == 0)
+    {
+        uploadProgress.accepted = true;
+    }
+    else if (notification.find("SEND_ACK") == 0)
+    {
+        uploadProgress.acknowledged = std::strtoull(notification.c_str() + 9, nullptr, 10);
+    }
+    else
+    {
+        uploadProgress.finished = true;
+    }
+    uploadProgress.changed.notify_all();
+}
+
+// "FILE_DATA <digest> <offset> <size>\n<bytes>": chunks arrive in order and
+// are appended to downloads\<name>. Returns the text to display once complete.
+std::string Client::receiveAttachment(const std::string& notification)
+{
+    size_t headerEnd = notification.find('\n');
+    if (headerEnd == std::string::npos)
+    {
+        return "";
+    }
+    std::istringstream header(notification.substr(10, headerEnd - 10));
+    std::string digest;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    header >> digest >> offset >> size;
+    auto offered = offeredFiles.find(digest);
+    std::string path = std::string(attachment::DOWNLOAD_DIRECTORY) + "\\" + (offered != offeredFiles.end() ? offered->second : digest);
+    if (offset == 0)
+    {
+        CreateDirectoryA(attachment::DOWNLOAD_DIRECTORY, nullptr);
+    }
+    size_t length = notification.size() - headerEnd - 1;
+    std::ofstream file(path, std::ios::binary | (offset == 0 ? std::ios::trunc : std::ios::app));
+    file.write(notification.data() + headerEnd + 1, length);
+    if (!file.good())
+    {
+        return "\033[2K\rError: Unable to write " + path + "\nEnter command or notification: ";
+    }
+    if (offset + length < size)
+    {
+        return "";
+    }
+    return "\033[2K\rSaved " + path + " (" + std::to_string(size) + " bytes)\nEnter command or notification: ";
+}
+
+// "ROSTER <version> a,b,c" replaces the local copy of who is online;
+// "PRESENCE <version> JOIN|LEAVE|RENAME ..." moves it on by one version. A
+// delta that does not follow on means one was missed, so the snapshot is
+// asked for again.
+std::string Client::applyPresence(const std::string& notification)
+{
+    std::istringstream fields(notification);
+    std::string kind, change, alias;
+    uint64_t version = 0;
+    fields >> kind >> version;
+    if (kind == "ROSTER") {
+        std::string names;
+        fields >> names;
+        onlineUsers.clear();
+        std::istringstream list(names);
+        while (std::getline(list, alias, ',')) {
+            onlineUsers.insert(alias);
+        }
+        rosterVersion = version;
+        std::string shown;
+        for (const auto& user : onlineUsers) {
+            shown += (shown.empty() ? "" : ", ") + user;
+        }
+        return "\033[2K\rOnline (" + std::to_string(onlineUsers.size()) + "): " + shown + "\nEnter command or notification: ";
+    }
+    if (version != rosterVersion + 1) {
+        sendFrame("$presence");
+        return "";
+    }
+    rosterVersion = version;
+    fields >> change >> alias;
+    std::string shown;
+    if (change == "JOIN") {
+        onlineUsers.insert(alias);
+        shown = alias + " is online";
+    }
+    else if (change == "LEAVE") {
+        onlineUsers.erase(alias);
+        shown = alias + " went offline";
+    }
+    else if (change == "RENAME") {
+        std::string renamed;
+        fields >> renamed;
+        onlineUsers.erase(alias);
+        onlineUsers.insert(renamed);
+        shown = alias + " is now " + renamed;
+    }
+    return "\033[2K\r* " + shown + " (" + std::to_string(onlineUsers.size()) + " online)\nEnter command or notification: ";
+}
+
 void Client::terminateLink()
 {
+    {
+        std::lock_guard<std::mutex> lock(uploadProgress.mutex);
+        uploadProgress.finished = true;
+        uploadProgress.changed.notify_all();
+    }
     if (!isActive)
     {
         return;
@@ -294,12 +737,70 @@ std::string Client::processMessage(const std::string& notification, bool& indica
     else if (notification.find("CHAT") == 0) {
         return "\033[2K\r" + notification + "\nEnter command or notification: ";
     }
+    else if (notification.find("ROSTER") == 0 || notification.find("PRESENCE") == 0) {
+        return applyPresence(notification);
+    }
     else if (notification.find("LIST") == 0) {
         return "\033[2K\r" + notification.substr(5) + "\nEnter command or notification: ";
     }
     else if (notification.find("LOG") == 0) {
-        recordLog(notification.substr(4));
-        return "\033[2K\r" + notification.substr(4) + "\nEnter command or notification: ";
+        return "\033[2K\r" + syncLog(notification.substr(4)) + "\nEnter command or notification: ";
+    }
+    else if (notification.find("THROTTLED Too many pings") == 0) {
+        return stopPing(notification);
+    }
+    else if (notification.find("METRICS") == 0 || notification.find("THROTTLED") == 0 || notification.find("SEARCH") == 0 ||
+        notification.find("STATS") == 0) {
+        return "\033[2K\r" + notification + "\nEnter command or notification: ";
+    }
+    else if (notification.find("SEND_READY") == 0 || notification.find("SEND_ACK") == 0) {
+        trackUpload(notification);
+        return "";
+    }
+    else if (notification.find("SEND_DONE") == 0) {
+        // "SEND_DONE <name> sha256:<digest> token:<token>"
+        trackUpload(notification);
+        size_t tokenPos = notification.rfind(" token:");
+        size_t digestPos = notification.rfind(" sha256:", tokenPos);
+        if (tokenPos == std::string::npos || digestPos == std::string::npos) {
+            return "\033[2K\r" + notification + "\nEnter command or notification: ";
+        }
+        {
+            std::lock_guard<std::mutex> lock(tokenMutex);
+            fetchTokens[notification.substr(digestPos + 8, tokenPos - digestPos - 8)] = notification.substr(tokenPos + 7);
+        }
+        return "\033[2K\r" + notification.substr(0, tokenPos) + "\nEnter command or notification: ";
+    }
+    else if (notification.find("SEND_REFUSED") == 0) {
+        trackUpload(notification);
+        return "\033[2K\r" + notification + "\nEnter command or notification: ";
+    }
+    else if (notification.find("FILE_DATA") == 0) {
+        return receiveAttachment(notification);
+    }
+    else if (notification.find("FILE ") == 0) {
+        // "FILE <digest> <token> <size> <sender> <name>"
+        std::istringstream offer(notification.substr(5));
+        std::string digest, token, size, sender, name;
+        offer >> digest >> token >> size >> sender;
+        std::getline(offer >> std::ws, name);
+        offeredFiles[digest] = attachment::baseName(name);
+        {
+            std::lock_guard<std::mutex> lock(tokenMutex);
+            fetchTokens[digest] = token;
+        }
+        return "\033[2K\r" + sender + " sent " + name + " (" + size + " bytes), use $fetch " + digest +
+            " to download it\nEnter command or notification: ";
+    }
+    else if (notification.find("PONG") == 0) {
+        return trackPing(notification);
+    }
+    else if (notification.find("RESUME_GAP") == 0) {
+        return "\033[2K\r" + notification.substr(11) + " messages were logged while you were away, use $resume all to fetch them" +
+            "\nEnter command or notification: ";
+    }
+    else if (notification.find("FETCH_REFUSED") == 0) {
+        return "\033[2K\r" + notification + "\nEnter command or notification: ";
     }
     else if (notification.find("EXIT") == 0) {
         indicator = true;
@@ -309,6 +810,10 @@ std::string Client::processMessage(const std::string& notification, bool& indica
         indicator = true;
         return "Server is currently full";
     }
+    else if (notification.find("SERVER_BUSY") == 0) {
+        indicator = true;
+        return "Server is busy, try again in " + notification.substr(12) + " ms";
+    }
     else {
         return "";
     }
@@ -324,31 +829,101 @@ void Client::recordLog(const std::string& logMsg) {
     }
 }
 
-std::string Client::fetchCommunication(bool& indicator) {
-    if (!isActive) {
-        throw std::runtime_error("Error: Client not isActive.");
+// The local log mirrors the server's: a "LOG <first> <last>\n<records>" reply
+// is appended whole when it starts right after the last synced record, or
+// when nothing was synced yet, and otherwise only shown. Records are never counted in the text, where a chat
+// line can pass for the start of one; the server's numbers are taken as they
+// are. A $getlog that overlaps the mirror or skips ahead of it leaves it
+// alone, and the next $resume fills it exactly. Returns the text to display.
+std::string Client::syncLog(const std::string& content) {
+    size_t headerEnd = content.find('\n');
+    uint64_t firstSequence = 0;
+    uint64_t lastSequence = 0;
+    std::istringstream header(content.substr(0, headerEnd));
+    if (headerEnd == std::string::npos || !(header >> firstSequence >> lastSequence) || firstSequence == 0) {
+        recordLog(content);
+        return content;
+    }
+    std::string body = content.substr(headerEnd + 1);
+    uint64_t lastSynced = lastSyncedSequence();
+    if ((lastSynced > 0 && firstSequence != lastSynced + 1) || lastSequence < firstSequence) {
+        return body;
+    }
+    std::ofstream logDescriptor(logPath, std::ios::binary | std::ios::app);
+    logDescriptor << body;
+    if (!logDescriptor.good()) {
+        std::cerr << "Error: Unable to open log file." << std::endl;
+        return body;
     }
+    std::ofstream sequenceDescriptor(logPath + ".seq", std::ios::trunc);
+    sequenceDescriptor << lastSequence << std::endl;
+    return body;
+}
 
-    for (;;) {
-        int SizeOfMsg = 0;
-        int nbytes = recv(soc_Client, reinterpret_cast<char*>(&SizeOfMsg), sizeof(SizeOfMsg), 0);
-        if (nbytes <= 0) {
-            throw std::runtime_error("Error: Unable to receive notification size. Code: " + std::to_string(WSAGetLastError()));
-        }
+uint64_t Client::lastSyncedSequence() const {
+    uint64_t lastSynced = 0;
+    std::ifstream sequenceDescriptor(logPath + ".seq");
+    sequenceDescriptor >> lastSynced;
+    return lastSynced;
+}
 
-        std::vector<char> holder(SizeOfMsg);
-        nbytes = recv(soc_Client, holder.data(), SizeOfMsg, 0);
+// Fetches what was logged since the last sync. A client that never synced
+// starts without history and can still ask for it with $getlog. Unless
+// `everything` is set, the server only says how much was missed when that
+// is more than it replays by default.
+void Client::resumeHistory(bool everything)
+{
+    uint64_t lastSynced = lastSyncedSequence();
+    if (lastSynced > 0)
+    {
+        runInstruction("$resume " + std::to_string(lastSynced) + (everything ? " all" : ""));
+    }
+}
+
+// Large frames (e.g. $getlog) arrive over several recv calls.
+void Client::receiveExact(char* holder, int length) {
+    if (channel) {
+        channel->receiveExact(holder, length);
+        return;
+    }
+    int bytesRead = 0;
+    while (bytesRead < length) {
+        int nbytes = recv(soc_Client, holder + bytesRead, length - bytesRead, 0);
         if (nbytes <= 0) {
             throw std::runtime_error("Error: Unable to receive notification. Code: " + std::to_string(WSAGetLastError()));
         }
+        bytesRead += nbytes;
+    }
+}
+
+std::string Client::fetchCommunication(bool& indicator) {
+    if (!isActive) {
+        throw std::runtime_error("Error: Client not isActive.");
+    }
 
-        std::string notification(holder.begin(), holder.end());
-        std::string processedMessage = processMessage(notification, indicator);
+    for (;;) {
+        std::string processedMessage = processMessage(receiveFrame(), indicator);
         if (!processedMessage.empty()) {
             return processedMessage;
         }
     }
 }
 
+std::string Client::receiveFrame() {
+    uint32_t SizeOfMsg = 0;
+    receiveExact(reinterpret_cast<char*>(&SizeOfMsg), sizeof(SizeOfMsg));
+    bool isCompressed = (SizeOfMsg & compression::COMPRESSED_FLAG) != 0;
+    SizeOfMsg &= ~compression::COMPRESSED_FLAG;
+
+    std::vector<char> holder(SizeOfMsg);
+    receiveExact(holder.data(), static_cast<int>(SizeOfMsg));
+
+    std::string notification(holder.begin(), holder.end());
+    if (isCompressed) {
+        notification = compression::decompressPayload(compressionCodec, notification);
+    }
+    return notification;
+}
+
 
 
@@ -1,18 +1,75 @@
 #pragma once
 
 #include <string>
+#include <memory>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 #include <winsock2.h>
+#include "Compression.h"
+#include "FileStore.h"
+#include "RateLimiter.h"
+#include "SharedChannel.h"
+#include "LatencyHistogram.h"
 
 #pragma comment(lib, "Ws2_32.lib")
 
+// Server side: frames a non-blocking socket could not take yet. Allocated
+// only while something is queued. Broadcasts may be dropped under memory
+// pressure; direct replies never are.
+struct OutboundFrame {
+    std::string bytes;
+    bool droppable;
+};
+struct Outbox {
+    std::deque<OutboundFrame> frames;
+    size_t headOffset = 0;
+    size_t bytes = 0;
+    bool shutdownWhenFlushed = false;
+};
+
+// Client side: the listener thread hands the server's answers about an upload
+// to the thread streaming it.
+struct UploadProgress {
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint64_t acknowledged = 0;
+    bool accepted = false;
+    bool finished = true;
+};
+
+// Client side: a $ping run. The listener thread sends each ping when the
+// previous PONG arrives, so exactly one is in flight.
+struct PingRun {
+    std::mutex mutex;
+    LatencyHistogram roundTrips;
+    int remaining = 0;
+    std::chrono::steady_clock::time_point sentAt;
+};
+
 class Client {
 public:
     Client();
+    Client(SOCKET acceptedSocket, const TimeSource& clock);
     ~Client();
     void connectToServer(const char* hostIP, const char* listeningPort);
+    void connectToLocal(const std::string& socketPath);
+    bool requestSharedMemory();
+    void resumeHistory(bool everything = false);
     void enrollUser(std::string userAlias);
     void runInstruction(std::string command);
     void sendMessage(std::string notification);
+    void sendFile(const std::string& recipient, const std::string& path);
+    // "$fetch <digest>", with the token the server handed out for it if any.
+    void fetchFile(const std::string& digest);
+    // Times `count` round trips; the percentiles arrive as a notification.
+    void ping(int count);
+    // Skip Nagle and take the loopback fast path; call before connecting.
+    void setLowLatency(bool enabled);
     void terminateLink();
     std::string fetchCommunication(bool& indicator);
     bool isLinked();
@@ -21,6 +78,29 @@ public:
     std::string getUserAlias() const;
     void setUserAlias(std::string newUsername);
     void awaitUdpAnnouncement();
+    void markPeerLink();
+    bool isPeerLink() const;
+    void setPeerNode(const std::string& nodeId);
+    std::string getPeerNode() const;
+    void setCompression(compression::Codec codec);
+    compression::Codec getCompression() const;
+    SessionLimits& limits();
+    std::string& inputBuffer();
+    void markLocal();
+    bool isLocal() const;
+    // Server side: the host the connection came from, "" when unknown.
+    void setRemoteHost(const std::string& host);
+    const std::string& remoteHost() const;
+    void attachSharedChannel(std::unique_ptr<SharedChannel> transport);
+    SharedChannel* sharedChannel() const;
+    Outbox* outbox() const;
+    Outbox& ensureOutbox();
+    void releaseOutbox();
+    size_t& chargedInput();
+    std::unique_ptr<Upload>& upload();
+    std::deque<std::unique_ptr<Download>>& downloads();
+    // A TransmitFile is writing to the socket; nothing else may until it ends.
+    bool transmitting() const;
 
 private:
     void initializeWinsock();
@@ -31,18 +111,56 @@ private:
     void handleError(const std::string& errorMessage);
     std::string processMessage(const std::string& notification, bool& indicator);
     void recordLog(const std::string& logMsg);
+    std::string syncLog(const std::string& content);
+    uint64_t lastSyncedSequence() const;
     void checkConnection();
     void sendCommandSize(const std::string& command);
     void sendCommand(const std::string& command);
+    void sendFrame(const std::string& command);
+    void streamUpload(std::string path, uint64_t size);
+    void trackUpload(const std::string& notification);
+    std::string trackPing(const std::string& notification);
+    std::string stopPing(const std::string& notification);
+    std::string receiveAttachment(const std::string& notification);
+    std::string applyPresence(const std::string& notification);
     std::string receiveServerResponse();
     void shutdownConnection();
     void processServerResponse(const std::string& response);
     void bindUdpSocket(sockaddr_in& AddressOfUdpClient);
     void setUdpSocketBroadcast();
     std::string receiveUdpBroadcast();
+    void receiveExact(char* holder, int length);
+    void transmitBytes(const char* bytes, int length);
+    std::string receiveFrame();
     SOCKET soc_Client;
     SOCKET udpClientEndpoint;
     bool isActive;
     std::string userAlias;
     std::string logPath;
+    bool peerLink;
+    std::string peerNode;
+    std::string remoteAddress;
+    compression::Codec compressionCodec;
+    SessionLimits sessionLimits;
+    std::string pendingInput;
+    bool localLink;
+    std::unique_ptr<SharedChannel> channel;
+    std::unique_ptr<Outbox> pendingOutput;
+    size_t chargedInputBytes;
+    std::unique_ptr<Upload> incomingUpload;
+    std::deque<std::unique_ptr<Download>> outgoingFiles;
+    bool serverSide;
+    std::mutex sendMutex;
+    UploadProgress uploadProgress;
+    std::thread uploader;
+    std::map<std::string, std::string> offeredFiles;
+    // Fetch tokens by digest, from FILE offers and our own SEND_DONE.
+    std::mutex tokenMutex;
+    std::map<std::string, std::string> fetchTokens;
+    std::set<std::string> onlineUsers;
+    uint64_t rosterVersion;
+    bool lowLatency;
+    // Client side only; its histogram would otherwise add 8 KB to every
+    // session the server holds.
+    std::unique_ptr<PingRun> pingRun;
 };
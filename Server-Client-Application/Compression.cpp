@@ -0,0 +1,203 @@
+#include "Compression.h"
+#include <windows.h>
+#include <compressapi.h>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+
+#pragma comment(lib, "Cabinet.lib")
+
+namespace compression {
+
+    static DWORD algorithmOf(Codec codec) {
+        switch (codec) {
+        case XPRESS_HUFF:
+            return COMPRESS_ALGORITHM_XPRESS_HUFF;
+        case MSZIP:
+            return COMPRESS_ALGORITHM_MSZIP;
+        default:
+            return COMPRESS_ALGORITHM_XPRESS;
+        }
+    }
+
+    // Compressor handles are costly to create, so each thread keeps one per codec.
+    struct HandleCache {
+        COMPRESSOR_HANDLE compressors[CODEC_COUNT] = {};
+        DECOMPRESSOR_HANDLE decompressors[CODEC_COUNT] = {};
+        ~HandleCache() {
+            for (int i = 0; i < CODEC_COUNT; i++) {
+                if (compressors[i] != NULL) {
+                    CloseCompressor(compressors[i]);
+                }
+                if (decompressors[i] != NULL) {
+                    CloseDecompressor(decompressors[i]);
+                }
+            }
+        }
+    };
+    static thread_local HandleCache handleCache;
+
+    Codec codecFromName(const std::string& name) {
+        if (name == "xpress") {
+            return XPRESS;
+        }
+        if (name == "huff") {
+            return XPRESS_HUFF;
+        }
+        if (name == "mszip") {
+            return MSZIP;
+        }
+        return NONE;
+    }
+
+    const char* codecName(Codec codec) {
+        switch (codec) {
+        case XPRESS:
+            return "xpress";
+        case XPRESS_HUFF:
+            return "huff";
+        case MSZIP:
+            return "mszip";
+        default:
+            return "none";
+        }
+    }
+
+    bool compressBlock(Codec codec, const char* data, size_t size, std::string& block) {
+        COMPRESSOR_HANDLE& compressor = handleCache.compressors[codec];
+        if (compressor == NULL && !CreateCompressor(algorithmOf(codec), NULL, &compressor)) {
+            std::cerr << "Error creating " << codecName(codec) << " compressor: " << GetLastError() << std::endl;
+            return false;
+        }
+        SIZE_T requiredSize = 0;
+        if (!Compress(compressor, data, size, NULL, 0, &requiredSize) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            return false;
+        }
+        block.resize(requiredSize);
+        SIZE_T compressedSize = 0;
+        if (!Compress(compressor, data, size, &block[0], block.size(), &compressedSize)) {
+            std::cerr << "Error compressing frame: " << GetLastError() << std::endl;
+            return false;
+        }
+        block.resize(compressedSize);
+        return true;
+    }
+
+    void appendBlock(std::string& payload, const std::string& block) {
+        uint32_t blockSize = static_cast<uint32_t>(block.size());
+        payload.append(reinterpret_cast<const char*>(&blockSize), sizeof(blockSize));
+        payload += block;
+    }
+
+    std::string decompressPayload(Codec codec, const std::string& payload) {
+        DECOMPRESSOR_HANDLE& decompressor = handleCache.decompressors[codec];
+        if (decompressor == NULL && !CreateDecompressor(algorithmOf(codec), NULL, &decompressor)) {
+            throw std::runtime_error("Error creating decompressor. Code: " + std::to_string(GetLastError()));
+        }
+
+        std::string notification;
+        size_t pos = 0;
+        while (pos + sizeof(uint32_t) <= payload.size()) {
+            uint32_t blockSize = 0;
+            memcpy(&blockSize, payload.data() + pos, sizeof(blockSize));
+            pos += sizeof(blockSize);
+            if (pos + blockSize > payload.size()) {
+                throw std::runtime_error("Truncated compressed frame");
+            }
+
+            SIZE_T requiredSize = 0;
+            if (!Decompress(decompressor, payload.data() + pos, blockSize, NULL, 0, &requiredSize) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+                throw std::runtime_error("Corrupt compressed frame. Code: " + std::to_string(GetLastError()));
+            }
+            size_t oldSize = notification.size();
+            notification.resize(oldSize + requiredSize);
+            SIZE_T decompressedSize = 0;
+            if (!Decompress(decompressor, payload.data() + pos, blockSize, &notification[oldSize], requiredSize, &decompressedSize)) {
+                throw std::runtime_error("Corrupt compressed frame. Code: " + std::to_string(GetLastError()));
+            }
+            notification.resize(oldSize + decompressedSize);
+            pos += blockSize;
+        }
+        return notification;
+    }
+
+    std::string encodeFrame(const std::string& payload) {
+        uint32_t header = static_cast<uint32_t>(payload.size()) | COMPRESSED_FLAG;
+        std::string frame(reinterpret_cast<const char*>(&header), sizeof(header));
+        frame += payload;
+        return frame;
+    }
+}
+
+CompressedSegments::CompressedSegments(const std::string& logPath, compression::Codec codec)
+    : storePath(logPath + "." + compression::codecName(codec)), codec(codec), loaded(false), sealedCount(0), storeSize(0) {
+}
+
+// Counts the segments already on disk and drops a torn trailing record.
+void CompressedSegments::load() {
+    loaded = true;
+    std::error_code error;
+    if (!std::filesystem::exists(storePath, error)) {
+        return;
+    }
+    uint64_t fileSize = std::filesystem::file_size(storePath, error);
+    std::ifstream store(storePath, std::ios::binary);
+    uint32_t blockSize = 0;
+    while (storeSize + sizeof(blockSize) <= fileSize) {
+        store.seekg(static_cast<std::streamoff>(storeSize));
+        if (!store.read(reinterpret_cast<char*>(&blockSize), sizeof(blockSize)) ||
+            storeSize + sizeof(blockSize) + blockSize > fileSize) {
+            break;
+        }
+        storeSize += sizeof(blockSize) + blockSize;
+        sealedCount++;
+    }
+    store.close();
+
+    if (fileSize != storeSize) {
+        std::filesystem::resize_file(storePath, storeSize, error);
+    }
+}
+
+void CompressedSegments::reset() {
+    std::error_code error;
+    std::filesystem::resize_file(storePath, 0, error);
+    sealedCount = 0;
+    storeSize = 0;
+}
+
+uint64_t CompressedSegments::appendSealed(const ChatLog& chatLog, std::string& payload) {
+    if (!loaded) {
+        load();
+    }
+    uint64_t sealable = chatLog.sizeInBytes() / compression::SEGMENT_SIZE;
+    if (sealedCount > sealable) {
+        // The log shrank underneath us, the stored segments no longer apply.
+        reset();
+    }
+
+    if (sealedCount < sealable) {
+        std::ofstream store(storePath, std::ios::binary | std::ios::app);
+        for (; sealedCount < sealable; sealedCount++) {
+            std::string raw = chatLog.read(sealedCount * compression::SEGMENT_SIZE, (sealedCount + 1) * compression::SEGMENT_SIZE);
+            std::string block;
+            if (!compression::compressBlock(codec, raw.data(), raw.size(), block)) {
+                break;
+            }
+            std::string record;
+            compression::appendBlock(record, block);
+            store.write(record.data(), record.size());
+            storeSize += record.size();
+        }
+    }
+
+    if (storeSize > 0) {
+        std::ifstream store(storePath, std::ios::binary);
+        size_t oldSize = payload.size();
+        payload.resize(oldSize + static_cast<size_t>(storeSize));
+        store.read(&payload[oldSize], static_cast<std::streamsize>(storeSize));
+    }
+    return sealedCount * compression::SEGMENT_SIZE;
+}
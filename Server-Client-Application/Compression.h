@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include "ChatLog.h"
+
+namespace compression {
+    // Set in the 4-byte size prefix of frames whose payload is compressed.
+    constexpr uint32_t COMPRESSED_FLAG{ 0x80000000u };
+    // Frames shorter than this are always sent as-is.
+    constexpr size_t FRAME_THRESHOLD{ 1024 };
+    // Chat log bytes per precompressed segment.
+    constexpr uint64_t SEGMENT_SIZE{ 1 << 20 };
+
+    // Negotiated per connection with "$register <alias> <codec>". XPRESS is the
+    // cheap LZ-class option, XPRESS_HUFF and MSZIP (deflate) trade CPU for ratio.
+    enum Codec {
+        NONE = 0,
+        XPRESS = 1,
+        XPRESS_HUFF = 2,
+        MSZIP = 3,
+        CODEC_COUNT = 4,
+    };
+
+    Codec codecFromName(const std::string& name);
+    const char* codecName(Codec codec);
+    bool compressBlock(Codec codec, const char* data, size_t size, std::string& block);
+    void appendBlock(std::string& payload, const std::string& block);
+    std::string decompressPayload(Codec codec, const std::string& payload);
+    std::string encodeFrame(const std::string& payload);
+}
+
+// Sealed 1 MB slices of the chat log, compressed once and kept in
+// "<log>.<codec>" as back-to-back [uint32 length][block] records, which is
+// exactly the layout of a compressed frame payload. $getlog copies the file
+// into the frame and only compresses the unsealed tail per request.
+class CompressedSegments {
+public:
+    CompressedSegments(const std::string& logPath, compression::Codec codec);
+    uint64_t appendSealed(const ChatLog& chatLog, std::string& payload);
+
+private:
+    void load();
+    void reset();
+    std::string storePath;
+    compression::Codec codec;
+    bool loaded;
+    uint64_t sealedCount;
+    uint64_t storeSize;
+};
@@ -0,0 +1,170 @@
+#include "DiagnosticLog.h"
+#include "LowLatency.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+static_assert((diag::QUEUE_CAPACITY & (diag::QUEUE_CAPACITY - 1)) == 0, "QUEUE_CAPACITY must be a power of two");
+
+namespace {
+    const char* levelName(diag::Level level) {
+        switch (level) {
+        case diag::VERBOSE: return "VERBOSE";
+        case diag::INFO: return "INFO";
+        case diag::WARNING: return "WARNING";
+        default: return "SEVERE";
+        }
+    }
+}
+
+DiagnosticLog::DiagnosticLog(const std::string& path)
+    : output(path.empty() ? nullptr : fopen(path.c_str(), "a")), cells(new Cell[diag::QUEUE_CAPACITY]), enqueuePos(0), dequeuePos(0), sampleCounter(0), droppedRecords(0), minimumLevel(diag::INFO), bodies(false), stopping(false) {
+    for (size_t i = 0; i < diag::QUEUE_CAPACITY; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    if (output == nullptr) {
+        output = stdout;
+    }
+    sink = std::thread(&DiagnosticLog::drain, this);
+}
+
+DiagnosticLog::~DiagnosticLog() {
+    stopping.store(true);
+    sink.join();
+    if (output != stdout) {
+        fclose(output);
+    }
+}
+
+void DiagnosticLog::configure(diag::Level level, bool includeBodies) {
+    minimumLevel.store(level);
+    bodies.store(includeBodies);
+}
+
+bool DiagnosticLog::pinWriter(int core) {
+    return pinThread(sink.native_handle(), core);
+}
+
+bool DiagnosticLog::enabled(diag::Level level) const {
+    return level >= minimumLevel.load(std::memory_order_relaxed);
+}
+
+bool DiagnosticLog::includesBodies() const {
+    return bodies.load(std::memory_order_relaxed);
+}
+
+void DiagnosticLog::write(diag::Level level, const char* event, std::string_view alias, std::string_view detail, int64_t value) {
+    if (!enabled(level)) {
+        return;
+    }
+    // Under backlog keep warnings and errors, thin out the routine chatter.
+    size_t backlog = enqueuePos.load(std::memory_order_relaxed) - dequeuePos.load(std::memory_order_relaxed);
+    if (level < diag::WARNING && backlog > diag::SAMPLING_DEPTH
+        && sampleCounter.fetch_add(1, std::memory_order_relaxed) % diag::SAMPLE_RATE != 0) {
+        droppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Record record;
+    record.timestamp = std::chrono::system_clock::now();
+    record.level = level;
+    record.event = event;
+    record.value = value;
+    record.aliasLength = static_cast<uint8_t>(std::min(alias.size(), diag::ALIAS_LENGTH));
+    memcpy(record.alias, alias.data(), record.aliasLength);
+    record.detailLength = static_cast<uint8_t>(std::min(detail.size(), diag::DETAIL_LENGTH));
+    memcpy(record.detail, detail.data(), record.detailLength);
+    if (!tryPush(record)) {
+        droppedRecords.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Bounded queue after Vyukov: each cell's sequence tells producers whether it
+// is free for their position and the consumer whether it has been filled.
+bool DiagnosticLog::tryPush(const Record& record) {
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[pos & (diag::QUEUE_CAPACITY - 1)];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (difference == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.record = record;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0) {
+            return false;
+        }
+        else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool DiagnosticLog::tryPop(Record& record) {
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    Cell& cell = cells[pos & (diag::QUEUE_CAPACITY - 1)];
+    if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+        return false;
+    }
+    record = cell.record;
+    cell.sequence.store(pos + diag::QUEUE_CAPACITY, std::memory_order_release);
+    dequeuePos.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+// Sink thread: formats whatever is queued into one buffer and writes it in a
+// single call, then reports anything that was dropped or sampled out.
+void DiagnosticLog::drain() {
+    std::string batch;
+    Record record;
+    while (true) {
+        bool stop = stopping.load();
+        batch.clear();
+        while (tryPop(record)) {
+            format(record, batch);
+        }
+        uint64_t dropped = droppedRecords.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            batch += "[diagnostics] " + std::to_string(dropped) + " records dropped or sampled out\n";
+        }
+        if (!batch.empty()) {
+            fwrite(batch.data(), 1, batch.size(), output);
+            fflush(output);
+        }
+        else if (stop) {
+            return;
+        }
+        else {
+            std::this_thread::sleep_for(diag::IDLE_WAIT);
+        }
+    }
+}
+
+void DiagnosticLog::format(const Record& record, std::string& out) {
+    std::time_t seconds = std::chrono::system_clock::to_time_t(record.timestamp);
+    int millis = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(record.timestamp.time_since_epoch()).count() % 1000);
+    char prefix[48];
+    std::strftime(prefix, sizeof(prefix), "[%H:%M:%S", std::localtime(&seconds));
+    out += prefix;
+    snprintf(prefix, sizeof(prefix), ".%03d] %s ", millis, levelName(record.level));
+    out += prefix;
+    out += record.event;
+    if (record.aliasLength > 0) {
+        out += " (";
+        out.append(record.alias, record.aliasLength);
+        out += ")";
+    }
+    if (record.detailLength > 0) {
+        out += ": ";
+        out.append(record.detail, record.detailLength);
+    }
+    if (record.value != 0) {
+        out += " [" + std::to_string(record.value) + "]";
+    }
+    out += '\n';
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string_view>
+#include <thread>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+namespace diag {
+    enum Level {
+        VERBOSE = 0,
+        INFO = 1,
+        WARNING = 2,
+        SEVERE = 3,
+    };
+    // Records waiting for the sink; producers drop (and count) when it is full.
+    constexpr size_t QUEUE_CAPACITY{ 4096 };
+    // Past this backlog only every SAMPLE_RATE-th VERBOSE/INFO record is kept.
+    constexpr size_t SAMPLING_DEPTH{ 1024 };
+    constexpr uint32_t SAMPLE_RATE{ 16 };
+    constexpr size_t ALIAS_LENGTH{ 32 };
+    constexpr size_t DETAIL_LENGTH{ 96 };
+    constexpr std::chrono::milliseconds IDLE_WAIT{ 10 };
+}
+
+// Console diagnostics for the server. Producers copy a fixed-size record into
+// a bounded lock-free queue and return; a background thread formats and
+// writes them, so a slow stdout never holds up the network thread.
+class DiagnosticLog {
+public:
+    // path: file the records are appended to; empty, or a file that cannot be
+    // opened, writes them to stdout.
+    explicit DiagnosticLog(const std::string& path = std::string());
+    ~DiagnosticLog();
+    void configure(diag::Level minimumLevel, bool includeBodies);
+    // Keeps the writer thread on one core, off the network thread's.
+    bool pinWriter(int core);
+    bool enabled(diag::Level level) const;
+    bool includesBodies() const;
+    // event must be a string literal: only the pointer is queued.
+    void write(diag::Level level, const char* event, std::string_view alias, std::string_view detail = {}, int64_t value = 0);
+
+private:
+    struct Record {
+        std::chrono::system_clock::time_point timestamp;
+        diag::Level level;
+        const char* event;
+        int64_t value;
+        uint8_t aliasLength;
+        uint8_t detailLength;
+        char alias[diag::ALIAS_LENGTH];
+        char detail[diag::DETAIL_LENGTH];
+    };
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    bool tryPush(const Record& record);
+    bool tryPop(Record& record);
+    void drain();
+    static void format(const Record& record, std::string& out);
+
+    std::FILE* output;
+    std::unique_ptr<Cell[]> cells;
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+    std::atomic<uint32_t> sampleCounter;
+    std::atomic<uint64_t> droppedRecords;
+    std::atomic<int> minimumLevel;
+    std::atomic<bool> bodies;
+    std::atomic<bool> stopping;
+    std::thread sink;
+};
@@ -0,0 +1,150 @@
+#include "Environment.h"
+#include <ws2tcpip.h>
+#include <iostream>
+#include <thread>
+#include <string>
+
+#pragma warning(disable: 4996)
+
+Environment& Environment::system() {
+    static WinsockLayer sockets;
+    static SystemClock clock;
+    static BroadcastDiscovery discovery;
+    static Environment environment{ sockets, clock, discovery, true };
+    return environment;
+}
+
+SystemClock::time_point SystemClock::now() const {
+    return std::chrono::steady_clock::now();
+}
+
+SOCKET WinsockLayer::openListener(const char* port, bool registeredIo) {
+    struct addrinfo* result_addr = NULL, ideas;
+    ZeroMemory(&ideas, sizeof(ideas));
+    ideas.ai_flags = AI_PASSIVE;
+    ideas.ai_family = AF_INET;
+    ideas.ai_socktype = SOCK_STREAM;
+    ideas.ai_protocol = IPPROTO_TCP;
+
+    int finalOutput = getaddrinfo(NULL, port, &ideas, &result_addr);
+    if (finalOutput != 0) {
+        std::cerr << "Error getting address info: " << finalOutput << std::endl;
+        return INVALID_SOCKET;
+    }
+
+    // Accepted sockets inherit the listener's flags, so RIO needs it from the start.
+    SOCKET listener;
+    if (registeredIo) {
+        listener = WSASocket(result_addr->ai_family, result_addr->ai_socktype, result_addr->ai_protocol, NULL, 0,
+            WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+    }
+    else {
+        listener = ::socket(result_addr->ai_family, result_addr->ai_socktype, result_addr->ai_protocol);
+    }
+    if (listener == INVALID_SOCKET) {
+        std::cerr << "Error creating server socket: " << WSAGetLastError() << std::endl;
+        freeaddrinfo(result_addr);
+        return INVALID_SOCKET;
+    }
+
+    finalOutput = ::bind(listener, result_addr->ai_addr, (int)result_addr->ai_addrlen);
+    freeaddrinfo(result_addr);
+    if (finalOutput == SOCKET_ERROR) {
+        std::cerr << "Error binding server socket: " << WSAGetLastError() << std::endl;
+        ::closesocket(listener);
+        return INVALID_SOCKET;
+    }
+    return listener;
+}
+
+int WinsockLayer::listen(SOCKET listener, int backlog) {
+    return ::listen(listener, backlog > 0 ? SOMAXCONN_HINT(backlog) : SOMAXCONN);
+}
+
+SOCKET WinsockLayer::accept(SOCKET listener, sockaddr* address, int* addressLength) {
+    return ::accept(listener, address, addressLength);
+}
+
+int WinsockLayer::send(SOCKET socket, const char* bytes, int length) {
+    return ::send(socket, bytes, length, 0);
+}
+
+int WinsockLayer::recv(SOCKET socket, char* bytes, int length) {
+    return ::recv(socket, bytes, length, 0);
+}
+
+int WinsockLayer::pending(SOCKET socket, u_long& bytes) {
+    return ::ioctlsocket(socket, FIONREAD, &bytes);
+}
+
+int WinsockLayer::setNonBlocking(SOCKET socket) {
+    u_long nonBlocking = 1;
+    return ::ioctlsocket(socket, FIONBIO, &nonBlocking);
+}
+
+// Winsock has no SO_BUSY_POLL; the loopback fast path is its nearest
+// equivalent and only exists on loopback, so its failure is not an error.
+int WinsockLayer::tuneForLatency(SOCKET socket) {
+    int enabled = 1;
+    DWORD bytesReturned = 0;
+    ::WSAIoctl(socket, SIO_LOOPBACK_FAST_PATH, &enabled, sizeof(enabled), NULL, 0, &bytesReturned, NULL, NULL);
+    BOOL noDelay = TRUE;
+    return ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+}
+
+int WinsockLayer::select(int highestSocket, fd_set* readSet, fd_set* writeSet, const timeval* timeout) {
+    return ::select(highestSocket + 1, readSet, writeSet, NULL, timeout);
+}
+
+int WinsockLayer::shutdown(SOCKET socket, int how) {
+    return ::shutdown(socket, how);
+}
+
+int WinsockLayer::close(SOCKET socket) {
+    return ::closesocket(socket);
+}
+
+int WinsockLayer::lastError() {
+    return WSAGetLastError();
+}
+
+std::string BroadcastDiscovery::hostAddress() {
+    std::string hostIP;
+    std::cout << "Enter server IP address: ";
+    std::cin >> hostIP;
+    return hostIP;
+}
+
+void BroadcastDiscovery::announce(const std::string& hostAddress, const std::string& listeningPort) {
+    SOCKET udpSocket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udpSocket == INVALID_SOCKET) {
+        std::cerr << "Can't create UDP socket: " << WSAGetLastError() << std::endl;
+        return;
+    }
+    int broadcast = 1;
+    if (setsockopt(udpSocket, SOL_SOCKET, SO_BROADCAST, (char*)&broadcast, sizeof(broadcast)) == SOCKET_ERROR) {
+        std::cerr << "Can't enable UDP broadcast: " << WSAGetLastError() << std::endl;
+        ::closesocket(udpSocket);
+        return;
+    }
+    std::thread udpThread(&BroadcastDiscovery::broadcastLoop, udpSocket, hostAddress + ":" + listeningPort,
+        static_cast<unsigned short>(std::stoi(listeningPort)));
+    udpThread.detach();
+}
+
+void BroadcastDiscovery::broadcastLoop(SOCKET udpSocket, std::string announcement, unsigned short port) {
+    sockaddr_in broadCastingAddressUDP{};
+    broadCastingAddressUDP.sin_family = AF_INET;
+    broadCastingAddressUDP.sin_addr.s_addr = INADDR_BROADCAST;
+    broadCastingAddressUDP.sin_port = htons(port);
+
+    while (true) {
+        int finalOutput = sendto(udpSocket, announcement.c_str(), announcement.size(), 0, (sockaddr*)&broadCastingAddressUDP, sizeof(broadCastingAddressUDP));
+        if (finalOutput == SOCKET_ERROR) {
+            std::cerr << "UDP broadcast failed: " << WSAGetLastError() << std::endl;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    ::closesocket(udpSocket);
+}
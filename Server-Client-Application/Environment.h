@@ -0,0 +1,119 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <winsock2.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+// fd_set is a fixed-size list on Winsock. The project defines FD_SETSIZE for
+// every translation unit so select() can watch a full server; a unit built
+// without it would disagree with the others on the size of fd_set.
+static_assert(FD_SETSIZE >= 16384, "Build with FD_SETSIZE=16384, as the project file does");
+
+namespace capacity {
+    // fd_set slots kept for the listeners and peer links.
+    constexpr int RESERVED_SOCKETS{ 64 };
+    constexpr int MAX_CLIENTS{ FD_SETSIZE - RESERVED_SOCKETS };
+}
+
+// Time source for reactor timers, read deadlines and rate limits.
+class TimeSource {
+public:
+    using time_point = std::chrono::steady_clock::time_point;
+    virtual ~TimeSource() = default;
+    virtual time_point now() const = 0;
+};
+
+// The socket calls the event loop makes. Winsock in production; the simulated
+// network stands in for it so the loop can run without real sockets.
+class SocketLayer {
+public:
+    virtual ~SocketLayer() = default;
+    // A TCP socket bound to `port`, or INVALID_SOCKET. It takes connections
+    // once listen() is called.
+    virtual SOCKET openListener(const char* port, bool registeredIo) = 0;
+    // backlog: connections the stack queues before refusing more; 0 for its maximum.
+    virtual int listen(SOCKET listener, int backlog) = 0;
+    virtual SOCKET accept(SOCKET listener, sockaddr* address, int* addressLength) = 0;
+    virtual int send(SOCKET socket, const char* bytes, int length) = 0;
+    virtual int recv(SOCKET socket, char* bytes, int length) = 0;
+    // Bytes recv() can return without blocking.
+    virtual int pending(SOCKET socket, u_long& bytes) = 0;
+    virtual int setNonBlocking(SOCKET socket) = 0;
+    // Low-latency mode: no Nagle delay, and the loopback fast path where the
+    // stack has one. On a listener, before listen(); accepted sockets inherit it.
+    virtual int tuneForLatency(SOCKET socket) = 0;
+    virtual int select(int highestSocket, fd_set* readSet, fd_set* writeSet, const timeval* timeout) = 0;
+    virtual int shutdown(SOCKET socket, int how) = 0;
+    virtual int close(SOCKET socket) = 0;
+    virtual int lastError() = 0;
+};
+
+// How the server learns the address it announces, and how it announces it.
+class Discovery {
+public:
+    virtual ~Discovery() = default;
+    virtual std::string hostAddress() = 0;
+    virtual void announce(const std::string& hostAddress, const std::string& listeningPort) = 0;
+};
+
+namespace storage {
+    constexpr const char* CHAT_LOG{ "Record_of_chat.txt" };
+    constexpr const char* ATTACHMENTS{ "attachments" };
+}
+
+// Where the server keeps its files. The chat log's index, postings and
+// compressed segments sit next to it; an empty diagnostics path writes the
+// diagnostics to the console.
+struct StoragePaths {
+    std::string chatLog = storage::CHAT_LOG;
+    std::string attachments = storage::ATTACHMENTS;
+    std::string diagnostics;
+};
+
+// Everything the server reaches outside its own process for. Host-bound
+// features (the AF_UNIX listener, shared memory, hot restart, peer links) are
+// only started when `hostServices` is set.
+struct Environment {
+    SocketLayer& sockets;
+    TimeSource& clock;
+    Discovery& discovery;
+    bool hostServices;
+    // A harness gives each run its own, so runs never share files.
+    StoragePaths storage{};
+    // Winsock, the steady clock, the console prompt and UDP broadcasts.
+    static Environment& system();
+};
+
+class SystemClock : public TimeSource {
+public:
+    time_point now() const override;
+};
+
+class WinsockLayer : public SocketLayer {
+public:
+    SOCKET openListener(const char* port, bool registeredIo) override;
+    int listen(SOCKET listener, int backlog) override;
+    SOCKET accept(SOCKET listener, sockaddr* address, int* addressLength) override;
+    int send(SOCKET socket, const char* bytes, int length) override;
+    int recv(SOCKET socket, char* bytes, int length) override;
+    int pending(SOCKET socket, u_long& bytes) override;
+    int setNonBlocking(SOCKET socket) override;
+    int tuneForLatency(SOCKET socket) override;
+    int select(int highestSocket, fd_set* readSet, fd_set* writeSet, const timeval* timeout) override;
+    int shutdown(SOCKET socket, int how) override;
+    int close(SOCKET socket) override;
+    int lastError() override;
+};
+
+// Asks for the address on the console and broadcasts "<ip>:<port>" over UDP
+// every second for clients waiting in awaitUdpAnnouncement().
+class BroadcastDiscovery : public Discovery {
+public:
+    std::string hostAddress() override;
+    void announce(const std::string& hostAddress, const std::string& listeningPort) override;
+
+private:
+    static void broadcastLoop(SOCKET udpSocket, std::string announcement, unsigned short port);
+};
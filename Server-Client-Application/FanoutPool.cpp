@@ -0,0 +1,124 @@
+#include "FanoutPool.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+FanoutPool::FanoutPool(SocketLayer& sockets, unsigned workerCount)
+    : sockets(sockets), queueCount(workerCount + 1), generation(0), activeWorkers(0), stopping(false),
+    currentFrame(nullptr), currentRecipients(nullptr), currentProgress(nullptr), failedSends(0) {
+    // Queue 0 belongs to the thread calling deliver(), which works alongside the pool.
+    queues.reset(new WorkQueue[queueCount]);
+    for (unsigned i = 1; i < queueCount; i++) {
+        workers.emplace_back(&FanoutPool::workerLoop, this, i);
+    }
+}
+
+FanoutPool::~FanoutPool() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    wakeWorkers.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+std::string FanoutPool::encodeFrame(const std::string& notification) {
+    uint32_t SizeOfMsg = static_cast<uint32_t>(notification.size());
+    std::string frame(sizeof(SizeOfMsg) + notification.size(), '\0');
+    memcpy(&frame[0], &SizeOfMsg, sizeof(SizeOfMsg));
+    memcpy(&frame[sizeof(SizeOfMsg)], notification.data(), notification.size());
+    return frame;
+}
+
+int FanoutPool::deliver(const std::string& frame, const std::vector<SOCKET>& recipients, std::vector<size_t>& bytesSent) {
+    size_t partitionCount = (recipients.size() + fanout::PARTITION_SIZE - 1) / fanout::PARTITION_SIZE;
+    bytesSent.assign(recipients.size(), 0);
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        currentFrame = &frame;
+        currentRecipients = &recipients;
+        currentProgress = &bytesSent;
+        failedSends = 0;
+        for (unsigned i = 0; i < queueCount; i++) {
+            queues[i].next = partitionCount * i / queueCount;
+            queues[i].end = partitionCount * (i + 1) / queueCount;
+        }
+        activeWorkers = static_cast<unsigned>(workers.size());
+        generation++;
+    }
+    wakeWorkers.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    batchDone.wait(lock, [this] { return activeWorkers == 0; });
+    currentFrame = nullptr;
+    currentRecipients = nullptr;
+    currentProgress = nullptr;
+    return failedSends;
+}
+
+void FanoutPool::workerLoop(unsigned index) {
+    unsigned long long seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            wakeWorkers.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = generation;
+        }
+        drain(index);
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (--activeWorkers == 0) {
+                batchDone.notify_one();
+            }
+        }
+    }
+}
+
+void FanoutPool::drain(unsigned index) {
+    while (runPartition(queues[index])) {
+    }
+    // Own run is finished, help whoever is still behind.
+    for (unsigned offset = 1; offset < queueCount; offset++) {
+        WorkQueue& victim = queues[(index + offset) % queueCount];
+        while (runPartition(victim)) {
+        }
+    }
+}
+
+bool FanoutPool::runPartition(WorkQueue& queue) {
+    size_t partition = queue.next.fetch_add(1);
+    if (partition >= queue.end) {
+        return false;
+    }
+    const std::vector<SOCKET>& recipients = *currentRecipients;
+    size_t first = partition * fanout::PARTITION_SIZE;
+    size_t last = std::min(first + fanout::PARTITION_SIZE, recipients.size());
+    // Each slot of the progress vector is written by exactly one thread.
+    for (size_t i = first; i < last; i++) {
+        (*currentProgress)[i] = sendFrame(recipients[i]);
+        if ((*currentProgress)[i] == fanout::SEND_FAILED) {
+            failedSends++;
+        }
+    }
+    return true;
+}
+
+size_t FanoutPool::sendFrame(SOCKET recipient) {
+    const std::string& frame = *currentFrame;
+    size_t bytesSent = 0;
+    while (bytesSent < frame.size()) {
+        int finalOutput = sockets.send(recipient, frame.data() + bytesSent, static_cast<int>(frame.size() - bytesSent));
+        if (finalOutput == SOCKET_ERROR) {
+            return sockets.lastError() == WSAEWOULDBLOCK ? bytesSent : fanout::SEND_FAILED;
+        }
+        bytesSent += finalOutput;
+    }
+    return bytesSent;
+}
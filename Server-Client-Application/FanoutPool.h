@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <winsock2.h>
+#include "Environment.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace fanout {
+    // Rooms smaller than this are sent inline on the network thread.
+    constexpr size_t PARALLEL_THRESHOLD{ 512 };
+    // Number of recipients a worker claims at a time.
+    constexpr size_t PARTITION_SIZE{ 128 };
+    // Progress value for a recipient whose socket failed.
+    constexpr size_t SEND_FAILED{ SIZE_MAX };
+}
+
+// Splits one broadcast across worker threads. The recipient list is cut into
+// partitions, each worker starts on its own run of partitions and steals from
+// the others once it runs dry. A partition is claimed by exactly one thread, so
+// the sockets in it are written without any locking. Sockets are non-blocking:
+// a full one is left where it stopped and reported through `bytesSent`.
+class FanoutPool {
+public:
+    FanoutPool(SocketLayer& sockets, unsigned workerCount);
+    ~FanoutPool();
+    int deliver(const std::string& frame, const std::vector<SOCKET>& recipients, std::vector<size_t>& bytesSent);
+    static std::string encodeFrame(const std::string& notification);
+
+private:
+    struct WorkQueue {
+        std::atomic<size_t> next{ 0 };
+        size_t end = 0;
+    };
+    void workerLoop(unsigned index);
+    void drain(unsigned index);
+    bool runPartition(WorkQueue& queue);
+    size_t sendFrame(SOCKET recipient);
+    SocketLayer& sockets;
+    std::vector<std::thread> workers;
+    std::unique_ptr<WorkQueue[]> queues;
+    unsigned queueCount;
+    std::mutex stateMutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable batchDone;
+    unsigned long long generation;
+    unsigned activeWorkers;
+    bool stopping;
+    const std::string* currentFrame;
+    const std::vector<SOCKET>* currentRecipients;
+    std::vector<size_t>* currentProgress;
+    std::atomic<int> failedSends;
+};
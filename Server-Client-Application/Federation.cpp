@@ -0,0 +1,217 @@
+#include "Federation.h"
+#include <random>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstring>
+
+Federation::Federation() : messageCounter(0) {
+    std::random_device entropy;
+    std::ostringstream id;
+    id << std::hex << std::setw(8) << std::setfill('0') << entropy() << std::setw(8) << entropy();
+    localNode = id.str();
+}
+
+void Federation::addPeerAddress(const std::string& address) {
+    size_t separatorPos = address.rfind(':');
+    if (separatorPos == std::string::npos || separatorPos == 0 || separatorPos + 1 == address.size()) {
+        throw std::runtime_error("Invalid peer address (expected host:port): " + address);
+    }
+    peers.push_back({ address.substr(0, separatorPos), address.substr(separatorPos + 1) });
+}
+
+const std::vector<PeerAddress>& Federation::configuredPeers() const {
+    return peers;
+}
+
+void Federation::setSharedSecret(const std::string& sharedSecret) {
+    secret = sharedSecret;
+}
+
+const std::string& Federation::sharedSecret() const {
+    return secret;
+}
+
+bool Federation::admitsPeer(const std::string& remoteHost, const std::string& presented) const {
+    if (!secret.empty() && presented.size() == secret.size()) {
+        // Compares every byte, so the time taken says nothing about the secret.
+        unsigned char difference = 0;
+        for (size_t i = 0; i < secret.size(); i++) {
+            difference |= static_cast<unsigned char>(secret[i] ^ presented[i]);
+        }
+        if (difference == 0) {
+            return true;
+        }
+    }
+    for (const auto& peer : peers) {
+        if (!remoteHost.empty() && peer.host == remoteHost) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const std::string& Federation::nodeId() const {
+    return localNode;
+}
+
+std::string Federation::nextMessageId() {
+    std::string messageId = localNode + ":" + std::to_string(++messageCounter);
+    markSeen(messageId);
+    return messageId;
+}
+
+unsigned long long Federation::messagesIssued() const {
+    return messageCounter;
+}
+
+void Federation::adoptIdentity(const std::string& nodeId, unsigned long long messagesIssued) {
+    localNode = nodeId;
+    messageCounter = messagesIssued;
+}
+
+bool Federation::markSeen(const std::string& messageId) {
+    if (!seenIds.insert(messageId).second) {
+        return false;
+    }
+    seenOrder.push_back(messageId);
+    if (seenOrder.size() > federation::SEEN_ID_CAPACITY) {
+        seenIds.erase(seenOrder.front());
+        seenOrder.pop_front();
+    }
+    return true;
+}
+
+void Federation::attachLink(Client* link, const std::string& remoteNode) {
+    links[link] = remoteNode;
+}
+
+std::vector<std::string> Federation::detachLink(Client* link) {
+    auto it = links.find(link);
+    if (it == links.end()) {
+        return {};
+    }
+    std::string remoteNode = it->second;
+    links.erase(it);
+    pendingBatches.erase(link);
+
+    // Only forget the node's users if no other link still reaches it.
+    for (const auto& other : links) {
+        if (other.second == remoteNode) {
+            return {};
+        }
+    }
+    auto members = remoteMembers.find(remoteNode);
+    if (members == remoteMembers.end()) {
+        return {};
+    }
+    std::vector<std::string> departed(members->second.begin(), members->second.end());
+    remoteMembers.erase(members);
+    return departed;
+}
+
+bool Federation::queueChat(const std::string& messageId, const std::string& notification) {
+    std::string entry = encodeEntry("CHAT", messageId, notification);
+    if (!fitsInBatch(entry)) {
+        return false;
+    }
+    for (const auto& link : links) {
+        // A node without members in the room has no use for its traffic.
+        auto members = remoteMembers.find(link.second);
+        if (members == remoteMembers.end() || members->second.empty()) {
+            continue;
+        }
+        appendEntry(link.first, entry);
+    }
+    return true;
+}
+
+void Federation::queuePresence(const std::string& type, const std::string& messageId, const std::string& userAlias) {
+    for (const auto& link : links) {
+        appendEntry(link.first, encodeEntry(type, messageId, userAlias));
+    }
+}
+
+void Federation::queueSnapshot(Client* link, const std::vector<std::string>& localAliases) {
+    for (const auto& userAlias : localAliases) {
+        appendEntry(link, encodeEntry("JOIN", nextMessageId(), userAlias));
+    }
+}
+
+bool Federation::applyPresence(const RelayEntry& entry) {
+    std::string origin = originOf(entry.messageId);
+    if (entry.type == "JOIN") {
+        return remoteMembers[origin].insert(entry.payload).second;
+    }
+    if (entry.type == "LEAVE") {
+        return remoteMembers[origin].erase(entry.payload) > 0;
+    }
+    return false;
+}
+
+std::vector<std::string> Federation::remoteAliases() const {
+    std::vector<std::string> aliases;
+    for (const auto& node : remoteMembers) {
+        aliases.insert(aliases.end(), node.second.begin(), node.second.end());
+    }
+    return aliases;
+}
+
+std::vector<std::pair<Client*, std::string>> Federation::takeBatches() {
+    std::vector<std::pair<Client*, std::string>> batches;
+    for (auto& pending : pendingBatches) {
+        for (auto& batch : pending.second) {
+            batches.emplace_back(pending.first, federation::BATCH_HEADER + batch);
+        }
+    }
+    pendingBatches.clear();
+    return batches;
+}
+
+// Entries are "<type> <messageId> <length>\n<payload>", back to back. The
+// explicit length lets chat payloads carry newlines.
+std::string Federation::encodeEntry(const std::string& type, const std::string& messageId, const std::string& payload) {
+    return type + " " + messageId + " " + std::to_string(payload.size()) + "\n" + payload;
+}
+
+bool Federation::fitsInBatch(const std::string& entry) {
+    return strlen(federation::BATCH_HEADER) + entry.size() <= federation::MAX_BATCH_SIZE;
+}
+
+// Entries stay whole: one that would push the open batch past MAX_BATCH_SIZE
+// starts the next. An entry too large for any batch is dropped.
+void Federation::appendEntry(Client* link, const std::string& entry) {
+    if (!fitsInBatch(entry)) {
+        return;
+    }
+    std::vector<std::string>& batches = pendingBatches[link];
+    if (batches.empty() || strlen(federation::BATCH_HEADER) + batches.back().size() + entry.size() > federation::MAX_BATCH_SIZE) {
+        batches.emplace_back();
+    }
+    batches.back() += entry;
+}
+
+std::vector<RelayEntry> Federation::parseBatch(const std::string& body) {
+    std::vector<RelayEntry> entries;
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t headerEnd = body.find('\n', pos);
+        if (headerEnd == std::string::npos) {
+            break;
+        }
+        std::istringstream header(body.substr(pos, headerEnd - pos));
+        RelayEntry entry;
+        size_t payloadLength = 0;
+        if (!(header >> entry.type >> entry.messageId >> payloadLength) || headerEnd + 1 + payloadLength > body.size()) {
+            break;
+        }
+        entry.payload = body.substr(headerEnd + 1, payloadLength);
+        entries.push_back(entry);
+        pos = headerEnd + 1 + payloadLength;
+    }
+    return entries;
+}
+
+std::string Federation::originOf(const std::string& messageId) {
+    return messageId.substr(0, messageId.find(':'));
+}
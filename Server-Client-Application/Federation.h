@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <unordered_set>
+#include "Client.h"
+#include "Reactor.h"
+
+namespace federation {
+    // How many relayed message IDs are remembered for duplicate suppression.
+    constexpr size_t SEEN_ID_CAPACITY{ 8192 };
+    // A batch goes out as one "$relay" frame; the peer drops a link whose
+    // frame is larger than MAX_FRAME_SIZE, so a busy tick is split into several.
+    constexpr size_t MAX_BATCH_SIZE{ reactor::MAX_FRAME_SIZE };
+    constexpr const char* BATCH_HEADER{ "$relay\n" };
+}
+
+struct PeerAddress {
+    std::string host;
+    std::string port;
+};
+
+struct RelayEntry {
+    std::string type;
+    std::string messageId;
+    std::string payload;
+};
+
+// Bookkeeping for server-to-server links. Sockets stay with the Server; this
+// class tracks which links exist, which remote users sit behind each node,
+// which relayed IDs were already seen, and the per-link batches waiting to be
+// flushed at the end of the event loop iteration.
+class Federation {
+public:
+    Federation();
+    void addPeerAddress(const std::string& address);
+    const std::vector<PeerAddress>& configuredPeers() const;
+    // Shared by every node of the federation; sent with "$peer" when dialing.
+    void setSharedSecret(const std::string& secret);
+    const std::string& sharedSecret() const;
+    // A connection may become a peer link if it presents the shared secret,
+    // or comes from the host of a configured peer (given as an IP address).
+    bool admitsPeer(const std::string& remoteHost, const std::string& secret) const;
+    const std::string& nodeId() const;
+    std::string nextMessageId();
+    unsigned long long messagesIssued() const;
+    // A hot-restarted node keeps its predecessor's identity, so peers neither
+    // see a new node nor take its fresh message IDs for duplicates.
+    void adoptIdentity(const std::string& nodeId, unsigned long long messagesIssued);
+    bool markSeen(const std::string& messageId);
+    void attachLink(Client* link, const std::string& remoteNode);
+    // Returns the remote users that went away with the link.
+    std::vector<std::string> detachLink(Client* link);
+    // False if the message cannot fit in a batch of its own; it is not relayed.
+    bool queueChat(const std::string& messageId, const std::string& notification);
+    void queuePresence(const std::string& type, const std::string& messageId, const std::string& userAlias);
+    void queueSnapshot(Client* link, const std::vector<std::string>& localAliases);
+    // False if the entry changed nothing, e.g. a JOIN seen twice.
+    bool applyPresence(const RelayEntry& entry);
+    std::vector<std::string> remoteAliases() const;
+    std::vector<std::pair<Client*, std::string>> takeBatches();
+    static std::vector<RelayEntry> parseBatch(const std::string& body);
+    static std::string originOf(const std::string& messageId);
+
+private:
+    static std::string encodeEntry(const std::string& type, const std::string& messageId, const std::string& payload);
+    static bool fitsInBatch(const std::string& entry);
+    void appendEntry(Client* link, const std::string& entry);
+    std::vector<PeerAddress> peers;
+    std::string secret;
+    std::string localNode;
+    unsigned long long messageCounter;
+    std::unordered_set<std::string> seenIds;
+    std::deque<std::string> seenOrder;
+    std::map<Client*, std::string> links;
+    std::map<Client*, std::vector<std::string>> pendingBatches;
+    std::map<std::string, std::set<std::string>> remoteMembers;
+};
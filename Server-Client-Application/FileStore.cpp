@@ -0,0 +1,307 @@
+#include "FileStore.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+    constexpr ULONG SHA256_LENGTH = 32;
+}
+
+bool attachment::isDigest(const std::string& text) {
+    return text.size() == DIGEST_LENGTH &&
+        std::all_of(text.begin(), text.end(), [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); });
+}
+
+bool attachment::isToken(const std::string& text) {
+    return text.size() == TOKEN_BYTES * 2 &&
+        std::all_of(text.begin(), text.end(), [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); });
+}
+
+std::string attachment::baseName(const std::string& path) {
+    size_t separator = path.find_last_of("/\\:");
+    return separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+Upload::Upload(const std::string& recipient, const std::string& name, uint64_t size, HANDLE spool,
+    const std::string& spoolPath, BCRYPT_HASH_HANDLE hash, uint64_t& reservedBytes)
+    : recipientAlias(recipient), fileName(name), expected(size), receivedBytes(0),
+    reservedBytes(reservedBytes), spool(spool), spoolPath(spoolPath), hash(hash) {
+    reservedBytes += size;
+}
+
+// An upload dropped before its last chunk leaves nothing behind.
+Upload::~Upload() {
+    if (spool != INVALID_HANDLE_VALUE) {
+        CloseHandle(spool);
+        DeleteFileA(spoolPath.c_str());
+    }
+    BCryptDestroyHash(hash);
+    reservedBytes -= expected;
+}
+
+const std::string& Upload::recipient() const {
+    return recipientAlias;
+}
+
+const std::string& Upload::name() const {
+    return fileName;
+}
+
+uint64_t Upload::size() const {
+    return expected;
+}
+
+uint64_t Upload::received() const {
+    return receivedBytes;
+}
+
+bool Upload::complete() const {
+    return receivedBytes == expected;
+}
+
+Download::Download(const std::string& digest, HANDLE file, uint64_t size)
+    : fileDigest(digest), file(file), size(size), offset(0), chunkLength(0), overlapped{}, destination(INVALID_SOCKET), inFlight(false) {
+    overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+}
+
+// The kernel writes the OVERLAPPED when a transmit finishes, so a transmit in
+// flight is cancelled and waited for before it goes away.
+Download::~Download() {
+    if (inFlight) {
+        DWORD transferred = 0;
+        DWORD flags = 0;
+        CancelIoEx(reinterpret_cast<HANDLE>(destination), &overlapped);
+        WSAGetOverlappedResult(destination, &overlapped, &transferred, TRUE, &flags);
+    }
+    CloseHandle(overlapped.hEvent);
+    CloseHandle(file);
+}
+
+// "FILE_DATA <digest> <offset> <size>\n" in front of each chunk tells the
+// recipient where the bytes go and when the file is complete.
+std::string Download::frameHeader(uint32_t length) const {
+    std::string text = "FILE_DATA " + fileDigest + " " + std::to_string(offset) + " " + std::to_string(size) + "\n";
+    uint32_t frameSize = static_cast<uint32_t>(text.size() + length);
+    std::string frame(sizeof(frameSize), '\0');
+    memcpy(&frame[0], &frameSize, sizeof(frameSize));
+    return frame + text;
+}
+
+bool Download::startChunk(SOCKET socket) {
+    destination = socket;
+    chunkLength = static_cast<uint32_t>(std::min<uint64_t>(attachment::CHUNK_SIZE, size - offset));
+    header = frameHeader(chunkLength);
+    TRANSMIT_FILE_BUFFERS buffers{ &header[0], static_cast<DWORD>(header.size()), nullptr, 0 };
+    HANDLE event = overlapped.hEvent;
+    overlapped = OVERLAPPED{};
+    overlapped.hEvent = event;
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    ResetEvent(event);
+    if (TransmitFile(destination, file, chunkLength, 0, &overlapped, &buffers, 0)) {
+        offset += chunkLength;
+        return true;
+    }
+    if (WSAGetLastError() != WSA_IO_PENDING) {
+        return false;
+    }
+    inFlight = true;
+    return true;
+}
+
+bool Download::pollChunk(SOCKET socket) {
+    if (!inFlight) {
+        return true;
+    }
+    DWORD transferred = 0;
+    DWORD flags = 0;
+    if (!WSAGetOverlappedResult(socket, &overlapped, &transferred, FALSE, &flags)) {
+        return WSAGetLastError() == WSA_IO_INCOMPLETE;
+    }
+    inFlight = false;
+    offset += chunkLength;
+    return true;
+}
+
+std::string Download::readChunk() {
+    uint32_t length = static_cast<uint32_t>(std::min<uint64_t>(attachment::CHUNK_SIZE, size - offset));
+    std::string frame = frameHeader(length);
+    size_t headerLength = frame.size();
+    frame.resize(headerLength + length);
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(offset);
+    DWORD bytesRead = 0;
+    if (!SetFilePointerEx(file, position, nullptr, FILE_BEGIN) || !ReadFile(file, &frame[headerLength], length, &bytesRead, nullptr) ||
+        bytesRead != length) {
+        throw std::runtime_error("Failed to read attachment " + fileDigest + ": " + std::to_string(GetLastError()));
+    }
+    offset += length;
+    return frame;
+}
+
+void Download::resumeAt(uint64_t position) {
+    offset = std::min(position, size);
+}
+
+bool Download::pending() const {
+    return inFlight;
+}
+
+bool Download::complete() const {
+    return !inFlight && offset == size;
+}
+
+const std::string& Download::digest() const {
+    return fileDigest;
+}
+
+uint64_t Download::bytesSent() const {
+    return offset;
+}
+
+FileStore::FileStore(const std::string& directory) : directory(directory), algorithm(nullptr), nextSpool(0), storedBytes(0), reservedBytes(0) {
+}
+
+FileStore::~FileStore() {
+    if (algorithm != nullptr) {
+        BCryptCloseAlgorithmProvider(algorithm, 0);
+    }
+}
+
+void FileStore::open() {
+    CreateDirectoryA(directory.c_str(), nullptr);
+    if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&algorithm, BCRYPT_SHA256_ALGORITHM, nullptr, 0))) {
+        algorithm = nullptr;
+        throw std::runtime_error("SHA-256 is not available for the attachment store");
+    }
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (attachment::isDigest(entry.path().filename().string())) {
+            storedBytes += entry.file_size(error);
+        }
+    }
+    std::ifstream accessList(accessPath());
+    std::string digest;
+    std::string holder;
+    while (accessList >> digest >> holder) {
+        // Older stores listed aliases; those grant nothing any more.
+        if (holder == attachment::EVERYONE || attachment::isToken(holder)) {
+            access[digest].insert(holder);
+        }
+    }
+}
+
+bool FileStore::hasRoomFor(uint64_t size) const {
+    return storedBytes + reservedBytes + size <= attachment::MAX_STORE_SIZE;
+}
+
+std::unique_ptr<Upload> FileStore::beginUpload(const std::string& recipient, const std::string& name, uint64_t size) {
+    BCRYPT_HASH_HANDLE hash = nullptr;
+    if (!BCRYPT_SUCCESS(BCryptCreateHash(algorithm, &hash, nullptr, 0, nullptr, 0, 0))) {
+        throw std::runtime_error("Failed to start hashing an attachment");
+    }
+    std::string spoolPath = directory + "\\spool-" + std::to_string(GetCurrentProcessId()) + "-" +
+        std::to_string(nextSpool++) + ".part";
+    HANDLE spool = CreateFileA(spoolPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, nullptr);
+    if (spool == INVALID_HANDLE_VALUE) {
+        BCryptDestroyHash(hash);
+        throw std::runtime_error("Failed to create " + spoolPath + ": " + std::to_string(GetLastError()));
+    }
+    return std::unique_ptr<Upload>(new Upload(recipient, name, size, spool, spoolPath, hash, reservedBytes));
+}
+
+void FileStore::append(Upload& upload, const char* bytes, size_t length) {
+    if (length > upload.expected - upload.receivedBytes) {
+        throw std::runtime_error("Attachment is larger than announced");
+    }
+    DWORD written = 0;
+    if (!WriteFile(upload.spool, bytes, static_cast<DWORD>(length), &written, nullptr) || written != length) {
+        throw std::runtime_error("Failed to spool attachment: " + std::to_string(GetLastError()));
+    }
+    BCryptHashData(upload.hash, reinterpret_cast<PUCHAR>(const_cast<char*>(bytes)), static_cast<ULONG>(length), 0);
+    upload.receivedBytes += length;
+}
+
+std::string FileStore::finishUpload(Upload& upload) {
+    UCHAR digestBytes[SHA256_LENGTH];
+    BCryptFinishHash(upload.hash, digestBytes, SHA256_LENGTH, 0);
+    char hex[attachment::DIGEST_LENGTH + 1];
+    for (ULONG i = 0; i < SHA256_LENGTH; i++) {
+        snprintf(hex + i * 2, 3, "%02x", digestBytes[i]);
+    }
+    std::string digest(hex, attachment::DIGEST_LENGTH);
+
+    CloseHandle(upload.spool);
+    upload.spool = INVALID_HANDLE_VALUE;
+    std::string path = pathFor(digest);
+    if (GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES) {
+        DeleteFileA(upload.spoolPath.c_str());
+    }
+    else if (!MoveFileExA(upload.spoolPath.c_str(), path.c_str(), 0)) {
+        DeleteFileA(upload.spoolPath.c_str());
+        throw std::runtime_error("Failed to store attachment " + digest + ": " + std::to_string(GetLastError()));
+    }
+    else {
+        storedBytes += upload.expected;
+    }
+    return digest;
+}
+
+std::unique_ptr<Download> FileStore::openDownload(const std::string& digest) {
+    if (!attachment::isDigest(digest)) {
+        return nullptr;
+    }
+    HANDLE file = CreateFileA(pathFor(digest).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return nullptr;
+    }
+    return std::unique_ptr<Download>(new Download(digest, file, static_cast<uint64_t>(size.QuadPart)));
+}
+
+std::string FileStore::issueToken(const std::string& digest) {
+    UCHAR tokenBytes[attachment::TOKEN_BYTES];
+    if (!BCRYPT_SUCCESS(BCryptGenRandom(nullptr, tokenBytes, sizeof(tokenBytes), BCRYPT_USE_SYSTEM_PREFERRED_RNG))) {
+        throw std::runtime_error("Failed to generate a fetch token");
+    }
+    char hex[attachment::TOKEN_BYTES * 2 + 1];
+    for (size_t i = 0; i < attachment::TOKEN_BYTES; i++) {
+        snprintf(hex + i * 2, 3, "%02x", tokenBytes[i]);
+    }
+    std::string token(hex, attachment::TOKEN_BYTES * 2);
+    grant(digest, token);
+    return token;
+}
+
+void FileStore::grantEveryone(const std::string& digest) {
+    grant(digest, attachment::EVERYONE);
+}
+
+void FileStore::grant(const std::string& digest, const std::string& holder) {
+    if (!access[digest].insert(holder).second) {
+        return;
+    }
+    std::ofstream accessList(accessPath(), std::ios::app);
+    accessList << digest << " " << holder << "\n";
+}
+
+bool FileStore::mayFetch(const std::string& digest, const std::string& token) const {
+    auto found = access.find(digest);
+    return found != access.end() &&
+        (found->second.count(attachment::EVERYONE) != 0 || (attachment::isToken(token) && found->second.count(token) != 0));
+}
+
+std::string FileStore::accessPath() const {
+    return directory + "\\" + attachment::ACCESS_FILE;
+}
+
+std::string FileStore::pathFor(const std::string& digest) const {
+    return directory + "\\" + digest;
+}
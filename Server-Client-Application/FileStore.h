@@ -0,0 +1,138 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <winsock2.h>
+#include <mswsock.h>
+#include <windows.h>
+#include <bcrypt.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Mswsock.lib")
+#pragma comment(lib, "Bcrypt.lib")
+
+namespace attachment {
+    // Bytes per frame in either direction; chat frames never wait behind more.
+    constexpr uint32_t CHUNK_SIZE{ 64 * 1024 };
+    // Chunks a sender keeps unacknowledged before it waits for SEND_ACK. The
+    // sender paces itself by it; the server cannot tell an ack the sender has
+    // not seen yet from one it ignored, and relies on the upload byte budget.
+    constexpr uint64_t WINDOW_CHUNKS{ 8 };
+    constexpr uint64_t MAX_SIZE{ 1ull << 30 };
+    // Stored attachments plus uploads in progress; past it uploads are refused.
+    constexpr uint64_t MAX_STORE_SIZE{ 16ull << 30 };
+    // Client side: where fetched files are written.
+    constexpr const char* DOWNLOAD_DIRECTORY{ "downloads" };
+    // How often select() comes back while a TransmitFile is outstanding.
+    constexpr long PENDING_POLL_MICROSECONDS{ 1000 };
+    // SHA-256 as lowercase hex.
+    constexpr size_t DIGEST_LENGTH{ 64 };
+    // Random bytes of a fetch token, sent as lowercase hex.
+    constexpr size_t TOKEN_BYTES{ 16 };
+    // "<digest> <token>" lines in the store directory: which tokens open what.
+    constexpr const char* ACCESS_FILE{ "access" };
+    // Entry in the access list of a file sent to "all": no token needed.
+    constexpr const char* EVERYONE{ "*" };
+    bool isDigest(const std::string& text);
+    bool isToken(const std::string& text);
+    // Drops any directory part so a name can only land in the target directory.
+    std::string baseName(const std::string& path);
+}
+
+// An attachment coming in from its sender: spooled to a temporary file and
+// hashed as the chunks arrive, so it is never held in memory.
+class Upload {
+public:
+    Upload(const std::string& recipient, const std::string& name, uint64_t size, HANDLE spool,
+        const std::string& spoolPath, BCRYPT_HASH_HANDLE hash, uint64_t& reservedBytes);
+    ~Upload();
+    const std::string& recipient() const;
+    const std::string& name() const;
+    uint64_t size() const;
+    uint64_t received() const;
+    bool complete() const;
+
+private:
+    friend class FileStore;
+    std::string recipientAlias;
+    std::string fileName;
+    uint64_t expected;
+    uint64_t receivedBytes;
+    // The store's space held for this upload, given back when it ends.
+    uint64_t& reservedBytes;
+    HANDLE spool;
+    std::string spoolPath;
+    BCRYPT_HASH_HANDLE hash;
+};
+
+// An attachment going out to one recipient, a chunk per frame. The frame
+// header comes from memory and TransmitFile moves the file bytes from the
+// cache to the socket without copying them through this process.
+class Download {
+public:
+    Download(const std::string& digest, HANDLE file, uint64_t size);
+    ~Download();
+    // Starts the next chunk; false if the socket failed.
+    bool startChunk(SOCKET destination);
+    // Completes the chunk in flight if it is done; false if it failed.
+    bool pollChunk(SOCKET destination);
+    // Shared-memory sessions have no socket to transmit on: the same frame,
+    // read into memory.
+    std::string readChunk();
+    // Continues a download handed over by a previous process.
+    void resumeAt(uint64_t position);
+    bool pending() const;
+    bool complete() const;
+    const std::string& digest() const;
+    uint64_t bytesSent() const;
+
+private:
+    std::string frameHeader(uint32_t chunkLength) const;
+    std::string fileDigest;
+    HANDLE file;
+    uint64_t size;
+    uint64_t offset;
+    uint32_t chunkLength;
+    std::string header;
+    OVERLAPPED overlapped;
+    SOCKET destination;
+    bool inFlight;
+};
+
+// Content-addressed store for "$send": files are kept under their SHA-256, so
+// the same attachment sent twice is stored once. A private file is fetched
+// with the token its sender and recipients were handed when it was stored;
+// an alias proves nothing, since anyone can "$register" under it.
+class FileStore {
+public:
+    // directory: where files are kept, StoragePaths::attachments.
+    explicit FileStore(const std::string& directory);
+    ~FileStore();
+    void open();
+    // Whether MAX_STORE_SIZE leaves room for another `size` bytes.
+    bool hasRoomFor(uint64_t size) const;
+    std::unique_ptr<Upload> beginUpload(const std::string& recipient, const std::string& name, uint64_t size);
+    void append(Upload& upload, const char* bytes, size_t length);
+    // Moves the spooled file under its digest and returns the digest.
+    std::string finishUpload(Upload& upload);
+    std::unique_ptr<Download> openDownload(const std::string& digest);
+    // A new token for the file, added to its access list on disk too.
+    std::string issueToken(const std::string& digest);
+    // Lets anyone fetch the file, token or not.
+    void grantEveryone(const std::string& digest);
+    bool mayFetch(const std::string& digest, const std::string& token) const;
+
+private:
+    std::string pathFor(const std::string& digest) const;
+    std::string accessPath() const;
+    void grant(const std::string& digest, const std::string& holder);
+    std::string directory;
+    BCRYPT_ALG_HANDLE algorithm;
+    uint64_t nextSpool;
+    uint64_t storedBytes;
+    uint64_t reservedBytes;
+    std::unordered_map<std::string, std::unordered_set<std::string>> access;
+};
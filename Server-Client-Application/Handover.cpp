@@ -0,0 +1,309 @@
+#include "Handover.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <sddl.h>
+
+namespace {
+    // Length-prefixed fields in native byte order; both ends are the same
+    // program on the same machine.
+    void putBytes(std::string& out, const void* bytes, size_t length) {
+        out.append(static_cast<const char*>(bytes), length);
+    }
+
+    template <typename T>
+    void putValue(std::string& out, T value) {
+        putBytes(out, &value, sizeof(value));
+    }
+
+    void putString(std::string& out, const std::string& text) {
+        putValue<uint64_t>(out, text.size());
+        out += text;
+    }
+
+    class StateReader {
+    public:
+        explicit StateReader(const std::string& bytes) : bytes(bytes), position(0) {
+        }
+
+        void take(void* target, size_t length) {
+            if (length > bytes.size() - position) {
+                throw std::runtime_error("Handover state is truncated");
+            }
+            memcpy(target, bytes.data() + position, length);
+            position += length;
+        }
+
+        template <typename T>
+        T value() {
+            T result;
+            take(&result, sizeof(result));
+            return result;
+        }
+
+        std::string text() {
+            uint64_t length = value<uint64_t>();
+            if (length > bytes.size() - position) {
+                throw std::runtime_error("Handover state is truncated");
+            }
+            std::string result = bytes.substr(position, static_cast<size_t>(length));
+            position += static_cast<size_t>(length);
+            return result;
+        }
+
+    private:
+        const std::string& bytes;
+        size_t position;
+    };
+
+    std::string encodeState(const ServerHandover& state) {
+        std::string out;
+        putValue<uint32_t>(out, handover::FORMAT_VERSION);
+        putValue(out, state.listener);
+        putValue<uint8_t>(out, state.hasLocalListener);
+        putValue(out, state.localListener);
+        putString(out, state.hostIP);
+        putString(out, state.nodeId);
+        putValue<uint64_t>(out, state.messagesIssued);
+        putValue<uint64_t>(out, state.sessions.size());
+        for (const auto& session : state.sessions) {
+            putValue(out, session.socketInfo);
+            putString(out, session.alias);
+            putValue<uint8_t>(out, session.codec);
+            putValue<uint8_t>(out, session.peerLink);
+            putValue<uint8_t>(out, session.local);
+            putValue<uint8_t>(out, session.presence);
+            putString(out, session.peerNode);
+            putString(out, session.pendingInput);
+            putString(out, session.pendingOutput);
+            putString(out, session.sharedChannelName);
+            putValue<uint64_t>(out, session.downloads.size());
+            for (const auto& download : session.downloads) {
+                putString(out, download.digest);
+                putValue<uint64_t>(out, download.offset);
+            }
+        }
+        return out;
+    }
+
+    // A DACL with a single entry: full access for the user this process runs
+    // as. Free the descriptor with LocalFree.
+    PSECURITY_DESCRIPTOR ownerOnlyDescriptor() {
+        HANDLE token = NULL;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) {
+            return nullptr;
+        }
+        DWORD size = 0;
+        GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+        std::vector<char> user(size);
+        BOOL found = size > 0 && GetTokenInformation(token, TokenUser, user.data(), size, &size);
+        CloseHandle(token);
+        LPSTR sid = nullptr;
+        if (!found || !ConvertSidToStringSidA(reinterpret_cast<TOKEN_USER*>(user.data())->User.Sid, &sid)) {
+            return nullptr;
+        }
+        std::string sddl = std::string("D:P(A;;GA;;;") + sid + ")";
+        LocalFree(sid);
+        PSECURITY_DESCRIPTOR descriptor = nullptr;
+        if (!ConvertStringSecurityDescriptorToSecurityDescriptorA(sddl.c_str(), SDDL_REVISION_1, &descriptor, nullptr)) {
+            return nullptr;
+        }
+        return descriptor;
+    }
+
+    ServerHandover decodeState(const std::string& bytes) {
+        StateReader reader(bytes);
+        if (reader.value<uint32_t>() != handover::FORMAT_VERSION) {
+            throw std::runtime_error("The running server uses a different handover format");
+        }
+        ServerHandover state;
+        state.listener = reader.value<WSAPROTOCOL_INFOA>();
+        state.hasLocalListener = reader.value<uint8_t>() != 0;
+        state.localListener = reader.value<WSAPROTOCOL_INFOA>();
+        state.hostIP = reader.text();
+        state.nodeId = reader.text();
+        state.messagesIssued = reader.value<uint64_t>();
+        uint64_t sessionCount = reader.value<uint64_t>();
+        for (uint64_t i = 0; i < sessionCount; i++) {
+            SessionHandover session;
+            session.socketInfo = reader.value<WSAPROTOCOL_INFOA>();
+            session.alias = reader.text();
+            session.codec = reader.value<uint8_t>();
+            session.peerLink = reader.value<uint8_t>() != 0;
+            session.local = reader.value<uint8_t>() != 0;
+            session.presence = reader.value<uint8_t>() != 0;
+            session.peerNode = reader.text();
+            session.pendingInput = reader.text();
+            session.pendingOutput = reader.text();
+            session.sharedChannelName = reader.text();
+            uint64_t downloadCount = reader.value<uint64_t>();
+            for (uint64_t j = 0; j < downloadCount; j++) {
+                DownloadHandover download;
+                download.digest = reader.text();
+                download.offset = reader.value<uint64_t>();
+                session.downloads.push_back(download);
+            }
+            state.sessions.push_back(std::move(session));
+        }
+        return state;
+    }
+}
+
+std::string handover::pipeName(const std::string& listeningPort) {
+    return "\\\\.\\pipe\\ServerClientConsole-" + listeningPort + "-handover";
+}
+
+HandoverPipe::HandoverPipe() : pipe(INVALID_HANDLE_VALUE), overlapped{}, serverEnd(false) {
+}
+
+HandoverPipe::~HandoverPipe() {
+    if (pipe != INVALID_HANDLE_VALUE) {
+        CloseHandle(pipe);
+    }
+    if (overlapped.hEvent != NULL) {
+        CloseHandle(overlapped.hEvent);
+    }
+}
+
+bool HandoverPipe::listen(const std::string& listeningPort) {
+    // Without the owner-only DACL there is no pipe: the default one lets
+    // other accounts in.
+    SECURITY_ATTRIBUTES security{ sizeof(security), ownerOnlyDescriptor(), FALSE };
+    if (security.lpSecurityDescriptor == nullptr) {
+        return false;
+    }
+    pipe = CreateNamedPipeA(handover::pipeName(listeningPort).c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES,
+        handover::PIPE_BUFFER_SIZE, handover::PIPE_BUFFER_SIZE, 0, &security);
+    LocalFree(security.lpSecurityDescriptor);
+    if (pipe == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    serverEnd = true;
+    overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    return waitForConnection();
+}
+
+bool HandoverPipe::waitForConnection() {
+    ResetEvent(overlapped.hEvent);
+    if (ConnectNamedPipe(pipe, &overlapped)) {
+        return true;
+    }
+    DWORD error = GetLastError();
+    if (error == ERROR_PIPE_CONNECTED) {
+        // The successor was faster than us.
+        SetEvent(overlapped.hEvent);
+        return true;
+    }
+    return error == ERROR_IO_PENDING;
+}
+
+bool HandoverPipe::successorWaiting() {
+    return pipe != INVALID_HANDLE_VALUE && WaitForSingleObject(overlapped.hEvent, 0) == WAIT_OBJECT_0;
+}
+
+DWORD HandoverPipe::receiveSuccessorId() {
+    DWORD processId = 0;
+    readExact(&processId, sizeof(processId));
+    return processId;
+}
+
+void HandoverPipe::sendState(const ServerHandover& state) {
+    std::string bytes = encodeState(state);
+    uint64_t length = bytes.size();
+    writeAll(&length, sizeof(length));
+    writeAll(bytes.data(), bytes.size());
+}
+
+bool HandoverPipe::awaitConfirmation() {
+    char confirmation = 0;
+    try {
+        readExact(&confirmation, sizeof(confirmation));
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return confirmation == 1;
+}
+
+void HandoverPipe::rearm() {
+    DisconnectNamedPipe(pipe);
+    waitForConnection();
+}
+
+void HandoverPipe::connect(const std::string& listeningPort) {
+    std::string name = handover::pipeName(listeningPort);
+    while (true) {
+        pipe = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            break;
+        }
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeA(name.c_str(), handover::CONNECT_TIMEOUT_MS)) {
+            throw std::runtime_error("No running server to take over on port " + listeningPort + ": " + std::to_string(GetLastError()));
+        }
+    }
+    DWORD processId = GetCurrentProcessId();
+    writeAll(&processId, sizeof(processId));
+}
+
+ServerHandover HandoverPipe::receiveState() {
+    uint64_t length = 0;
+    readExact(&length, sizeof(length));
+    std::string bytes(static_cast<size_t>(length), '\0');
+    readExact(&bytes[0], bytes.size());
+    return decodeState(bytes);
+}
+
+void HandoverPipe::confirm() {
+    char confirmation = 1;
+    writeAll(&confirmation, sizeof(confirmation));
+}
+
+// The server end is overlapped so it can be polled; its reads and writes
+// still complete before returning, or fail after IO_TIMEOUT_MS.
+void HandoverPipe::writeAll(const void* bytes, size_t length) {
+    const char* next = static_cast<const char*>(bytes);
+    while (length > 0) {
+        DWORD written = 0;
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(length, handover::PIPE_BUFFER_SIZE));
+        BOOL done = WriteFile(pipe, next, chunk, &written, serverEnd ? &overlapped : nullptr);
+        if (!done && serverEnd && GetLastError() == ERROR_IO_PENDING) {
+            done = finishPending(written);
+        }
+        if (!done) {
+            throw std::runtime_error("Handover pipe write failed: " + std::to_string(GetLastError()));
+        }
+        next += written;
+        length -= written;
+    }
+}
+
+void HandoverPipe::readExact(void* bytes, size_t length) {
+    char* next = static_cast<char*>(bytes);
+    while (length > 0) {
+        DWORD bytesRead = 0;
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(length, handover::PIPE_BUFFER_SIZE));
+        BOOL done = ReadFile(pipe, next, chunk, &bytesRead, serverEnd ? &overlapped : nullptr);
+        if (!done && serverEnd && GetLastError() == ERROR_IO_PENDING) {
+            done = finishPending(bytesRead);
+        }
+        if (!done || bytesRead == 0) {
+            throw std::runtime_error("Handover pipe read failed: " + std::to_string(GetLastError()));
+        }
+        next += bytesRead;
+        length -= bytesRead;
+    }
+}
+
+// A successor that stops reading or writing must not freeze the server: the
+// operation is cancelled and reported as timed out.
+BOOL HandoverPipe::finishPending(DWORD& transferred) {
+    if (WaitForSingleObject(overlapped.hEvent, handover::IO_TIMEOUT_MS) != WAIT_OBJECT_0) {
+        CancelIoEx(pipe, &overlapped);
+        // Returns once the cancellation has landed, so the buffer is free.
+        GetOverlappedResult(pipe, &overlapped, &transferred, TRUE);
+        SetLastError(ERROR_TIMEOUT);
+        return FALSE;
+    }
+    return GetOverlappedResult(pipe, &overlapped, &transferred, FALSE);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <winsock2.h>
+#include <windows.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Advapi32.lib")
+
+namespace handover {
+    // Bumped whenever the state layout changes; mismatched binaries refuse.
+    constexpr uint32_t FORMAT_VERSION{ 2 };
+    // How long a successor waits for the running server to pick up the pipe.
+    constexpr DWORD CONNECT_TIMEOUT_MS{ 10000 };
+    // How long the running server waits on one pipe read or write before it
+    // gives up on the successor and goes back to serving.
+    constexpr DWORD IO_TIMEOUT_MS{ 5000 };
+    // How long transmits in flight get to finish before their sessions are
+    // left behind.
+    constexpr DWORD SETTLE_TIMEOUT_MS{ 2000 };
+    constexpr DWORD PIPE_BUFFER_SIZE{ 64 * 1024 };
+    std::string pipeName(const std::string& listeningPort);
+}
+
+// One file being fetched, to be resumed at the next chunk.
+struct DownloadHandover {
+    std::string digest;
+    uint64_t offset;
+};
+
+// What a session needs to carry on in the next process. Queued output and
+// partly received input travel as raw bytes so neither stream loses its
+// framing.
+struct SessionHandover {
+    WSAPROTOCOL_INFOA socketInfo;
+    std::string alias;
+    uint8_t codec;
+    bool peerLink;
+    bool local;
+    bool presence;
+    std::string peerNode;
+    std::string pendingInput;
+    std::string pendingOutput;
+    std::string sharedChannelName;
+    std::vector<DownloadHandover> downloads;
+};
+
+struct ServerHandover {
+    WSAPROTOCOL_INFOA listener;
+    bool hasLocalListener;
+    WSAPROTOCOL_INFOA localListener;
+    std::string hostIP;
+    std::string nodeId;
+    uint64_t messagesIssued;
+    std::vector<SessionHandover> sessions;
+};
+
+// Hot restart over a named pipe. The running server keeps one pipe instance
+// waiting for a successor started with --takeover. The successor sends its
+// process id and gets back every socket duplicated for it with
+// WSADuplicateSocket, plus the session state; the old process exits once the
+// successor confirms it owns them. The pipe's DACL admits only the account
+// the server runs as, so no other user can take a server over.
+class HandoverPipe {
+public:
+    HandoverPipe();
+    ~HandoverPipe();
+    // Running server: false if the pipe could not be created.
+    bool listen(const std::string& listeningPort);
+    // Polled from the select() loop without blocking.
+    bool successorWaiting();
+    DWORD receiveSuccessorId();
+    void sendState(const ServerHandover& state);
+    bool awaitConfirmation();
+    // Drops a successor that failed and waits for the next one.
+    void rearm();
+    // Successor: throws if no server is listening on the port.
+    void connect(const std::string& listeningPort);
+    ServerHandover receiveState();
+    void confirm();
+
+private:
+    void writeAll(const void* bytes, size_t length);
+    void readExact(void* bytes, size_t length);
+    bool waitForConnection();
+    BOOL finishPending(DWORD& transferred);
+    HANDLE pipe;
+    OVERLAPPED overlapped;
+    bool serverEnd;
+};
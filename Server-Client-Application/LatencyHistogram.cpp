@@ -0,0 +1,67 @@
+#include "LatencyHistogram.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram() : buckets{}, samples(0), largest(0) {
+}
+
+// Exact below HISTOGRAM_SUB_BUCKETS microseconds, then HISTOGRAM_SUB_BUCKETS
+// buckets per power of two: about 6% resolution at any scale.
+int LatencyHistogram::bucketFor(uint64_t micros) {
+    if (micros < latency::HISTOGRAM_SUB_BUCKETS) {
+        return static_cast<int>(micros);
+    }
+    int shift = static_cast<int>(std::bit_width(micros)) - 5;
+    int top = static_cast<int>(micros >> shift);
+    return latency::HISTOGRAM_SUB_BUCKETS * (shift + 1) + top - latency::HISTOGRAM_SUB_BUCKETS;
+}
+
+uint64_t LatencyHistogram::bucketLimit(int bucket) {
+    if (bucket < latency::HISTOGRAM_SUB_BUCKETS) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int shift = bucket / latency::HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t top = latency::HISTOGRAM_SUB_BUCKETS + bucket % latency::HISTOGRAM_SUB_BUCKETS;
+    return ((top + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(std::chrono::microseconds latency) {
+    uint64_t micros = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+    buckets[bucketFor(micros)]++;
+    samples++;
+    largest = std::max(largest, micros);
+}
+
+uint64_t LatencyHistogram::count() const {
+    return samples;
+}
+
+std::chrono::microseconds LatencyHistogram::percentile(double percent) const {
+    if (samples == 0) {
+        return std::chrono::microseconds(0);
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percent / 100.0 * samples)));
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < latency::HISTOGRAM_BUCKETS; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            return std::chrono::microseconds(std::min(bucketLimit(bucket), largest));
+        }
+    }
+    return maximum();
+}
+
+std::chrono::microseconds LatencyHistogram::maximum() const {
+    return std::chrono::microseconds(largest);
+}
+
+std::string LatencyHistogram::report() const {
+    std::string result = "samples=" + std::to_string(samples);
+    result += " p50_us=" + std::to_string(percentile(50).count());
+    result += " p90_us=" + std::to_string(percentile(90).count());
+    result += " p99_us=" + std::to_string(percentile(99).count());
+    result += " p999_us=" + std::to_string(percentile(99.9).count());
+    result += " max_us=" + std::to_string(largest);
+    return result;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+namespace latency {
+    // Samples are bucketed on a log scale: 16 buckets per power of two.
+    constexpr int HISTOGRAM_SUB_BUCKETS{ 16 };
+    constexpr int HISTOGRAM_BUCKETS{ 64 * HISTOGRAM_SUB_BUCKETS };
+}
+
+// Log-linear histogram of latencies in microseconds: virtual time in the
+// simulated network, $ping round trips on the client.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    void record(std::chrono::microseconds latency);
+    uint64_t count() const;
+    // Upper bound of the bucket holding the given percentile (0-100).
+    std::chrono::microseconds percentile(double percent) const;
+    std::chrono::microseconds maximum() const;
+    std::string report() const;
+
+private:
+    static int bucketFor(uint64_t micros);
+    static uint64_t bucketLimit(int bucket);
+    uint64_t buckets[latency::HISTOGRAM_BUCKETS];
+    uint64_t samples;
+    uint64_t largest;
+};
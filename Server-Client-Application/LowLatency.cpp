@@ -0,0 +1,19 @@
+#include "LowLatency.h"
+
+bool pinThread(HANDLE thread, int core) {
+    if (core < 0 || core >= static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+        return false;
+    }
+    return SetThreadAffinityMask(thread, DWORD_PTR(1) << core) != 0;
+}
+
+void prefault(std::string& buffer, size_t bytes) {
+    if (buffer.capacity() < bytes) {
+        buffer.reserve(bytes);
+    }
+    // resize() zero-fills, which writes every page; shrinking back keeps the
+    // capacity.
+    size_t used = buffer.size();
+    buffer.resize(buffer.capacity());
+    buffer.resize(used);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <windows.h>
+
+namespace lowlatency {
+    constexpr int ANY_CORE{ -1 };
+    // Receive buffer each session gets up front in low-latency mode, touched
+    // so its pages are mapped before the first frame arrives.
+    constexpr size_t PREFAULTED_INPUT{ 64 * 1024 };
+    // Round trips measured by "$ping" without a count.
+    constexpr int DEFAULT_PINGS{ 1000 };
+}
+
+// Opt-in trade of CPU for latency. busyPoll: the loop polls select() without
+// sleeping, sockets skip Nagle and take the loopback fast path, and session
+// buffers are pre-faulted and kept. The cores pin the network thread and the
+// diagnostics writer; ANY_CORE leaves them to the scheduler.
+struct LatencyTuning {
+    bool busyPoll = false;
+    int reactorCore = lowlatency::ANY_CORE;
+    int logCore = lowlatency::ANY_CORE;
+};
+
+// false if the core does not exist or the mask was refused.
+bool pinThread(HANDLE thread, int core);
+// Grows `buffer` to at least `bytes` of capacity and writes every page of it.
+// Its contents are kept.
+void prefault(std::string& buffer, size_t bytes);
@@ -0,0 +1,47 @@
+#include "MemoryBudget.h"
+
+MemoryBudget::MemoryBudget() : usedBytes(0), ceilingBytes(memory::DEFAULT_CEILING) {
+}
+
+void MemoryBudget::setCeiling(uint64_t bytes) {
+    ceilingBytes.store(bytes);
+}
+
+uint64_t MemoryBudget::ceiling() const {
+    return ceilingBytes.load();
+}
+
+void MemoryBudget::charge(int64_t bytes) {
+    usedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+uint64_t MemoryBudget::used() const {
+    int64_t used = usedBytes.load(std::memory_order_relaxed);
+    return used > 0 ? static_cast<uint64_t>(used) : 0;
+}
+
+memory::Pressure MemoryBudget::pressure() const {
+    uint64_t used = this->used();
+    uint64_t limit = ceiling();
+    if (used >= limit) {
+        return memory::REJECT_CONNECTIONS;
+    }
+    if (used >= limit / 100 * memory::REFUSE_HISTORY_PERCENT) {
+        return memory::REFUSE_HISTORY;
+    }
+    if (used >= limit / 100 * memory::SHED_BROADCASTS_PERCENT) {
+        return memory::SHED_BROADCASTS;
+    }
+    return memory::NORMAL;
+}
+
+bool MemoryBudget::fits(uint64_t bytes) const {
+    return used() + bytes < ceiling();
+}
+
+// How much has to be freed to fall back below the first shedding stage.
+uint64_t MemoryBudget::bytesOverShedding() const {
+    uint64_t threshold = ceiling() / 100 * memory::SHED_BROADCASTS_PERCENT;
+    uint64_t used = this->used();
+    return used > threshold ? used - threshold : 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace memory {
+    constexpr uint64_t DEFAULT_CEILING{ 512ull << 20 };
+    // Shedding stages, as a share of the ceiling.
+    constexpr int SHED_BROADCASTS_PERCENT{ 80 };
+    constexpr int REFUSE_HISTORY_PERCENT{ 90 };
+    // Output one session may hold before its oldest broadcasts are dropped.
+    constexpr size_t SESSION_OUTBOX_LIMIT{ 4 << 20 };
+    // Idle input buffers larger than this are given back.
+    constexpr size_t IDLE_BUFFER_RETAIN{ 256 };
+
+    enum Pressure {
+        NORMAL = 0,
+        SHED_BROADCASTS = 1,
+        REFUSE_HISTORY = 2,
+        REJECT_CONNECTIONS = 3,
+    };
+}
+
+// Bytes held for sessions (input buffers, queued output) and history caches,
+// against one configurable ceiling. Charged from the network thread. The
+// search index keeps its own count: it cannot be shed, so it must not gate
+// admission.
+class MemoryBudget {
+public:
+    MemoryBudget();
+    void setCeiling(uint64_t bytes);
+    uint64_t ceiling() const;
+    void charge(int64_t bytes);
+    uint64_t used() const;
+    memory::Pressure pressure() const;
+    bool fits(uint64_t bytes) const;
+    uint64_t bytesOverShedding() const;
+
+private:
+    std::atomic<int64_t> usedBytes;
+    std::atomic<uint64_t> ceilingBytes;
+};
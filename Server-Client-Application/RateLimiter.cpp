@@ -0,0 +1,60 @@
+#include "RateLimiter.h"
+#include <algorithm>
+
+TokenBucket::TokenBucket(const TimeSource& clock, double ratePerSecond, double burst)
+    : clock(clock), ratePerSecond(ratePerSecond), capacity(burst), tokens(burst), lastRefill(clock.now()) {
+}
+
+void TokenBucket::refill() {
+    auto now = clock.now();
+    std::chrono::duration<double> elapsed = now - lastRefill;
+    lastRefill = now;
+    tokens = std::min(capacity, tokens + elapsed.count() * ratePerSecond);
+}
+
+bool TokenBucket::tryTake(double amount) {
+    refill();
+    if (tokens < amount) {
+        return false;
+    }
+    tokens -= amount;
+    return true;
+}
+
+// Takes tokens even if that leaves the bucket in debt. Used for costs that are
+// only known after the work is done, such as the size of a $getlog reply.
+void TokenBucket::charge(double amount) {
+    refill();
+    tokens -= amount;
+}
+
+bool TokenBucket::hasTokens() {
+    refill();
+    return tokens > 0;
+}
+
+double TokenBucket::secondsUntil(double amount) {
+    refill();
+    if (tokens >= amount || ratePerSecond <= 0) {
+        return 0;
+    }
+    return (amount - tokens) / ratePerSecond;
+}
+
+// Starts full at the new burst.
+void TokenBucket::setRate(double rate, double burst) {
+    ratePerSecond = rate;
+    capacity = burst;
+    tokens = burst;
+    lastRefill = clock.now();
+}
+
+SessionLimits::SessionLimits(const TimeSource& clock)
+    : chatMessages(clock, ratelimit::CHAT_MESSAGES_PER_SECOND, ratelimit::CHAT_MESSAGE_BURST),
+    chatBytes(clock, ratelimit::CHAT_BYTES_PER_SECOND, ratelimit::CHAT_BYTE_BURST),
+    commands(clock, ratelimit::COMMANDS_PER_SECOND, ratelimit::COMMAND_BURST),
+    commandBytes(clock, ratelimit::COMMAND_BYTES_PER_SECOND, ratelimit::COMMAND_BYTE_BURST),
+    pings(clock, ratelimit::PINGS_PER_SECOND, ratelimit::PING_BURST),
+    uploadBytes(clock, ratelimit::UPLOAD_BYTES_PER_SECOND, ratelimit::UPLOAD_BYTE_BURST),
+    throttleNotified(false) {
+}
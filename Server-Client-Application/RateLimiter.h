@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include "Environment.h"
+
+namespace ratelimit {
+    // Chat: sustained rate and burst, per session.
+    constexpr double CHAT_MESSAGES_PER_SECOND{ 10.0 };
+    constexpr double CHAT_MESSAGE_BURST{ 30.0 };
+    constexpr double CHAT_BYTES_PER_SECOND{ 32.0 * 1024 };
+    constexpr double CHAT_BYTE_BURST{ 128.0 * 1024 };
+    // Expensive commands ($getlog, $getlist): requests and reply bytes.
+    constexpr double COMMANDS_PER_SECOND{ 0.5 };
+    constexpr double COMMAND_BURST{ 3.0 };
+    constexpr double COMMAND_BYTES_PER_SECOND{ 256.0 * 1024 };
+    constexpr double COMMAND_BYTE_BURST{ 4.0 * 1024 * 1024 };
+    // Attachment bytes a session may upload; over it, its frames are read
+    // more slowly and TCP holds the sender back.
+    constexpr double UPLOAD_BYTES_PER_SECOND{ 8.0 * 1024 * 1024 };
+    constexpr double UPLOAD_BYTE_BURST{ 16.0 * 1024 * 1024 };
+    // "$ping": a default run of round trips fits in the burst; a session
+    // pinging nonstop is held to the sustained rate.
+    constexpr double PINGS_PER_SECOND{ 1000.0 };
+    constexpr double PING_BURST{ 1000.0 };
+    // Frames one session may have handled per event loop iteration.
+    constexpr int FRAMES_PER_TICK{ 8 };
+}
+
+class TokenBucket {
+public:
+    TokenBucket(const TimeSource& clock, double ratePerSecond, double burst);
+    bool tryTake(double amount);
+    void charge(double amount);
+    bool hasTokens();
+    // Time until `amount` tokens are available; 0 if they are now.
+    double secondsUntil(double amount);
+    void setRate(double ratePerSecond, double burst);
+
+private:
+    void refill();
+    const TimeSource& clock;
+    double ratePerSecond;
+    double capacity;
+    double tokens;
+    TimeSource::time_point lastRefill;
+};
+
+struct SessionLimits {
+    explicit SessionLimits(const TimeSource& clock);
+    TokenBucket chatMessages;
+    TokenBucket chatBytes;
+    TokenBucket commands;
+    TokenBucket commandBytes;
+    TokenBucket pings;
+    TokenBucket uploadBytes;
+    bool throttleNotified;
+};
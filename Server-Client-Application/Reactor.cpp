@@ -0,0 +1,219 @@
+#include "Reactor.h"
+#include <algorithm>
+#include <new>
+#include <cstring>
+
+namespace {
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    thread_local FreeBlock* freeLists[reactor::POOLED_FRAME_LIMIT / reactor::FRAME_SIZE_CLASS] = {};
+}
+
+void* FramePool::allocate(size_t size) {
+    if (size > reactor::POOLED_FRAME_LIMIT) {
+        return ::operator new(size);
+    }
+    size_t sizeClass = (size - 1) / reactor::FRAME_SIZE_CLASS;
+    FreeBlock*& head = freeLists[sizeClass];
+    if (head != nullptr) {
+        FreeBlock* block = head;
+        head = block->next;
+        return block;
+    }
+    return ::operator new((sizeClass + 1) * reactor::FRAME_SIZE_CLASS);
+}
+
+void FramePool::release(void* block, size_t size) {
+    if (size > reactor::POOLED_FRAME_LIMIT) {
+        ::operator delete(block);
+        return;
+    }
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    FreeBlock*& head = freeLists[(size - 1) / reactor::FRAME_SIZE_CLASS];
+    freed->next = head;
+    head = freed;
+}
+
+Reactor::Reactor(const TimeSource& clock, SocketLayer& sockets) : clock(clock), socketLayer(sockets) {
+}
+
+Reactor::Clock::time_point Reactor::now() const {
+    return clock.now();
+}
+
+SocketLayer& Reactor::sockets() const {
+    return socketLayer;
+}
+
+void Reactor::watch(SOCKET socket, ReadWaiter* waiter, Clock::time_point deadline) {
+    watches[socket] = Watch{ waiter, deadline };
+}
+
+void Reactor::schedule(std::coroutine_handle<> handle, Clock::time_point when) {
+    timers.emplace(when, handle);
+}
+
+void Reactor::deferToNextTick(std::coroutine_handle<> handle) {
+    deferred.push_back(handle);
+}
+
+void Reactor::prepare(fd_set& readSet) const {
+    for (const auto& watch : watches) {
+        FD_SET(watch.first, &readSet);
+    }
+}
+
+// The select() timeout: the regular wait, shortened to the next timer or read
+// deadline, or zero when sessions are waiting for the next tick.
+timeval Reactor::nextTimeout(const timeval& maximum) const {
+    if (!deferred.empty()) {
+        return timeval{ 0, 0 };
+    }
+    Clock::time_point now = clock.now();
+    Clock::time_point wakeUp = now + std::chrono::seconds(maximum.tv_sec) + std::chrono::microseconds(maximum.tv_usec);
+    if (!timers.empty()) {
+        wakeUp = std::min(wakeUp, timers.begin()->first);
+    }
+    for (const auto& watch : watches) {
+        wakeUp = std::min(wakeUp, watch.second.deadline);
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::microseconds>(std::max(wakeUp - now, Clock::duration::zero()));
+    return timeval{ static_cast<long>(wait.count() / 1000000), static_cast<long>(wait.count() % 1000000) };
+}
+
+void Reactor::dispatch(const fd_set& readSet) {
+    // Collect first: resumed sessions register new watches and timers.
+    Clock::time_point now = clock.now();
+    std::vector<ReadWaiter*> readable;
+    std::vector<ReadWaiter*> expired;
+    for (auto it = watches.begin(); it != watches.end();) {
+        if (FD_ISSET(it->first, &readSet)) {
+            readable.push_back(it->second.waiter);
+            it = watches.erase(it);
+        }
+        else if (it->second.deadline <= now) {
+            expired.push_back(it->second.waiter);
+            it = watches.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    std::vector<std::coroutine_handle<>> runnable;
+    runnable.swap(deferred);
+    while (!timers.empty() && timers.begin()->first <= now) {
+        runnable.push_back(timers.begin()->second);
+        timers.erase(timers.begin());
+    }
+
+    for (ReadWaiter* waiter : readable) {
+        waiter->onReadable();
+    }
+    for (ReadWaiter* waiter : expired) {
+        waiter->onTimeout();
+    }
+    for (auto handle : runnable) {
+        handle.resume();
+    }
+}
+
+FrameAwaiter::FrameAwaiter(Reactor& reactor, Client* client, Reactor::Clock::time_point deadline)
+    : reactor(reactor), client(client), deadline(deadline), result{ FrameStatus::RECEIVED, std::string(), false } {
+}
+
+bool FrameAwaiter::await_ready() {
+    if (client->sharedChannel() != nullptr) {
+        client->sharedChannel()->receiveInto(client->inputBuffer());
+    }
+    return extractFrame();
+}
+
+bool FrameAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    waitingSession = handle;
+    result.waited = true;
+    return !frameReadyOrWatch();
+}
+
+// Returns true if a frame is ready; otherwise the socket is being watched.
+// A shared-memory writer only rings once the reader is flagged as waiting,
+// so the ring is checked again after raising the flag.
+bool FrameAwaiter::frameReadyOrWatch() {
+    while (!extractFrame()) {
+        SharedChannel* channel = client->sharedChannel();
+        if (channel == nullptr || channel->prepareToWait()) {
+            reactor.watch(client->retrieveEndpoint(), this, deadline);
+            return false;
+        }
+        channel->receiveInto(client->inputBuffer());
+    }
+    return true;
+}
+
+FrameResult FrameAwaiter::await_resume() {
+    return std::move(result);
+}
+
+void FrameAwaiter::onReadable() {
+    if (!receiveAvailable()) {
+        result.status = FrameStatus::CLOSED;
+        waitingSession.resume();
+        return;
+    }
+    if (client->sharedChannel() != nullptr) {
+        client->sharedChannel()->finishWait();
+        client->sharedChannel()->receiveInto(client->inputBuffer());
+    }
+    if (frameReadyOrWatch()) {
+        waitingSession.resume();
+    }
+}
+
+void FrameAwaiter::onTimeout() {
+    if (client->sharedChannel() != nullptr) {
+        client->sharedChannel()->finishWait();
+    }
+    result.status = FrameStatus::TIMED_OUT;
+    waitingSession.resume();
+}
+
+bool FrameAwaiter::extractFrame() {
+    std::string& input = client->inputBuffer();
+    uint32_t SizeOfMsg = 0;
+    if (input.size() < sizeof(SizeOfMsg)) {
+        return false;
+    }
+    memcpy(&SizeOfMsg, input.data(), sizeof(SizeOfMsg));
+    if (SizeOfMsg > reactor::MAX_FRAME_SIZE) {
+        result.status = FrameStatus::CLOSED;
+        return true;
+    }
+    if (input.size() < sizeof(SizeOfMsg) + SizeOfMsg) {
+        return false;
+    }
+    result.notification.assign(input, sizeof(SizeOfMsg), SizeOfMsg);
+    input.erase(0, sizeof(SizeOfMsg) + SizeOfMsg);
+    return true;
+}
+
+// One recv per readiness report, sized to what is queued, so it cannot block.
+bool FrameAwaiter::receiveAvailable() {
+    u_long pending = 0;
+    SocketLayer& sockets = reactor.sockets();
+    if (sockets.pending(client->retrieveEndpoint(), pending) == SOCKET_ERROR) {
+        return false;
+    }
+    if (client->sharedChannel() != nullptr) {
+        // Doorbells carry no data.
+        char bells[64];
+        int wanted = static_cast<int>(std::min<u_long>(std::max<u_long>(pending, 1), sizeof(bells)));
+        return sockets.recv(client->retrieveEndpoint(), bells, wanted) > 0;
+    }
+    std::string& input = client->inputBuffer();
+    size_t oldSize = input.size();
+    int wanted = static_cast<int>(std::min<u_long>(std::max<u_long>(pending, 1), reactor::MAX_FRAME_SIZE));
+    input.resize(oldSize + wanted);
+    int nbytes = sockets.recv(client->retrieveEndpoint(), &input[oldSize], wanted);
+    input.resize(oldSize + std::max(nbytes, 0));
+    return nbytes > 0;
+}
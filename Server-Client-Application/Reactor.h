@@ -0,0 +1,148 @@
+#pragma once
+
+#include <coroutine>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <winsock2.h>
+#include "Client.h"
+#include "Environment.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace reactor {
+    // Frames announcing more than this are treated as a protocol error.
+    constexpr uint32_t MAX_FRAME_SIZE{ 1 << 20 };
+    // How long a session waits for the client to close after "$exit".
+    constexpr std::chrono::seconds EXIT_LINGER{ 2 };
+    // A session about to close checks this often whether its last replies
+    // have left the outbox, for at most EXIT_LINGER.
+    constexpr std::chrono::milliseconds CLOSE_FLUSH_POLL{ 10 };
+    // Coroutine frames up to POOLED_FRAME_LIMIT are recycled in FRAME_SIZE_CLASS steps.
+    constexpr size_t FRAME_SIZE_CLASS{ 256 };
+    constexpr size_t POOLED_FRAME_LIMIT{ 4096 };
+}
+
+// Free lists for coroutine frames, so starting a session does not hit the
+// general-purpose heap once the pool is warm. Per thread, never shrinks.
+class FramePool {
+public:
+    static void* allocate(size_t size);
+    static void release(void* block, size_t size);
+};
+
+// Return type of session coroutines. Runs eagerly up to its first suspension
+// and frees its own frame when it finishes.
+struct SessionTask {
+    struct promise_type {
+        SessionTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { throw; }
+        static void* operator new(size_t size) { return FramePool::allocate(size); }
+        static void operator delete(void* block, size_t size) { FramePool::release(block, size); }
+    };
+};
+
+// Drives suspended sessions from the server's select() loop: sockets being
+// read, sleeping sessions and sessions that yielded for the rest of the tick.
+// Timers and deadlines run on the environment's clock, reads go through its
+// socket layer.
+class Reactor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Reactor(const TimeSource& clock, SocketLayer& sockets);
+    Clock::time_point now() const;
+    SocketLayer& sockets() const;
+
+    class ReadWaiter {
+    public:
+        virtual void onReadable() = 0;
+        virtual void onTimeout() = 0;
+    protected:
+        ~ReadWaiter() = default;
+    };
+
+    void watch(SOCKET socket, ReadWaiter* waiter, Clock::time_point deadline);
+    void schedule(std::coroutine_handle<> handle, Clock::time_point when);
+    void deferToNextTick(std::coroutine_handle<> handle);
+    void prepare(fd_set& readSet) const;
+    timeval nextTimeout(const timeval& maximum) const;
+    void dispatch(const fd_set& readSet);
+
+private:
+    struct Watch {
+        ReadWaiter* waiter;
+        Clock::time_point deadline;
+    };
+    const TimeSource& clock;
+    SocketLayer& socketLayer;
+    std::unordered_map<SOCKET, Watch> watches;
+    std::multimap<Clock::time_point, std::coroutine_handle<>> timers;
+    std::vector<std::coroutine_handle<>> deferred;
+};
+
+enum class FrameStatus {
+    RECEIVED,
+    CLOSED,
+    TIMED_OUT,
+};
+
+struct FrameResult {
+    FrameStatus status;
+    std::string notification;
+    bool waited;
+};
+
+// co_await FrameAwaiter(reactor, client) yields the next length-prefixed frame
+// from the client. Bytes are only read when select() reports the socket ready,
+// so a client that stalls halfway through a frame never blocks the thread.
+// Clients on shared memory are read from their ring; their socket then only
+// wakes the reactor.
+class FrameAwaiter : public Reactor::ReadWaiter {
+public:
+    FrameAwaiter(Reactor& reactor, Client* client, Reactor::Clock::time_point deadline = Reactor::Clock::time_point::max());
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> handle);
+    FrameResult await_resume();
+    void onReadable() override;
+    void onTimeout() override;
+
+private:
+    bool extractFrame();
+    bool frameReadyOrWatch();
+    bool receiveAvailable();
+    Reactor& reactor;
+    Client* client;
+    Reactor::Clock::time_point deadline;
+    std::coroutine_handle<> waitingSession;
+    FrameResult result;
+};
+
+struct SleepAwaiter {
+    Reactor& reactor;
+    Reactor::Clock::duration duration;
+    bool await_ready() const noexcept { return duration <= Reactor::Clock::duration::zero(); }
+    void await_suspend(std::coroutine_handle<> handle) { reactor.schedule(handle, reactor.now() + duration); }
+    void await_resume() const noexcept {}
+};
+
+struct NextTickAwaiter {
+    Reactor& reactor;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) { reactor.deferToNextTick(handle); }
+    void await_resume() const noexcept {}
+};
+
+inline SleepAwaiter sleepFor(Reactor& reactor, Reactor::Clock::duration duration) {
+    return SleepAwaiter{ reactor, duration };
+}
+
+inline NextTickAwaiter nextTick(Reactor& reactor) {
+    return NextTickAwaiter{ reactor };
+}
@@ -0,0 +1,217 @@
+#include "RioSender.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+RioSender::RioSender()
+    : rio{}, completionQueue(RIO_INVALID_CQ), completionQueueSize(0), sendBuffer(nullptr), sendBufferId(RIO_INVALID_BUFFERID),
+    firstSliceId(0), bufferHead(0), bufferTail(0), outstandingSends(0), active(false) {
+}
+
+RioSender::~RioSender() {
+    if (sendBufferId != RIO_INVALID_BUFFERID) {
+        rio.RIODeregisterBuffer(sendBufferId);
+    }
+    if (completionQueue != RIO_INVALID_CQ) {
+        rio.RIOCloseCompletionQueue(completionQueue);
+    }
+    if (sendBuffer != nullptr) {
+        VirtualFree(sendBuffer, 0, MEM_RELEASE);
+    }
+}
+
+bool RioSender::initialize(SOCKET listeningSocket, size_t expectedSockets) {
+    GUID functionTableId = WSAID_MULTIPLE_RIO;
+    DWORD bytesReturned = 0;
+    if (WSAIoctl(listeningSocket, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &functionTableId, sizeof(functionTableId),
+        &rio, sizeof(rio), &bytesReturned, NULL, NULL) == SOCKET_ERROR) {
+        std::cerr << "Registered I/O is not available: " << WSAGetLastError() << std::endl;
+        return false;
+    }
+
+    // Every request queue reserves its send slots and one receive slot. No
+    // notification: the event loop polls the queue.
+    completionQueueSize = static_cast<DWORD>((io::RIO_SEND_SLOTS + 1) * (expectedSockets + 1));
+    completionQueue = rio.RIOCreateCompletionQueue(completionQueueSize, NULL);
+    if (completionQueue == RIO_INVALID_CQ) {
+        std::cerr << "Error creating RIO completion queue: " << WSAGetLastError() << std::endl;
+        return false;
+    }
+
+    sendBuffer = static_cast<char*>(VirtualAlloc(NULL, io::RIO_SEND_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (sendBuffer == nullptr) {
+        std::cerr << "Error allocating RIO send buffer: " << GetLastError() << std::endl;
+        return false;
+    }
+    sendBufferId = rio.RIORegisterBuffer(sendBuffer, io::RIO_SEND_BUFFER_SIZE);
+    if (sendBufferId == RIO_INVALID_BUFFERID) {
+        std::cerr << "Error registering RIO send buffer: " << WSAGetLastError() << std::endl;
+        return false;
+    }
+    active = true;
+    return true;
+}
+
+bool RioSender::isActive() const {
+    return active;
+}
+
+RioSender::SendQueue* RioSender::queueFor(SOCKET socket) {
+    auto it = sendQueues.find(socket);
+    if (it != sendQueues.end()) {
+        return it->second.get();
+    }
+    if (plainSockets.count(socket) != 0) {
+        return nullptr;
+    }
+
+    size_t requestQueues = sendQueues.size() + forgottenQueues.size() + 1;
+    if ((io::RIO_SEND_SLOTS + 1) * requestQueues > completionQueueSize) {
+        if (!rio.RIOResizeCompletionQueue(completionQueue, completionQueueSize * 2)) {
+            plainSockets.insert(socket);
+            return nullptr;
+        }
+        completionQueueSize *= 2;
+    }
+    auto queue = std::make_unique<SendQueue>();
+    // Completions carry the queue back as their socket context.
+    queue->requestQueue = rio.RIOCreateRequestQueue(socket, 1, 1, io::RIO_SEND_SLOTS, 1, completionQueue, completionQueue, queue.get());
+    if (queue->requestQueue == RIO_INVALID_RQ) {
+        // Socket was not created for registered I/O.
+        plainSockets.insert(socket);
+        return nullptr;
+    }
+    SendQueue* created = queue.get();
+    sendQueues[socket] = std::move(queue);
+    return created;
+}
+
+// Sockets are closed by the server; the request queue goes away with them.
+// Sends still outstanding complete as aborted and are reaped as usual.
+void RioSender::forget(SOCKET socket) {
+    plainSockets.erase(socket);
+    auto it = sendQueues.find(socket);
+    if (it == sendQueues.end()) {
+        return;
+    }
+    if (it->second->outstanding > 0) {
+        it->second->forgotten = true;
+        forgottenQueues.push_back(std::move(it->second));
+    }
+    sendQueues.erase(it);
+}
+
+bool RioSender::sending(SOCKET socket) const {
+    auto it = sendQueues.find(socket);
+    return it != sendQueues.end() && it->second->outstanding > 0;
+}
+
+bool RioSender::sending() const {
+    return outstandingSends > 0;
+}
+
+// Takes `length` contiguous bytes at the tail of the ring, wrapping to the
+// start when the end is too short. The tail never catches up with the head.
+bool RioSender::reserve(ULONG length, ULONG& offset) {
+    if (slices.empty()) {
+        bufferHead = 0;
+        bufferTail = 0;
+    }
+    if (bufferTail >= bufferHead) {
+        if (io::RIO_SEND_BUFFER_SIZE - bufferTail >= length) {
+            offset = bufferTail;
+        }
+        else if (bufferHead > length) {
+            offset = 0;
+        }
+        else {
+            return false;
+        }
+    }
+    else if (bufferHead - bufferTail > length) {
+        offset = bufferTail;
+    }
+    else {
+        return false;
+    }
+    bufferTail = offset + length;
+    return true;
+}
+
+// Slices are handed out in order, so they are reclaimed from the front.
+void RioSender::release(ULONG_PTR sliceId) {
+    slices[static_cast<size_t>(sliceId - firstSliceId)].references--;
+    while (!slices.empty() && slices.front().references == 0) {
+        slices.pop_front();
+        firstSliceId++;
+    }
+    if (!slices.empty()) {
+        bufferHead = slices.front().offset;
+    }
+}
+
+void RioSender::sendFrame(const std::string& frame, const std::vector<SOCKET>& recipients, std::vector<SOCKET>& refused) {
+    ULONG length = static_cast<ULONG>(frame.size());
+    ULONG offset = 0;
+    if (frame.size() > io::RIO_SEND_BUFFER_SIZE || !reserve(length, offset)) {
+        refused.insert(refused.end(), recipients.begin(), recipients.end());
+        return;
+    }
+    memcpy(sendBuffer + offset, frame.data(), frame.size());
+    ULONG_PTR sliceId = firstSliceId + slices.size();
+    slices.push_back({ offset, length, 0 });
+    RIO_BUF slice{ sendBufferId, offset, length };
+    for (SOCKET recipient : recipients) {
+        SendQueue* queue = queueFor(recipient);
+        if (queue != nullptr && queue->outstanding < io::RIO_SEND_SLOTS
+            && rio.RIOSend(queue->requestQueue, &slice, 1, 0, reinterpret_cast<PVOID>(sliceId))) {
+            queue->outstanding++;
+            slices.back().references++;
+            outstandingSends++;
+        }
+        else {
+            refused.push_back(recipient);
+        }
+    }
+    if (slices.back().references == 0) {
+        // Nobody took it: give the slice straight back.
+        slices.pop_back();
+        bufferTail = offset;
+    }
+}
+
+int RioSender::reapCompletions() {
+    int failedSends = 0;
+    RIORESULT results[64];
+    while (outstandingSends > 0) {
+        ULONG completed = rio.RIODequeueCompletion(completionQueue, results, 64);
+        if (completed == RIO_CORRUPT_CQ) {
+            std::cerr << "RIO completion queue is corrupt" << std::endl;
+            // Nothing more will be reaped; let the sockets go back to send().
+            active = false;
+            failedSends += static_cast<int>(outstandingSends);
+            outstandingSends = 0;
+            sendQueues.clear();
+            forgottenQueues.clear();
+            slices.clear();
+            return failedSends;
+        }
+        for (ULONG i = 0; i < completed; i++) {
+            if (results[i].Status != 0) {
+                failedSends++;
+            }
+            SendQueue* queue = reinterpret_cast<SendQueue*>(static_cast<ULONG_PTR>(results[i].SocketContext));
+            queue->outstanding--;
+            if (queue->forgotten && queue->outstanding == 0) {
+                forgottenQueues.erase(std::find_if(forgottenQueues.begin(), forgottenQueues.end(),
+                    [queue](const std::unique_ptr<SendQueue>& forgotten) { return forgotten.get() == queue; }));
+            }
+            release(static_cast<ULONG_PTR>(results[i].RequestContext));
+            outstandingSends--;
+        }
+        if (completed < 64) {
+            break;
+        }
+    }
+    return failedSends;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <winsock2.h>
+#include <mswsock.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace io {
+    // Socket I/O backend picked at startup. REGISTERED_IO falls back to SELECT
+    // when the RIO extension is not available.
+    enum Backend {
+        SELECT = 0,
+        REGISTERED_IO = 1,
+    };
+    // Pre-registered send buffer shared by all broadcasts, used as a ring:
+    // each frame takes a slice that is reused once all its sends complete.
+    constexpr DWORD RIO_SEND_BUFFER_SIZE{ 1 << 20 };
+    // Sends one socket may have outstanding before its frames go to the outbox.
+    constexpr ULONG RIO_SEND_SLOTS{ 16 };
+}
+
+// Broadcast path on Winsock Registered I/O. Each frame is copied once into a
+// pre-registered buffer and every recipient gets a RIOSend pointing at it, so
+// no per-send buffer probing or locking happens and one slow reader no longer
+// holds up the sends queued behind it. Nothing here waits: completions are
+// reaped from the event loop, and a recipient without a free send slot or
+// without room left in the buffer is handed back for the ordinary send path.
+class RioSender {
+public:
+    RioSender();
+    ~RioSender();
+    bool initialize(SOCKET listeningSocket, size_t expectedSockets);
+    bool isActive() const;
+    // Posts the frame to every recipient it can. The ones it could not take
+    // are added to `refused`; the caller sends them the frame itself.
+    void sendFrame(const std::string& frame, const std::vector<SOCKET>& recipients, std::vector<SOCKET>& refused);
+    // Dequeues finished sends without waiting. Returns the ones that failed.
+    int reapCompletions();
+    // Sends are outstanding on this socket (or on any); nothing else may write
+    // to it until they complete.
+    bool sending(SOCKET socket) const;
+    bool sending() const;
+    void forget(SOCKET socket);
+
+private:
+    // A socket's request queue. Outlives the socket while sends it posted are
+    // still to be reaped, since their completions point back at it.
+    struct SendQueue {
+        RIO_RQ requestQueue = RIO_INVALID_RQ;
+        ULONG outstanding = 0;
+        bool forgotten = false;
+    };
+    // A frame's region of the send buffer and the sends still reading it.
+    struct Slice {
+        ULONG offset;
+        ULONG length;
+        ULONG references;
+    };
+    SendQueue* queueFor(SOCKET socket);
+    bool reserve(ULONG length, ULONG& offset);
+    void release(ULONG_PTR sliceId);
+    RIO_EXTENSION_FUNCTION_TABLE rio;
+    RIO_CQ completionQueue;
+    DWORD completionQueueSize;
+    char* sendBuffer;
+    RIO_BUFFERID sendBufferId;
+    std::unordered_map<SOCKET, std::unique_ptr<SendQueue>> sendQueues;
+    std::vector<std::unique_ptr<SendQueue>> forgottenQueues;
+    std::unordered_set<SOCKET> plainSockets;
+    // Live slices in buffer order; the front one has id firstSliceId. Ids
+    // travel as request contexts, so they are pointer-sized and wrap.
+    std::deque<Slice> slices;
+    ULONG_PTR firstSliceId;
+    ULONG bufferHead;
+    ULONG bufferTail;
+    size_t outstandingSends;
+    bool active;
+};
@@ -0,0 +1,112 @@
+#include "Roster.h"
+#include <algorithm>
+
+Roster::Roster() : currentVersion(0), cachedVersion(UINT64_MAX) {
+}
+
+std::string Roster::delta(const std::string& change) {
+    currentVersion++;
+    return "PRESENCE " + std::to_string(currentVersion) + " " + change;
+}
+
+std::string Roster::join(const std::string& alias) {
+    if (sessions[alias]++ > 0) {
+        return std::string();
+    }
+    return delta("JOIN " + alias);
+}
+
+std::string Roster::leave(const std::string& alias) {
+    auto it = sessions.find(alias);
+    if (it == sessions.end()) {
+        return std::string();
+    }
+    if (--it->second > 0) {
+        return std::string();
+    }
+    sessions.erase(it);
+    return delta("LEAVE " + alias);
+}
+
+// Collapses to a single JOIN or LEAVE when only one side of the rename is
+// visible, e.g. when another session keeps the old alias.
+std::string Roster::rename(const std::string& from, const std::string& to) {
+    if (from == to) {
+        return std::string();
+    }
+    auto old = sessions.find(from);
+    bool fromGone = old != sessions.end() && old->second == 1;
+    if (old != sessions.end() && --old->second == 0) {
+        sessions.erase(old);
+    }
+    bool toNew = sessions[to]++ == 0;
+    if (fromGone && toNew) {
+        return delta("RENAME " + from + " " + to);
+    }
+    if (fromGone) {
+        return delta("LEAVE " + from);
+    }
+    if (toNew) {
+        return delta("JOIN " + to);
+    }
+    return std::string();
+}
+
+uint64_t Roster::version() const {
+    return currentVersion;
+}
+
+// Sorted, so the same membership always reads the same.
+void Roster::rebuild() {
+    if (cachedVersion == currentVersion) {
+        return;
+    }
+    std::vector<const std::string*> aliases;
+    aliases.reserve(sessions.size());
+    for (const auto& entry : sessions) {
+        aliases.push_back(&entry.first);
+    }
+    std::sort(aliases.begin(), aliases.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+    std::string names;
+    for (const std::string* alias : aliases) {
+        if (!names.empty()) {
+            names += ",";
+        }
+        names += *alias;
+    }
+    cachedListing = aliases.size() > 1 ? "LIST " + names : "LIST You are all alone in this server\n";
+    cachedSnapshot = "ROSTER " + std::to_string(currentVersion) + " " + names;
+    cachedVersion = currentVersion;
+}
+
+const std::string& Roster::listing() {
+    rebuild();
+    return cachedListing;
+}
+
+const std::string& Roster::snapshot() {
+    rebuild();
+    return cachedSnapshot;
+}
+
+void Roster::subscribe(Client* client) {
+    if (std::find(subscriberList.begin(), subscriberList.end(), client) == subscriberList.end()) {
+        subscriberList.push_back(client);
+    }
+}
+
+void Roster::unsubscribe(Client* client) {
+    auto it = std::find(subscriberList.begin(), subscriberList.end(), client);
+    if (it != subscriberList.end()) {
+        *it = subscriberList.back();
+        subscriberList.pop_back();
+    }
+}
+
+bool Roster::subscribed(Client* client) const {
+    return std::find(subscriberList.begin(), subscriberList.end(), client) != subscriberList.end();
+}
+
+const std::vector<Client*>& Roster::subscribers() const {
+    return subscriberList;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+class Client;
+
+// Who is online, local and remote, with a version that moves on every
+// visible change. Replies to $getlist and $presence are cached per version,
+// so a poll between two changes costs nothing to build. Subscribers get each
+// change as a delta:
+//   "PRESENCE <version> JOIN <alias>"
+//   "PRESENCE <version> LEAVE <alias>"
+//   "PRESENCE <version> RENAME <old> <new>"
+// An alias used by several sessions, or on several nodes, is listed once; it
+// joins with the first and leaves with the last.
+class Roster {
+public:
+    Roster();
+    // Each returns the delta to publish, or "" when the listing is unchanged.
+    std::string join(const std::string& alias);
+    std::string leave(const std::string& alias);
+    std::string rename(const std::string& from, const std::string& to);
+    uint64_t version() const;
+    // "LIST a,b,c", the $getlist reply.
+    const std::string& listing();
+    // "ROSTER <version> a,b,c", what a subscriber starts from.
+    const std::string& snapshot();
+    void subscribe(Client* client);
+    void unsubscribe(Client* client);
+    bool subscribed(Client* client) const;
+    const std::vector<Client*>& subscribers() const;
+
+private:
+    void rebuild();
+    std::string delta(const std::string& change);
+    std::unordered_map<std::string, size_t> sessions;
+    uint64_t currentVersion;
+    uint64_t cachedVersion;
+    std::string cachedListing;
+    std::string cachedSnapshot;
+    std::vector<Client*> subscriberList;
+};
@@ -0,0 +1,388 @@
+#include "SearchIndex.h"
+#include "ChatLog.h"
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+
+namespace {
+    void appendVarint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    template <typename T>
+    void appendRaw(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    bool readRaw(const std::string& in, size_t& position, T& value) {
+        if (in.size() - position < sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, in.data() + position, sizeof(value));
+        position += sizeof(value);
+        return true;
+    }
+
+    // Drops the "[timestamp] " prefix and the "CHAT " tag around a logged line.
+    std::string messageText(const std::string& notification) {
+        size_t start = notification.find("): ");
+        return start == std::string::npos ? notification : notification.substr(start + 3);
+    }
+}
+
+SearchIndex::SearchIndex(const std::string& logPath)
+    : logPath(logPath), postingsPath(logPath + ".postings"), storedThrough(0), memoryBytes(0), existingRecords(0), indexedSequence(0), stopping(false) {
+}
+
+SearchIndex::~SearchIndex() {
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        stopping = true;
+    }
+    pendingReady.notify_one();
+    if (indexer.joinable()) {
+        indexer.join();
+    }
+}
+
+void SearchIndex::start(uint64_t records) {
+    existingRecords = records;
+    indexer = std::thread(&SearchIndex::indexerLoop, this);
+}
+
+void SearchIndex::add(uint64_t sequence, const std::string& notification) {
+    if (sequence == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending.push_back({ sequence, notification });
+    }
+    pendingReady.notify_one();
+}
+
+uint64_t SearchIndex::indexedThrough() const {
+    return indexedSequence.load();
+}
+
+uint64_t SearchIndex::bytesInMemory() const {
+    return memoryBytes.load(std::memory_order_relaxed);
+}
+
+std::vector<std::string> SearchIndex::tokenize(const std::string& text) {
+    std::vector<std::string> terms;
+    std::string term;
+    for (size_t i = 0; i <= text.size(); i++) {
+        unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+        if (std::isalnum(c) || c >= 0x80) {
+            term.push_back(static_cast<char>(std::tolower(c)));
+            continue;
+        }
+        if (term.size() >= search::MIN_TERM_LENGTH && term.size() <= search::MAX_TERM_LENGTH) {
+            terms.push_back(term);
+        }
+        term.clear();
+    }
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    return terms;
+}
+
+std::string SearchIndex::messageAuthor(const std::string& notification) {
+    size_t open = notification.find('(');
+    size_t close = notification.find("): ");
+    if (open == std::string::npos || close == std::string::npos || close < open) {
+        return std::string();
+    }
+    return notification.substr(open + 1, close - open - 1);
+}
+
+void SearchIndex::indexerLoop() {
+    indexExisting();
+    std::vector<PendingRecord> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(pendingMutex);
+            pendingReady.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (stopping) {
+                return;
+            }
+            batch.swap(pending);
+        }
+        indexBatch(batch);
+        batch.clear();
+    }
+}
+
+// Walks the sidecar index and the log side by side, so records split exactly
+// as ChatLog wrote them, without touching ChatLog's own streams. Segments
+// already in the postings store are not read again.
+void SearchIndex::indexExisting() {
+    std::ifstream indexReader(logPath + ".idx", std::ios::binary);
+    std::ifstream logReader(logPath, std::ios::binary);
+    uint64_t firstUnindexed = loadSealed(indexReader);
+    indexReader.clear();
+    indexReader.seekg(static_cast<std::streamoff>((firstUnindexed - 1) * sizeof(LogIndexRecord)));
+    std::vector<PendingRecord> batch;
+    LogIndexRecord record{};
+    std::string line;
+    for (uint64_t sequence = firstUnindexed; sequence <= existingRecords; sequence++) {
+        if (!indexReader.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+            break;
+        }
+        line.resize(record.length);
+        logReader.seekg(static_cast<std::streamoff>(record.offset));
+        logReader.read(&line[0], record.length);
+        batch.push_back({ sequence, line });
+        if (batch.size() == 4096) {
+            indexBatch(batch);
+            batch.clear();
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (stopping) {
+                return;
+            }
+        }
+    }
+    indexBatch(batch);
+}
+
+bool SearchIndex::readIndexRecord(std::ifstream& indexReader, uint64_t sequence, LogIndexRecord& record) {
+    indexReader.clear();
+    indexReader.seekg(static_cast<std::streamoff>((sequence - 1) * sizeof(record)));
+    return static_cast<bool>(indexReader.read(reinterpret_cast<char*>(&record), sizeof(record)));
+}
+
+// Loads stored segments in order while each still matches the log, then cuts
+// the store back to the ones loaded. Returns the first sequence to index.
+uint64_t SearchIndex::loadSealed(std::ifstream& indexReader) {
+    std::error_code error;
+    if (!std::filesystem::exists(postingsPath, error)) {
+        return 1;
+    }
+    uint64_t fileSize = std::filesystem::file_size(postingsPath, error);
+    std::ifstream store(postingsPath, std::ios::binary);
+    uint64_t storeSize = 0;
+    uint64_t nextSequence = 1;
+    uint32_t blockSize = 0;
+    std::string block;
+    while (storeSize + sizeof(blockSize) <= fileSize) {
+        if (!store.read(reinterpret_cast<char*>(&blockSize), sizeof(blockSize)) ||
+            storeSize + sizeof(blockSize) + blockSize > fileSize) {
+            break;
+        }
+        block.resize(blockSize);
+        store.read(&block[0], blockSize);
+        uint64_t lastSequence = nextSequence + search::SEGMENT_RECORDS - 1;
+        Segment segment{};
+        LogIndexRecord sealedBy{};
+        LogIndexRecord logged{};
+        int64_t size = 0;
+        if (lastSequence > existingRecords || !readIndexRecord(indexReader, lastSequence, logged) ||
+            !parseSegment(block, sealedBy, segment, size) || segment.firstSequence != nextSequence ||
+            memcmp(&sealedBy, &logged, sizeof(logged)) != 0) {
+            // The log was replaced or cut short under the store.
+            break;
+        }
+        {
+            std::unique_lock<std::shared_mutex> lock(indexMutex);
+            segments.push_back(std::move(segment));
+        }
+        memoryBytes.fetch_add(static_cast<uint64_t>(size), std::memory_order_relaxed);
+        indexedSequence.store(lastSequence);
+        storeSize += sizeof(blockSize) + blockSize;
+        storedThrough = lastSequence;
+        nextSequence = lastSequence + 1;
+    }
+    store.close();
+
+    if (fileSize != storeSize) {
+        std::filesystem::resize_file(postingsPath, storeSize, error);
+    }
+    return nextSequence;
+}
+
+// [log index entry of the last record][first sequence][term count], then per
+// term [length][term][last sequence][posting length][postings].
+bool SearchIndex::parseSegment(const std::string& block, LogIndexRecord& sealedBy, Segment& segment, int64_t& size) {
+    size_t position = 0;
+    uint32_t termCount = 0;
+    if (!readRaw(block, position, sealedBy) || !readRaw(block, position, segment.firstSequence) || !readRaw(block, position, termCount)) {
+        return false;
+    }
+    segment.postings.reserve(termCount);
+    for (uint32_t i = 0; i < termCount; i++) {
+        uint32_t termLength = 0;
+        uint32_t postingLength = 0;
+        PostingList list;
+        if (!readRaw(block, position, termLength) || block.size() - position < termLength) {
+            return false;
+        }
+        std::string term = block.substr(position, termLength);
+        position += termLength;
+        if (!readRaw(block, position, list.lastSequence) || !readRaw(block, position, postingLength) || block.size() - position < postingLength) {
+            return false;
+        }
+        list.bytes = block.substr(position, postingLength);
+        position += postingLength;
+        size += static_cast<int64_t>(term.size() + sizeof(PostingList) + list.bytes.size());
+        segment.postings.emplace(std::move(term), std::move(list));
+    }
+    return position == block.size();
+}
+
+// Runs on the indexer thread, the only one that changes segments, so the
+// sealed segment is read without the lock.
+void SearchIndex::storeSealed(const Segment& segment) {
+    std::ifstream indexReader(logPath + ".idx", std::ios::binary);
+    LogIndexRecord sealedBy{};
+    if (!readIndexRecord(indexReader, segment.firstSequence + search::SEGMENT_RECORDS - 1, sealedBy)) {
+        return;
+    }
+    std::string block;
+    appendRaw(block, sealedBy);
+    appendRaw(block, segment.firstSequence);
+    appendRaw(block, static_cast<uint32_t>(segment.postings.size()));
+    for (const auto& posting : segment.postings) {
+        appendRaw(block, static_cast<uint32_t>(posting.first.size()));
+        block += posting.first;
+        appendRaw(block, posting.second.lastSequence);
+        appendRaw(block, static_cast<uint32_t>(posting.second.bytes.size()));
+        block += posting.second.bytes;
+    }
+    uint32_t blockSize = static_cast<uint32_t>(block.size());
+    std::ofstream store(postingsPath, std::ios::binary | std::ios::app);
+    store.write(reinterpret_cast<const char*>(&blockSize), sizeof(blockSize));
+    store.write(block.data(), block.size());
+    if (store.good()) {
+        storedThrough = segment.firstSequence + search::SEGMENT_RECORDS - 1;
+    }
+}
+
+// Tokenizes outside the lock, then appends to the posting lists. Sequences
+// arrive in increasing order, so every list stays sorted.
+void SearchIndex::indexBatch(const std::vector<PendingRecord>& batch) {
+    if (batch.empty()) {
+        return;
+    }
+    std::vector<std::pair<uint64_t, std::vector<std::string>>> tokenized;
+    tokenized.reserve(batch.size());
+    for (const auto& record : batch) {
+        std::vector<std::string> terms = tokenize(messageText(record.notification));
+        std::string author = messageAuthor(record.notification);
+        if (!author.empty()) {
+            terms.push_back("@" + author);
+        }
+        tokenized.emplace_back(record.sequence, std::move(terms));
+    }
+
+    std::unique_lock<std::shared_mutex> lock(indexMutex);
+    int64_t grown = 0;
+    std::vector<const Segment*> sealed;
+    for (const auto& entry : tokenized) {
+        uint64_t sequence = entry.first;
+        if (segments.empty() || sequence >= segments.back().firstSequence + search::SEGMENT_RECORDS) {
+            if (!segments.empty()) {
+                for (auto& posting : segments.back().postings) {
+                    posting.second.bytes.shrink_to_fit();
+                }
+                if (segments.back().firstSequence > storedThrough) {
+                    sealed.push_back(&segments.back());
+                }
+            }
+            segments.push_back({ sequence - (sequence - 1) % search::SEGMENT_RECORDS, {} });
+        }
+        Segment& segment = segments.back();
+        for (const auto& term : entry.second) {
+            auto inserted = segment.postings.try_emplace(term);
+            PostingList& list = inserted.first->second;
+            if (inserted.second) {
+                grown += static_cast<int64_t>(term.size() + sizeof(PostingList));
+            }
+            size_t before = list.bytes.size();
+            appendVarint(list.bytes, sequence - (list.lastSequence == 0 ? segment.firstSequence : list.lastSequence));
+            list.lastSequence = sequence;
+            grown += static_cast<int64_t>(list.bytes.size() - before);
+        }
+    }
+    indexedSequence.store(tokenized.back().first);
+    memoryBytes.fetch_add(static_cast<uint64_t>(grown), std::memory_order_relaxed);
+    lock.unlock();
+    for (const Segment* segment : sealed) {
+        storeSealed(*segment);
+    }
+}
+
+std::vector<uint64_t> SearchIndex::decode(const PostingList& list, uint64_t fromSequence) {
+    std::vector<uint64_t> sequences;
+    uint64_t sequence = 0;
+    uint64_t value = 0;
+    int shift = 0;
+    bool first = true;
+    for (char byte : list.bytes) {
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte & 0x80) {
+            shift += 7;
+            continue;
+        }
+        sequence = first ? fromSequence + value : sequence + value;
+        first = false;
+        sequences.push_back(sequence);
+        value = 0;
+        shift = 0;
+    }
+    return sequences;
+}
+
+std::vector<uint64_t> SearchIndex::find(const SearchQuery& query, size_t limit) const {
+    std::vector<std::string> terms = query.terms;
+    if (!query.alias.empty()) {
+        terms.push_back("@" + query.alias);
+    }
+    std::vector<uint64_t> results;
+    if (terms.empty() || limit == 0) {
+        return results;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(indexMutex);
+    for (auto segment = segments.rbegin(); segment != segments.rend() && results.size() < limit; ++segment) {
+        if (segment->firstSequence + search::SEGMENT_RECORDS <= query.fromSequence) {
+            break;
+        }
+        // Intersect starting from the shortest list.
+        std::vector<const PostingList*> lists;
+        for (const auto& term : terms) {
+            auto found = segment->postings.find(term);
+            if (found == segment->postings.end()) {
+                lists.clear();
+                break;
+            }
+            lists.push_back(&found->second);
+        }
+        if (lists.empty()) {
+            continue;
+        }
+        std::sort(lists.begin(), lists.end(), [](const PostingList* a, const PostingList* b) { return a->bytes.size() < b->bytes.size(); });
+        std::vector<uint64_t> matches = decode(*lists[0], segment->firstSequence);
+        for (size_t i = 1; i < lists.size() && !matches.empty(); i++) {
+            std::vector<uint64_t> other = decode(*lists[i], segment->firstSequence);
+            std::vector<uint64_t> common;
+            std::set_intersection(matches.begin(), matches.end(), other.begin(), other.end(), std::back_inserter(common));
+            matches.swap(common);
+        }
+        for (auto match = matches.rbegin(); match != matches.rend() && results.size() < limit; ++match) {
+            if (*match < query.fromSequence) {
+                break;
+            }
+            results.push_back(*match);
+        }
+    }
+    return results;
+}
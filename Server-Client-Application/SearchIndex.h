@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include "ChatLog.h"
+
+namespace search {
+    // Sequences per index segment; segments are searched newest first.
+    constexpr uint64_t SEGMENT_RECORDS{ 1 << 16 };
+    constexpr size_t RESULT_LIMIT{ 20 };
+    constexpr size_t SNIPPET_LENGTH{ 80 };
+    constexpr size_t MIN_TERM_LENGTH{ 2 };
+    constexpr size_t MAX_TERM_LENGTH{ 32 };
+}
+
+struct SearchQuery {
+    std::vector<std::string> terms;
+    std::string alias;
+    uint64_t fromSequence = 1;
+};
+
+// Inverted index over the chat log, kept in memory. Each segment maps a term
+// to a posting list of sequence numbers stored as varint deltas; the author
+// is indexed as the term "@alias". A background thread indexes the existing
+// log on startup and then whatever recordLog appends, so the network thread
+// only queues the text. Posting bytes are counted here, not charged to the
+// memory budget: the index cannot be shed, and a long history alone would
+// otherwise hold the server at its ceiling from startup.
+//
+// Full segments are appended to "<log>.postings" as [uint32 length][segment]
+// records, each carrying the log index entry of its last record. Startup
+// loads the ones that still match the log and only indexes the rest.
+class SearchIndex {
+public:
+    explicit SearchIndex(const std::string& logPath);
+    ~SearchIndex();
+    void start(uint64_t existingRecords);
+    void add(uint64_t sequence, const std::string& notification);
+    // Matching sequences, newest first, at most `limit` of them.
+    std::vector<uint64_t> find(const SearchQuery& query, size_t limit) const;
+    uint64_t indexedThrough() const;
+    // Posting bytes held in memory, for $metrics.
+    uint64_t bytesInMemory() const;
+    static std::vector<std::string> tokenize(const std::string& text);
+    static std::string messageAuthor(const std::string& notification);
+
+private:
+    struct PostingList {
+        std::string bytes;
+        uint64_t lastSequence = 0;
+    };
+    struct Segment {
+        uint64_t firstSequence;
+        std::unordered_map<std::string, PostingList> postings;
+    };
+    struct PendingRecord {
+        uint64_t sequence;
+        std::string notification;
+    };
+
+    void indexerLoop();
+    void indexExisting();
+    uint64_t loadSealed(std::ifstream& indexReader);
+    void indexBatch(const std::vector<PendingRecord>& batch);
+    void storeSealed(const Segment& segment);
+    static bool parseSegment(const std::string& block, LogIndexRecord& sealedBy, Segment& segment, int64_t& size);
+    static bool readIndexRecord(std::ifstream& indexReader, uint64_t sequence, LogIndexRecord& record);
+    static std::vector<uint64_t> decode(const PostingList& list, uint64_t fromSequence);
+    std::string logPath;
+    std::string postingsPath;
+    // Last sequence covered by the postings store.
+    uint64_t storedThrough;
+    std::atomic<uint64_t> memoryBytes;
+    uint64_t existingRecords;
+    std::deque<Segment> segments;
+    mutable std::shared_mutex indexMutex;
+    std::vector<PendingRecord> pending;
+    std::mutex pendingMutex;
+    std::condition_variable pendingReady;
+    std::atomic<uint64_t> indexedSequence;
+    bool stopping;
+    std::thread indexer;
+};
@@ -8,26 +8,43 @@
 #include <ctime>
 #include <algorithm>
 #include <stdexcept>
+#include <cstdlib>
+#include <cctype>
+#include <sstream>
+#include <unordered_set>
+#include <afunix.h>
 
 // Defines
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #define _CRT_SECURE_NO_WARNINGS
 #pragma comment(lib, "Ws2_32.lib")
 #pragma warning(disable: 4996)
-Server::Server(int clientLimit, const char* listeningPort)
-    : clientLimit(clientLimit), listeningPort(listeningPort), logPath("Record_of_chat.txt") {
+Server::Server(int clientLimit, const char* listeningPort, io::Backend ioBackend, bool takeOver, Environment& environment)
+    : environment(environment), clientLimit(std::min(clientLimit, capacity::MAX_CLIENTS)), peerLinks(0), listeningPort(listeningPort), logPath(environment.storage.chatLog),
+    fanoutPool(environment.sockets, std::max(1u, std::thread::hardware_concurrency()) - 1), chatLog(logPath),
+    trafficStats(environment.clock), ioBackend(ioBackend), reactor(environment.clock, environment.sockets),
+    diagnostics(environment.storage.diagnostics), localSocket(INVALID_SOCKET), localPath(local::socketPath(listeningPort)),
+    searchIndex(logPath), fileStore(environment.storage.attachments), admissionControl(environment.clock), listenBacklog(admission::DEFAULT_BACKLOG), transmitsInFlight(false) {
     if (!initializeWinsock()) {
         exit(STARTUP_ERROR);
     }
-    if (!setupServer()) {
+    if (takeOver ? !adoptPredecessor() : !setupServer()) {
         cleanupClients();
         exit(SETUP_ERROR);
     }
+    // A predecessor is frozen by now, so the log files are no longer written.
+    chatLog.open();
+    searchIndex.start(chatLog.lastSequence());
+    fileStore.open();
 }
 
 Server::~Server() {
     cleanupClients();
-    closesocket(tcpSocket);
+    if (localSocket != INVALID_SOCKET) {
+        closesocket(localSocket);
+        DeleteFileA(localPath.c_str());
+    }
+    environment.sockets.close(tcpSocket);
     WSACleanup();
 }
 
@@ -42,95 +59,76 @@ bool Server::initializeWinsock() {
 }
 
 bool Server::setupServer() {
-    struct addrinfo* result_addr = NULL, ideas;
-    ZeroMemory(&ideas, sizeof(ideas));
-    ideas.ai_flags = AI_PASSIVE;
-    ideas.ai_family = AF_INET;
-    ideas.ai_socktype = SOCK_STREAM;
-    ideas.ai_protocol = IPPROTO_TCP;
-
-    int finalOutput = getaddrinfo(NULL, listeningPort, &ideas, &result_addr);
-    if (finalOutput != 0) {
-        displayError("Error getting address info", finalOutput);
-        WSACleanup();
-        return false;
-    }
-
-    tcpSocket = socket(result_addr->ai_family, result_addr->ai_socktype, result_addr->ai_protocol);
+    tcpSocket = environment.sockets.openListener(listeningPort, ioBackend == io::REGISTERED_IO);
     if (tcpSocket == INVALID_SOCKET) {
-        displayError("Error creating server socket", WSAGetLastError());
-        freeaddrinfo(result_addr);
-        WSACleanup();
         return false;
     }
-
-    finalOutput = bind(tcpSocket, result_addr->ai_addr, (int)result_addr->ai_addrlen);
-    if (finalOutput == SOCKET_ERROR) {
-        displayError("Error binding server socket", WSAGetLastError());
-        cleanupSocketAndAddrInfo(tcpSocket, result_addr);
-        return false;
+    // Registered I/O needs real sockets.
+    if (ioBackend == io::REGISTERED_IO && (!environment.hostServices || !rioSender.initialize(tcpSocket, clientLimit))) {
+        std::cout << "Falling back to select() for socket I/O" << std::endl;
+        ioBackend = io::SELECT;
     }
+    return true;
+}
 
-    if (!setupUDPServer()) {
-        cleanupSocketAndAddrInfo(tcpSocket, result_addr);
-        return false;
-    }
+void Server::displayError(const char* errorMsg, int errorCode) {
+    std::cerr << errorMsg << ": " << errorCode << std::endl;
+}
 
-    freeaddrinfo(result_addr);
-    finalOutput = listen(tcpSocket, SOMAXCONN);
-    if (finalOutput == SOCKET_ERROR) {
-        displayError("Error setting server socket to listen", WSAGetLastError());
-        closesocket(tcpSocket);
-        closesocket(udpSocket);
-        return false;
+void Server::cleanupClients() {
+    for (auto client : clientList) {
+        environment.sockets.close(client->retrieveEndpoint());
+        delete client;
     }
-    return true;
 }
 
-bool Server::setupUDPServer() {
-    udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (udpSocket == INVALID_SOCKET) {
-        displayError("Can't create UDP socket", WSAGetLastError());
-        return false;
-    }
 
-    int broadcast = 1;
-    int finalOutput = setsockopt(udpSocket, SOL_SOCKET, SO_BROADCAST, (char*)&broadcast, sizeof(broadcast));
-    if (finalOutput == SOCKET_ERROR) {
-        displayError("Can't enable UDP broadcast", WSAGetLastError());
-        closesocket(udpSocket);
-        return false;
-    }
-    return true;
+
+void Server::setMemoryCeiling(uint64_t bytes) {
+    memoryBudget.setCeiling(bytes);
 }
 
-void Server::displayError(const char* errorMsg, int errorCode) {
-    std::cerr << errorMsg << ": " << errorCode << std::endl;
+void Server::configureAdmission(int backlog, double sessionsPerSecond) {
+    listenBacklog = backlog;
+    admissionControl.configure(sessionsPerSecond);
 }
 
-void Server::cleanupSocketAndAddrInfo(SOCKET& socket, struct addrinfo* addrInfo) {
-    closesocket(socket);
-    freeaddrinfo(addrInfo);
-    WSACleanup();
+void Server::configureLatency(const LatencyTuning& tuning) {
+    latencyTuning = tuning;
 }
 
-void Server::cleanupClients() {
-    for (auto client : clientList) {
-        closesocket(client->retrieveEndpoint());
-        delete client;
+// Pins the calling thread, which runs the loop, and the diagnostics writer.
+// A core that cannot be had is reported and left to the scheduler.
+void Server::applyLatencyTuning() {
+    if (latencyTuning.reactorCore != lowlatency::ANY_CORE && !pinThread(GetCurrentThread(), latencyTuning.reactorCore)) {
+        diagnostics.write(diag::WARNING, "network thread not pinned", {}, {}, latencyTuning.reactorCore);
+    }
+    if (latencyTuning.logCore != lowlatency::ANY_CORE && !diagnostics.pinWriter(latencyTuning.logCore)) {
+        diagnostics.write(diag::WARNING, "diagnostics writer not pinned", {}, {}, latencyTuning.logCore);
+    }
+    if (latencyTuning.busyPoll && inheritedState == nullptr) {
+        environment.sockets.tuneForLatency(tcpSocket);
     }
 }
 
+void Server::configureDiagnostics(diag::Level minimumLevel, bool includeBodies) {
+    diagnostics.configure(minimumLevel, includeBodies);
+}
 
+void Server::addPeer(const std::string& address) {
+    federation.addPeerAddress(address);
+}
 
-void Server::promptForServerIP() {
-    std::cout << "Enter server IP address: ";
-    std::cin >> hostIP;
+void Server::setPeerSecret(const std::string& secret) {
+    federation.setSharedSecret(secret);
 }
 
 void Server::displayServerInitialization() {
     std::cout << "Starting server..." << std::endl;
     std::cout << "IP: " << hostIP << ", Port: " << listeningPort << std::endl;
+    if (!federation.configuredPeers().empty()) {
+        std::cout << "Node: " << federation.nodeId() << ", Peers: " << federation.configuredPeers().size() << std::endl;
+    }
 }
 
 void Server::setupServerSocketForListening() {
@@ -139,15 +137,48 @@ void Server::setupServerSocketForListening() {
     FD_ZERO(&activeSet);
     FD_SET(tcpSocket, &masterSet);
     waitDuration.tv_sec = 1;
+    waitDuration.tv_usec = 0;
+    if (localSocket != INVALID_SOCKET) {
+        // Inherited from a predecessor; its socket file is still in place.
+        environment.sockets.setNonBlocking(localSocket);
+        FD_SET(localSocket, &masterSet);
+        return;
+    }
+    if (environment.hostServices) {
+        setupLocalListener();
+    }
 }
 
-void Server::startUdpBroadcastThread() {
-    std::thread udpThread(&Server::sendUdpBroadcast, this);
-    udpThread.detach();
+// Same-host clients can connect through an AF_UNIX socket next to the TCP
+// listener. Optional: the server runs without it on older Windows builds.
+void Server::setupLocalListener() {
+    localSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (localSocket == INVALID_SOCKET) {
+        diagnostics.write(diag::WARNING, "local listener unavailable", {}, {}, WSAGetLastError());
+        return;
+    }
+    sockaddr_un localAddress{};
+    localAddress.sun_family = AF_UNIX;
+    memcpy(localAddress.sun_path, localPath.c_str(), std::min(localPath.size() + 1, sizeof(localAddress.sun_path)));
+    // A socket file left behind by a previous run would make bind fail.
+    DeleteFileA(localPath.c_str());
+    if (bind(localSocket, (sockaddr*)&localAddress, sizeof(localAddress)) == SOCKET_ERROR ||
+        listen(localSocket, listenBacklog > 0 ? SOMAXCONN_HINT(listenBacklog) : SOMAXCONN) == SOCKET_ERROR) {
+        diagnostics.write(diag::WARNING, "local listener unavailable", {}, localPath, WSAGetLastError());
+        closesocket(localSocket);
+        localSocket = INVALID_SOCKET;
+        return;
+    }
+    environment.sockets.setNonBlocking(localSocket);
+    FD_SET(localSocket, &masterSet);
+    diagnostics.write(diag::INFO, "listening locally", {}, localPath);
 }
 
 int Server::getHighestFileDescriptor() {
     int highestFileDescriptor = tcpSocket;
+    if (localSocket != INVALID_SOCKET && localSocket > highestFileDescriptor) {
+        highestFileDescriptor = localSocket;
+    }
     for (const auto& client : clientList) {
         if (client->retrieveEndpoint() > highestFileDescriptor) {
             highestFileDescriptor = client->retrieveEndpoint();
@@ -158,8 +189,8 @@ int Server::getHighestFileDescriptor() {
 
 void Server::handleSocketErrors(int finalOutput) {
     if (finalOutput == SOCKET_ERROR) {
-        std::cerr << "Error in select: " << WSAGetLastError() << std::endl;
-        closesocket(tcpSocket);
+        std::cerr << "Error in select: " << environment.sockets.lastError() << std::endl;
+        environment.sockets.close(tcpSocket);
         WSACleanup();
         exit(PARAMETER_ERROR);
     }
@@ -169,20 +200,21 @@ void Server::checkAndHandleClientConnections() {
     if (FD_ISSET(tcpSocket, &activeSet)) {
         addNewClient();
     }
-    for (int i = 0; i < clientList.size(); i++) {
-        SOCKET soc_Client = clientList[i]->retrieveEndpoint();
-        if (FD_ISSET(soc_Client, &activeSet)) {
-            processClientQuery(clientList[i]);
-        }
+    if (localSocket != INVALID_SOCKET && FD_ISSET(localSocket, &activeSet)) {
+        addLocalClient();
     }
+    reactor.dispatch(activeSet);
 }
 
 void Server::removeDisconnectedClients() {
     clientList.erase(
-        std::remove_if(clientList.begin(), clientList.end(), [](Client* client) {
+        std::remove_if(clientList.begin(), clientList.end(), [this](Client* client) {
             if (client->retrieveEndpoint() == INVALID_SOCKET) {
-                std::cout << "(" << client->getUserAlias() << ") HAS DISCONNECTED" << std::endl;
-                closesocket(client->retrieveEndpoint());
+                diagnostics.write(diag::INFO, "disconnected", client->getUserAlias());
+                if (client->isPeerLink()) {
+                    peerLinks--;
+                }
+                environment.sockets.close(client->retrieveEndpoint());
                 delete client;
                 return true;
             }
@@ -192,94 +224,491 @@ void Server::removeDisconnectedClients() {
 }
 
 void Server::execution() {
-    promptForServerIP();
+    start();
+    while (true) {
+        runOnce();
+    }
+}
+
+void Server::start() {
+    if (inheritedState == nullptr) {
+        hostIP = environment.discovery.hostAddress();
+    }
     displayServerInitialization();
+    applyLatencyTuning();
+    // An inherited listener is already taking connections.
+    if (inheritedState == nullptr && environment.sockets.listen(tcpSocket, listenBacklog) == SOCKET_ERROR) {
+        throw std::runtime_error("Error setting server socket to listen: " + std::to_string(environment.sockets.lastError()));
+    }
+    // The accept loop runs until the queue is empty, so it must not block.
+    environment.sockets.setNonBlocking(tcpSocket);
     setupServerSocketForListening();
-    startUdpBroadcastThread();
+    if (inheritedState != nullptr) {
+        resumeInheritedSessions();
+    }
+    environment.discovery.announce(hostIP, listeningPort);
+    if (!environment.hostServices) {
+        return;
+    }
+    connectToPeers();
+    if (!handoverPipe.listen(listeningPort)) {
+        diagnostics.write(diag::WARNING, "hot restart unavailable", {}, handover::pipeName(listeningPort), GetLastError());
+    }
+}
 
-    while (true) {
-        activeSet = masterSet;
-        int highestFileDescriptor = getHighestFileDescriptor();
-        int finalOutput = select(highestFileDescriptor + 1, &activeSet, NULL, NULL, &waitDuration);
+void Server::runOnce() {
+    int failedSends = rioSender.reapCompletions();
+    if (failedSends > 0) {
+        diagnostics.write(diag::WARNING, "broadcast delivery failed", {}, {}, failedSends);
+    }
+    activeSet = masterSet;
+    reactor.prepare(activeSet);
+    fd_set writeSet;
+    FD_ZERO(&writeSet);
+    bool ringsBacklogged = false;
+    for (const auto& client : clientList) {
+        if (client->outbox() == nullptr && client->downloads().empty()) {
+            continue;
+        }
+        if (client->sharedChannel() != nullptr) {
+            // The socket is only a doorbell and always writable; room in the
+            // ring is polled for instead.
+            ringsBacklogged = true;
+        }
+        else if (!writeInFlight(client)) {
+            FD_SET(client->retrieveEndpoint(), &writeSet);
+        }
+    }
+    timeval timeout = reactor.nextTimeout(waitDuration);
+    if (latencyTuning.busyPoll) {
+        // Spin: a ready socket is seen on the next pass, not after a wakeup.
+        timeout = timeval{ 0, 0 };
+    }
+    bool pollPending = transmitsInFlight || rioSender.sending() || ringsBacklogged;
+    if (pollPending && timeout.tv_sec * 1000000L + timeout.tv_usec > attachment::PENDING_POLL_MICROSECONDS) {
+        // A finished TransmitFile or RIO send, or a ring the client drained,
+        // cannot wake select(), so poll for it.
+        timeout = timeval{ 0, attachment::PENDING_POLL_MICROSECONDS };
+    }
+    int highestFileDescriptor = getHighestFileDescriptor();
+    int finalOutput = environment.sockets.select(highestFileDescriptor, &activeSet, &writeSet, &timeout);
+
+    handleSocketErrors(finalOutput);
+    flushWritable(writeSet);
+    transmitsInFlight = pumpDownloads(writeSet);
+    checkAndHandleClientConnections();
+    removeDisconnectedClients();
+    flushPeerBatches();
+    if (handoverPipe.successorWaiting()) {
+        handOver();
+    }
+}
 
-        handleSocketErrors(finalOutput);
-        checkAndHandleClientConnections();
-        removeDisconnectedClients();
+// Successor side of a hot restart: the listening sockets are taken over now,
+// the sessions once execution() has set up the loop.
+bool Server::adoptPredecessor() {
+    takeoverStarted = std::chrono::steady_clock::now();
+    predecessor.reset(new HandoverPipe());
+    try {
+        predecessor->connect(listeningPort);
+        inheritedState.reset(new ServerHandover(predecessor->receiveState()));
     }
+    catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return false;
+    }
+    DWORD socketFlags = WSA_FLAG_OVERLAPPED | (ioBackend == io::REGISTERED_IO ? WSA_FLAG_REGISTERED_IO : 0);
+    tcpSocket = WSASocket(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &inheritedState->listener, 0, socketFlags);
+    if (tcpSocket == INVALID_SOCKET) {
+        displayError("Error taking over the listening socket", WSAGetLastError());
+        return false;
+    }
+    if (inheritedState->hasLocalListener) {
+        localSocket = WSASocket(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &inheritedState->localListener, 0, WSA_FLAG_OVERLAPPED);
+    }
+    hostIP = inheritedState->hostIP;
+    federation.adoptIdentity(inheritedState->nodeId, inheritedState->messagesIssued);
+    if (ioBackend == io::REGISTERED_IO && !rioSender.initialize(tcpSocket, clientLimit)) {
+        std::cout << "Falling back to select() for socket I/O" << std::endl;
+        ioBackend = io::SELECT;
+    }
+    return true;
 }
 
-void Server::sendUdpBroadcast() {
-    sockaddr_in broadCastingAddressUDP{};
-    broadCastingAddressUDP.sin_family = AF_INET;
-    broadCastingAddressUDP.sin_addr.s_addr = INADDR_BROADCAST;
-    broadCastingAddressUDP.sin_port = htons(static_cast<unsigned short>(std::stoi(listeningPort)));
+// Rebuilds every handed-over session with its queued output and partial
+// input, then tells the predecessor it may exit.
+void Server::resumeInheritedSessions() {
+    std::vector<Client*> adopted;
+    for (auto& session : inheritedState->sessions) {
+        SOCKET sessionSocket = WSASocket(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &session.socketInfo, 0, WSA_FLAG_OVERLAPPED);
+        if (sessionSocket == INVALID_SOCKET) {
+            diagnostics.write(diag::WARNING, "session lost in handover", session.alias, {}, WSAGetLastError());
+            continue;
+        }
+        u_long nonBlocking = 1;
+        ioctlsocket(sessionSocket, FIONBIO, &nonBlocking);
+        Client* client = new Client(sessionSocket, environment.clock);
+        client->setUserAlias(session.alias);
+        client->setCompression(static_cast<compression::Codec>(session.codec));
+        if (session.local) {
+            client->markLocal();
+        }
+        if (!session.sharedChannelName.empty()) {
+            try {
+                client->attachSharedChannel(SharedChannel::adopt(session.sharedChannelName, sessionSocket));
+            }
+            catch (const std::exception& ex) {
+                diagnostics.write(diag::WARNING, "session lost in handover", session.alias, ex.what());
+                closesocket(sessionSocket);
+                delete client;
+                continue;
+            }
+        }
+        if (session.peerLink) {
+            client->markPeerLink();
+            peerLinks++;
+            client->setPeerNode(session.peerNode);
+            federation.attachLink(client, session.peerNode);
+        }
+        else if (!session.alias.empty()) {
+            roster.join(session.alias);
+        }
+        if (session.presence) {
+            roster.subscribe(client);
+        }
+        clientList.push_back(client);
+        updateMaxFD(sessionSocket);
+        client->inputBuffer() = session.pendingInput;
+        accountInput(client);
+        if (!session.pendingOutput.empty()) {
+            queueFrame(client, session.pendingOutput, 0, false);
+        }
+        for (const auto& inherited : session.downloads) {
+            std::unique_ptr<Download> download = fileStore.openDownload(inherited.digest);
+            if (download != nullptr) {
+                download->resumeAt(inherited.offset);
+                client->downloads().push_back(std::move(download));
+            }
+        }
+        adopted.push_back(client);
+    }
+
+    try {
+        predecessor->confirm();
+    }
+    catch (const std::exception& ex) {
+        diagnostics.write(diag::WARNING, "predecessor did not take the confirmation", {}, ex.what());
+    }
+    predecessor.reset();
+    inheritedState.reset();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - takeoverStarted);
+    std::cout << "Took over " << adopted.size() << " sessions in " << elapsed.count() / 1000.0 << " ms" << std::endl;
+    diagnostics.write(diag::INFO, "took over sessions", {}, std::to_string(adopted.size()), elapsed.count());
+
+    for (auto& client : adopted) {
+        // Peers answer with a fresh snapshot of their users.
+        if (client->isPeerLink()) {
+            transmitToClient("$peer " + federation.nodeId(), client);
+        }
+        // Versions restart with the process; a fresh snapshot resets the
+        // subscriber's.
+        if (roster.subscribed(client)) {
+            transmitToClient(roster.snapshot(), client);
+        }
+        runSession(client);
+    }
+}
 
-    while (true) {
-        std::string CliBroadcastMsg = hostIP + ":" + std::string(listeningPort);
-        int finalOutput = sendto(udpSocket, CliBroadcastMsg.c_str(), CliBroadcastMsg.size(), 0, (sockaddr*)&broadCastingAddressUDP, sizeof(broadCastingAddressUDP));
-        if (finalOutput == SOCKET_ERROR) {
-            std::cerr << "Error sending UDP broadcast: " << WSAGetLastError() << std::endl;
-            break;
+// Predecessor side. Sessions are frozen from here on; once the successor
+// confirms it owns the sockets, this process exits without closing any of them.
+void Server::handOver() {
+    auto started = std::chrono::steady_clock::now();
+    ServerHandover state{};
+    DWORD successor = 0;
+    try {
+        successor = handoverPipe.receiveSuccessorId();
+        std::unordered_set<Client*> abandoned = settleTransmits();
+        if (!collectHandover(successor, state, abandoned)) {
+            throw std::runtime_error("the listening socket could not be duplicated: " + std::to_string(WSAGetLastError()));
         }
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        handoverPipe.sendState(state);
     }
+    catch (const std::exception& ex) {
+        diagnostics.write(diag::SEVERE, "hot restart failed", {}, ex.what());
+        handoverPipe.rearm();
+        return;
+    }
+    if (!handoverPipe.awaitConfirmation()) {
+        diagnostics.write(diag::SEVERE, "hot restart failed", {}, "successor did not confirm", successor);
+        handoverPipe.rearm();
+        return;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    std::cout << "Handed over " << state.sessions.size() << " sessions to process " << successor << " in "
+        << elapsed.count() / 1000.0 << " ms" << std::endl;
+    exit(SUCCESS);
 }
 
+// A transmit cut short would leave half a frame on the wire, so the ones in
+// flight get SETTLE_TIMEOUT_MS to finish. Sessions still writing after that
+// have their transmits cancelled and are shut down rather than handed over.
+std::unordered_set<Client*> Server::settleTransmits() {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(handover::SETTLE_TIMEOUT_MS);
+    while (rioSender.sending() && std::chrono::steady_clock::now() < deadline) {
+        rioSender.reapCompletions();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::unordered_set<Client*> abandoned;
+    for (auto& client : clientList) {
+        while (client->transmitting() && std::chrono::steady_clock::now() < deadline) {
+            if (!client->downloads().front()->pollChunk(client->retrieveEndpoint())) {
+                client->downloads().clear();
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (writeInFlight(client)) {
+            diagnostics.write(diag::WARNING, "transmit abandoned for hot restart", client->getUserAlias());
+            client->downloads().clear();
+            environment.sockets.shutdown(client->retrieveEndpoint(), SD_BOTH);
+            abandoned.insert(client);
+        }
+    }
+    return abandoned;
+}
 
+bool Server::collectHandover(DWORD successor, ServerHandover& state, const std::unordered_set<Client*>& abandoned) {
+    if (WSADuplicateSocket(tcpSocket, successor, &state.listener) != 0) {
+        return false;
+    }
+    state.hasLocalListener = localSocket != INVALID_SOCKET && WSADuplicateSocket(localSocket, successor, &state.localListener) == 0;
+    state.hostIP = hostIP;
+    state.nodeId = federation.nodeId();
+    state.messagesIssued = federation.messagesIssued();
+    for (auto& client : clientList) {
+        if (abandoned.count(client) != 0) {
+            continue;
+        }
+        // Spooled uploads stay with this process; the sender starts over.
+        if (client->upload() != nullptr) {
+            client->upload().reset();
+            try {
+                transmitToClient("SEND_REFUSED The server is restarting, send the file again", client);
+            }
+            catch (const std::exception&) {
+            }
+        }
+        SessionHandover session{};
+        if (WSADuplicateSocket(client->retrieveEndpoint(), successor, &session.socketInfo) != 0) {
+            diagnostics.write(diag::WARNING, "session not handed over", client->getUserAlias(), {}, WSAGetLastError());
+            continue;
+        }
+        session.alias = client->getUserAlias();
+        session.codec = static_cast<uint8_t>(client->getCompression());
+        session.peerLink = client->isPeerLink();
+        session.local = client->isLocal();
+        session.presence = roster.subscribed(client);
+        session.peerNode = client->getPeerNode();
+        session.pendingInput = client->inputBuffer();
+        if (client->outbox() != nullptr) {
+            const Outbox& outbox = *client->outbox();
+            for (size_t i = 0; i < outbox.frames.size(); i++) {
+                session.pendingOutput.append(outbox.frames[i].bytes, i == 0 ? outbox.headOffset : 0, std::string::npos);
+            }
+        }
+        if (client->sharedChannel() != nullptr) {
+            session.sharedChannelName = client->sharedChannel()->name();
+        }
+        for (const auto& download : client->downloads()) {
+            session.downloads.push_back({ download->digest(), download->bytesSent() });
+        }
+        state.sessions.push_back(std::move(session));
+    }
+    return true;
+}
+
+void Server::connectToPeers() {
+    for (const auto& peer : federation.configuredPeers()) {
+        SOCKET peerSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (peerSocket == INVALID_SOCKET) {
+            displayError("Error creating peer socket", WSAGetLastError());
+            continue;
+        }
+
+        sockaddr_in addressOfPeer{};
+        addressOfPeer.sin_family = AF_INET;
+        addressOfPeer.sin_addr.s_addr = inet_addr(peer.host.c_str());
+        addressOfPeer.sin_port = htons(static_cast<unsigned short>(std::stoi(peer.port)));
+        if (connect(peerSocket, (sockaddr*)&addressOfPeer, sizeof(addressOfPeer)) == SOCKET_ERROR) {
+            // Not up yet; the link is made when that node starts and dials us.
+            diagnostics.write(diag::WARNING, "peer not reachable yet", {}, peer.host + ":" + peer.port);
+            closesocket(peerSocket);
+            continue;
+        }
+
+        // Every accepted connection is greeted with a raw "SERVER_SUCCESS\0".
+        char greeting[sizeof("SERVER_SUCCESS")];
+        int bytesRead = 0;
+        while (bytesRead < (int)sizeof(greeting)) {
+            int finalOutput = recv(peerSocket, greeting + bytesRead, sizeof(greeting) - bytesRead, 0);
+            if (finalOutput == SOCKET_ERROR || finalOutput == 0) {
+                break;
+            }
+            bytesRead += finalOutput;
+        }
+        if (bytesRead != (int)sizeof(greeting) || std::string(greeting) != "SERVER_SUCCESS") {
+            diagnostics.write(diag::WARNING, "peer refused the link", {}, peer.host + ":" + peer.port);
+            closesocket(peerSocket);
+            continue;
+        }
+
+        u_long nonBlocking = 1;
+        ioctlsocket(peerSocket, FIONBIO, &nonBlocking);
+        Client* link = new Client(peerSocket, environment.clock);
+        link->markPeerLink();
+        peerLinks++;
+        clientList.push_back(link);
+        updateMaxFD(peerSocket);
+        std::string introduction = "$peer " + federation.nodeId();
+        if (!federation.sharedSecret().empty()) {
+            introduction += " " + federation.sharedSecret();
+        }
+        transmitToClient(introduction, link);
+        diagnostics.write(diag::INFO, "linked to peer", {}, peer.host + ":" + peer.port);
+        runSession(link);
+    }
+}
+
+void Server::flushPeerBatches() {
+    for (auto& batch : federation.takeBatches()) {
+        try {
+            transmitToClient(batch.second, batch.first);
+        }
+        catch (const std::exception& ex) {
+            diagnostics.write(diag::WARNING, "relay failed", batch.first->getPeerNode(), ex.what());
+        }
+    }
+}
+
+// Drains the listen queue, up to ACCEPTS_PER_TICK connections per iteration.
+// Whatever is left keeps the listener readable, so a reconnect storm is taken
+// in batches between rounds of session work instead of starving it.
 void Server::addNewClient() {
-    struct sockaddr_in AddressOfClient {};
-    int clientAddrLen = sizeof(AddressOfClient);
+    for (int accepted = 0; accepted < admission::ACCEPTS_PER_TICK; accepted++) {
+        struct sockaddr_in AddressOfClient {};
+        int clientAddrLen = sizeof(AddressOfClient);
 
-    SOCKET soc_Client = createClientSocket(AddressOfClient, clientAddrLen);
+        SOCKET soc_Client = createClientSocket(AddressOfClient, clientAddrLen);
 
-    if (soc_Client == INVALID_SOCKET) {
-        return;
+        if (soc_Client == INVALID_SOCKET) {
+            return;
+        }
+
+        if (!admitConnection(soc_Client)) {
+            continue;
+        }
+
+        std::string remoteHost = inet_ntoa(AddressOfClient.sin_addr);
+        addClientToServer(soc_Client, remoteHost + ":" + std::to_string(ntohs(AddressOfClient.sin_port)), remoteHost);
     }
+    metrics.acceptBatchesCapped++;
+}
 
-    if (isServerFull()) {
-        rejectClientDueToCapacity(soc_Client);
-        return;
+void Server::addLocalClient() {
+    for (int accepted = 0; accepted < admission::ACCEPTS_PER_TICK; accepted++) {
+        SOCKET soc_Client = environment.sockets.accept(localSocket, NULL, NULL);
+        if (soc_Client == INVALID_SOCKET) {
+            if (environment.sockets.lastError() != WSAEWOULDBLOCK) {
+                diagnostics.write(diag::WARNING, "local accept failed", {}, {}, environment.sockets.lastError());
+            }
+            return;
+        }
+        if (!admitConnection(soc_Client)) {
+            continue;
+        }
+        addClientToServer(soc_Client, localPath)->markLocal();
     }
+    metrics.acceptBatchesCapped++;
+}
 
-    addClientToServer(soc_Client, AddressOfClient);
+// Turns away what the server cannot take: a full server or one at its memory
+// ceiling refuses, one over the admission rate says when to come back.
+bool Server::admitConnection(SOCKET clientSock) {
+    if (isServerFull()) {
+        rejectClientDueToCapacity(clientSock);
+        return false;
+    }
+    if (memoryBudget.pressure() >= memory::REJECT_CONNECTIONS) {
+        metrics.connectionsShed++;
+        diagnostics.write(diag::WARNING, "connection refused at memory ceiling", {}, {}, static_cast<int64_t>(memoryBudget.used()));
+        rejectClientDueToCapacity(clientSock);
+        return false;
+    }
+    std::chrono::milliseconds retryAfter;
+    if (!admissionControl.admit(retryAfter)) {
+        metrics.connectionsDeferred++;
+        diagnostics.write(diag::VERBOSE, "connection deferred", {}, {}, static_cast<int64_t>(retryAfter.count()));
+        deferClient(clientSock, retryAfter);
+        return false;
+    }
+    return true;
 }
 
 SOCKET Server::createClientSocket(sockaddr_in& clientAddress, int& clientAddressLength) {
-    SOCKET soc_Client = accept(tcpSocket, (sockaddr*)&clientAddress, &clientAddressLength);
+    SOCKET soc_Client = environment.sockets.accept(tcpSocket, (sockaddr*)&clientAddress, &clientAddressLength);
 
-    if (soc_Client == INVALID_SOCKET) {
-        std::cerr << "Error accepting client socket: " << WSAGetLastError() << std::endl;
+    // WSAEWOULDBLOCK just means the queue is empty.
+    if (soc_Client == INVALID_SOCKET && environment.sockets.lastError() != WSAEWOULDBLOCK) {
+        diagnostics.write(diag::WARNING, "accept failed", {}, {}, environment.sockets.lastError());
     }
 
     return soc_Client;
 }
 
+// Peer links are server-to-server plumbing and do not take a client's place.
+size_t Server::sessionCount() const {
+    return clientList.size() - peerLinks;
+}
+
 bool Server::isServerFull() const {
-    return clientList.size() >= clientLimit;
+    return sessionCount() >= static_cast<size_t>(clientLimit);
 }
 
-void Server::rejectClientDueToCapacity(SOCKET& clientSock) {
+SessionTask Server::rejectClientDueToCapacity(SOCKET clientSock) {
     std::string notification = "SERVER_LIMIT_REACHED";
-    Client* disconnectingClient = new Client();
-    disconnectingClient->assignEndpoint(clientSock);
-    transmitToClient(notification, disconnectingClient);
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-    closesocket(clientSock);
-    delete disconnectingClient;
+    std::string frame = FanoutPool::encodeFrame(notification);
+    environment.sockets.send(clientSock, frame.data(), (int)frame.size());
+    co_await sleepFor(reactor, std::chrono::seconds(1));
+    environment.sockets.close(clientSock);
 }
 
-void Server::addClientToServer(SOCKET& clientSock, sockaddr_in& clientAddress) {
-    Client* newClient = new Client();
-    newClient->assignEndpoint(clientSock);
-    clientList.push_back(newClient);
+// "SERVER_BUSY <ms>": come back after that many milliseconds.
+SessionTask Server::deferClient(SOCKET clientSock, std::chrono::milliseconds retryAfter) {
+    std::string frame = FanoutPool::encodeFrame("SERVER_BUSY " + std::to_string(retryAfter.count()));
+    environment.sockets.send(clientSock, frame.data(), (int)frame.size());
+    co_await sleepFor(reactor, admission::DEFER_LINGER);
+    environment.sockets.close(clientSock);
+}
 
-    FD_SET(clientSock, &masterSet);
+Client* Server::addClientToServer(SOCKET& clientSock, const std::string& origin, const std::string& remoteHost) {
+    // Sessions never block on a slow reader; what a socket cannot take is queued.
+    environment.sockets.setNonBlocking(clientSock);
+    Client* newClient = new Client(clientSock, environment.clock);
+    newClient->setRemoteHost(remoteHost);
+    if (latencyTuning.busyPoll) {
+        environment.sockets.tuneForLatency(clientSock);
+        prefault(newClient->inputBuffer(), lowlatency::PREFAULTED_INPUT);
+        accountInput(newClient);
+    }
+    clientList.push_back(newClient);
     updateMaxFD(clientSock);
 
     std::string notification = "SERVER_SUCCESS";
-    send(clientSock, notification.c_str(), notification.size() + 1, 0);
+    sendFrameToClient(std::string(notification.c_str(), notification.size() + 1), newClient);
 
-    std::cout << "New client isActive from " << inet_ntoa(clientAddress.sin_addr) << ":" << ntohs(clientAddress.sin_port) << std::endl;
+    diagnostics.write(diag::INFO, "connected", {}, origin);
+    runSession(newClient);
+    return newClient;
 }
 
 void Server::updateMaxFD(SOCKET& clientSock) {
@@ -289,60 +718,130 @@ void Server::updateMaxFD(SOCKET& clientSock) {
 }
 
 
-bool Server::processClientQuery(Client* client) {
-    // Receive the size of the incoming notification first.
-    int SizeOfMsg = 0;
-    int nbytes = recv(client->retrieveEndpoint(), reinterpret_cast<char*>(&SizeOfMsg), sizeof(SizeOfMsg), 0);
-    if (nbytes <= 0) {
-        // client disconnected
-        closesocket(client->retrieveEndpoint());
-        FD_CLR(client->retrieveEndpoint(), &masterSet);
-        for (auto it = clientList.begin(); it != clientList.end(); ++it) {
-            if ((*it)->retrieveEndpoint() == client->retrieveEndpoint()) {
-                delete (*it);
-                clientList.erase(it);
-                break;
+// One coroutine per connection: reads frames, applies the session's limits and
+// dispatches them. It only suspends, so a slow or stalled client never holds
+// up the select() loop.
+SessionTask Server::runSession(Client* client) {
+    int framesThisTick = 0;
+    while (true) {
+        releaseIdleInput(client);
+        FrameResult frame = co_await FrameAwaiter(reactor, client);
+        accountInput(client);
+        if (frame.status != FrameStatus::RECEIVED) {
+            dropClient(client);
+            co_return;
+        }
+        if (frame.waited) {
+            framesThisTick = 0;
+        }
+
+        const std::string& notification = frame.notification;
+        logReceived(client, notification);
+        metrics.framesProcessed++;
+
+        bool keepSession = true;
+        bool isExit = false;
+        try {
+            if (client->isPeerLink() || admitRequest(client, notification)) {
+                isExit = notification.find("$exit") == 0;
+                keepSession = processClientQuery(client, notification);
             }
         }
-        return false;
-    }
+        catch (const std::exception& ex) {
+            diagnostics.write(diag::WARNING, "session error", client->getUserAlias(), ex.what());
+            dropClient(client);
+            co_return;
+        }
 
-    // Allocate a holder of the appropriate size to receive the notification.
-    char* holder = new char[SizeOfMsg];
-    int bytesRead = 0;
-    while (bytesRead < SizeOfMsg) {
-        int finalOutput = recv(client->retrieveEndpoint(), holder + bytesRead, SizeOfMsg - bytesRead, 0);
-        if (finalOutput == SOCKET_ERROR || finalOutput == 0) {
-            // Error occurred or client disconnected
-            delete[] holder;
-            closesocket(client->retrieveEndpoint());
-            FD_CLR(client->retrieveEndpoint(), &masterSet);
-            for (auto it = clientList.begin(); it != clientList.end(); ++it) {
-                if ((*it)->retrieveEndpoint() == client->retrieveEndpoint()) {
-                    delete (*it);
-                    clientList.erase(it);
-                    break;
-                }
+        if (isExit || !keepSession) {
+            // The last reply can still be queued behind a full socket, and
+            // closing now would discard it.
+            auto deadline = reactor.now() + reactor::EXIT_LINGER;
+            while (client->outbox() != nullptr && reactor.now() < deadline) {
+                co_await sleepFor(reactor, reactor::CLOSE_FLUSH_POLL);
             }
-            return false;
         }
-        bytesRead += finalOutput;
+        if (isExit) {
+            // Let the client close its side first, but not forever.
+            auto deadline = reactor.now() + reactor::EXIT_LINGER;
+            while ((co_await FrameAwaiter(reactor, client, deadline)).status == FrameStatus::RECEIVED) {
+            }
+            dropClient(client);
+            co_return;
+        }
+        if (!keepSession) {
+            co_await sleepFor(reactor, std::chrono::seconds(1));
+            dropClient(client);
+            co_return;
+        }
+
+        // Over its upload budget, the session reads nothing more until the
+        // bucket refills; the sender's window fills and it waits.
+        TokenBucket& uploadBytes = client->limits().uploadBytes;
+        if (!uploadBytes.hasTokens()) {
+            co_await sleepFor(reactor, std::chrono::duration_cast<Reactor::Clock::duration>(
+                std::chrono::duration<double>(uploadBytes.secondsUntil(1))));
+            framesThisTick = 0;
+            continue;
+        }
+
+        // Serve queued frames back to back, but no more than FRAMES_PER_TICK
+        // before letting the other sessions run.
+        if (++framesThisTick >= ratelimit::FRAMES_PER_TICK) {
+            metrics.sessionsYielded++;
+            framesThisTick = 0;
+            co_await nextTick(reactor);
+        }
+    }
+}
+
+// Bodies stay out of the console unless asked for; by default only the
+// command word and the frame size are recorded.
+void Server::logReceived(Client* client, const std::string& notification) {
+    if (!diagnostics.enabled(diag::INFO)) {
+        return;
     }
+    std::string_view detail = notification;
+    if (!diagnostics.includesBodies()) {
+        detail = notification[0] == '$' ? detail.substr(0, detail.find(' ')) : "message";
+    }
+    else if (notification.find("$peer ") == 0) {
+        // Never the shared secret.
+        detail = detail.substr(0, detail.find(' ', 6));
+    }
+    diagnostics.write(diag::INFO, "received", client->getUserAlias(), detail, static_cast<int64_t>(notification.size()));
+}
 
-    // Convert the received notification to a string.
-    std::string notification(holder, SizeOfMsg);
-    std::cout << "[Received] (" << client->getUserAlias() << "): " << notification << std::endl;
-    delete[] holder;
+void Server::dropClient(Client* client) {
+    if (client->isPeerLink()) {
+        peerLinks--;
+    }
+    announceDeparture(client);
+    // Transmits in flight are cancelled while their socket is still open.
+    client->downloads().clear();
+    if (client->outbox() != nullptr) {
+        memoryBudget.charge(-static_cast<int64_t>(client->outbox()->bytes));
+    }
+    memoryBudget.charge(-static_cast<int64_t>(client->chargedInput()));
+    environment.sockets.close(client->retrieveEndpoint());
+    clientList.erase(std::remove(clientList.begin(), clientList.end(), client), clientList.end());
+    delete client;
+}
 
+// Dispatches one request. Returns false when the session has to end.
+bool Server::processClientQuery(Client* client, const std::string& notification) {
     // Handle client request commands
     if (notification.find("$register") == 0) {
-        handleRegisterRequest(client, notification);
+        return handleRegisterRequest(client, notification);
     }
     else if (notification.find("$getlist") == 0) {
         handleGetListRequest(client);
     }
+    else if (notification.find("$presence") == 0) {
+        handlePresenceRequest(client, notification);
+    }
     else if (notification.find("$getlog") == 0) {
-        handleGetLogRequest(client);
+        handleGetLogRequest(client, notification);
     }
     else if (notification.find("$exit") == 0) {
         handleExitRequest(client);
@@ -350,94 +849,567 @@ bool Server::processClientQuery(Client* client) {
     else if (notification.find("$chat") == 0) {
         handleChatRequest(client, notification);
     }
+    else if (notification.find("$peer") == 0) {
+        return handlePeerRequest(client, notification);
+    }
+    else if (notification.find("$relay") == 0) {
+        handleRelayRequest(client, notification);
+    }
+    else if (notification.find("$metrics") == 0) {
+        handleMetricsRequest(client);
+    }
+    else if (notification.find("$ping") == 0) {
+        // "$ping <sequence>" is echoed at once for round-trip timing.
+        transmitToClient("PONG" + notification.substr(5), client);
+    }
+    else if (notification.find("$stats") == 0) {
+        handleStatsRequest(client);
+    }
+    else if (notification.find("$search") == 0) {
+        handleSearchRequest(client, notification);
+    }
+    else if (notification.find("$resume") == 0) {
+        handleResumeRequest(client, notification);
+    }
+    else if (notification.find("$shm") == 0) {
+        handleSharedMemoryRequest(client);
+    }
+    else if (notification.find("$upload") == 0) {
+        handleUploadRequest(client, notification);
+    }
+    else if (notification.find("$chunk") == 0) {
+        handleChunk(client, notification);
+    }
+    else if (notification.find("$fetch") == 0) {
+        handleFetchRequest(client, notification);
+    }
     else {
         handleDefaultChatRequest(client, notification);
     }
     return true;
 }
 
-void Server::handleRegisterRequest(Client* client, const std::string& notification) {
+bool Server::handleRegisterRequest(Client* client, const std::string& notification) {
     std::string userAlias = notification.substr(10, notification.size() - 10);
-    if (clientList.size() > clientLimit) {
+    // "$register <alias> <codec>" asks for compressed large frames.
+    size_t optionPos = userAlias.find(' ');
+    if (optionPos != std::string::npos) {
+        client->setCompression(compression::codecFromName(userAlias.substr(optionPos + 1)));
+        userAlias.erase(optionPos);
+    }
+    if (sessionCount() > static_cast<size_t>(clientLimit)) {
         std::string notification = "SERVER_LIMIT_REACHED";
         transmitToClient(notification, client);
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        closesocket(client->retrieveEndpoint());
-        delete client;
+        return false;
+    }
+    else if (userAlias == client->getUserAlias()) {
+        // Nothing changes: no presence delta, nothing for the peers.
+        sendFrameToClient("SERVER_SUCCESS", client);
     }
     else {
-        // register user
+        // register user. Peers keep a set of aliases per node, so they only
+        // hear of the first session taking an alias and the last giving it up.
+        std::string previousAlias = client->getUserAlias();
+        if (!previousAlias.empty() && !aliasHeldElsewhere(previousAlias, client)) {
+            federation.queuePresence("LEAVE", federation.nextMessageId(), previousAlias);
+        }
         client->setUserAlias(userAlias);
+        publishPresence(previousAlias.empty() ? roster.join(userAlias) : roster.rename(previousAlias, userAlias));
+        if (!aliasHeldElsewhere(userAlias, client)) {
+            federation.queuePresence("JOIN", federation.nextMessageId(), userAlias);
+        }
         std::string recieveMessage_S = "SERVER_SUCCESS";
-        send(client->retrieveEndpoint(), recieveMessage_S.c_str(), recieveMessage_S.size(), 0);
+        sendFrameToClient(recieveMessage_S, client);
     }
+    return true;
 }
 
+// Built by the roster only when membership changed since the last request.
 void Server::handleGetListRequest(Client* client) {
-    std::string listOfClients;
-    listOfClients += "LIST ";
-    for (auto& c : clientList) {
-        listOfClients += c->getUserAlias() + ",";
+    const std::string& listOfClients = roster.listing();
+    transmitToClient(listOfClients, client);
+    client->limits().commandBytes.charge(static_cast<double>(listOfClients.size()));
+}
+
+// "$presence" subscribes to join/leave/rename deltas and starts the client off
+// with the current snapshot; "$presence off" ends the subscription.
+void Server::handlePresenceRequest(Client* client, const std::string& notification) {
+    if (notification.size() > 10 && notification.substr(10) == "off") {
+        roster.unsubscribe(client);
+        return;
     }
-    if (clientList.size() > 1) {
-        listOfClients.erase(listOfClients.size() - 1); // remove last comma
+    roster.subscribe(client);
+    const std::string& snapshot = roster.snapshot();
+    transmitToClient(snapshot, client);
+    client->limits().commandBytes.charge(static_cast<double>(snapshot.size()));
+}
+
+// A delta is far below the compression threshold, so one plain frame serves
+// every subscriber. Deltas are never shed: a gap would leave the client's
+// roster wrong until it resubscribes.
+void Server::publishPresence(const std::string& delta) {
+    if (delta.empty() || roster.subscribers().empty()) {
+        return;
     }
-    else {
-        listOfClients = "LIST You are all alone in this server\n";
+    std::string frame = FanoutPool::encodeFrame(delta);
+    for (Client* subscriber : roster.subscribers()) {
+        try {
+            sendFrameToClient(frame, subscriber);
+        }
+        catch (const std::exception&) {
+            // The subscriber's own session notices the dead socket.
+        }
     }
-    transmitToClient(listOfClients, client);
 }
 
-void Server::handleGetLogRequest(Client* client) {
-    std::ifstream logDescriptor(logPath, std::ios::binary);
-    if (!logDescriptor.good()) {
-        std::cerr << "Error opening log file." << std::endl;
+void Server::handleGetLogRequest(Client* client, const std::string& notification) {
+    // "$getlog <minutes>" limits the reply to recent history using the index.
+    uint64_t firstSequence = 1;
+    int minutes = notification.size() > 8 ? std::atoi(notification.c_str() + 8) : 0;
+    if (minutes > 0) {
+        firstSequence = chatLog.sequenceSince(std::time(nullptr) - static_cast<std::time_t>(minutes) * 60);
+    }
+    sendHistory(client, firstSequence);
+}
+
+// Replies "LOG <first sequence> <last sequence>\n<records...>" so the client
+// can tell which records it already has without splitting the text itself.
+void Server::sendHistory(Client* client, uint64_t firstSequence) {
+    uint64_t fromOffset = chatLog.offsetOf(firstSequence);
+    // Second shedding stage: the reply is built in memory, so it is refused
+    // under pressure or when it would not fit under the ceiling.
+    if (memoryBudget.pressure() >= memory::REFUSE_HISTORY || !memoryBudget.fits(chatLog.sizeInBytes() - fromOffset)) {
+        metrics.historyRefused++;
+        transmitToClient("THROTTLED History is unavailable while the server is low on memory, try again later", client);
         return;
     }
-    logDescriptor.seekg(0, std::ios::end);
-    int LogSize = logDescriptor.tellg();
-    logDescriptor.seekg(0, std::ios::beg);
+    std::string header = "LOG " + std::to_string(firstSequence) + " " + std::to_string(chatLog.lastSequence()) + "\n";
+
+    // Full history for a compressing client: reuse the stored segments and only
+    // compress what was logged since the last sealed one.
+    compression::Codec codec = client->getCompression();
+    std::string prefixBlock;
+    if (codec != compression::NONE && fromOffset == 0 && compression::compressBlock(codec, header.data(), header.size(), prefixBlock)) {
+        std::string payload;
+        compression::appendBlock(payload, prefixBlock);
+        uint64_t sealedEnd = segmentsFor(codec).appendSealed(chatLog, payload);
+        std::string tail = chatLog.read(sealedEnd, chatLog.sizeInBytes());
+        std::string tailBlock;
+        if (tail.empty() || compression::compressBlock(codec, tail.data(), tail.size(), tailBlock)) {
+            if (!tail.empty()) {
+                compression::appendBlock(payload, tailBlock);
+            }
+            sendFrameToClient(compression::encodeFrame(payload), client);
+            client->limits().commandBytes.charge(static_cast<double>(payload.size()));
+            return;
+        }
+    }
 
-    std::string logPrefix = "LOG ";
-    int totalSize = LogSize + logPrefix.size();
+    std::string logString = header + chatLog.read(fromOffset, chatLog.sizeInBytes());
+    transmitToClient(logString, client);
+    client->limits().commandBytes.charge(static_cast<double>(logString.size()));
+}
 
-    char* fileBuffer = new char[totalSize];
-    memcpy(fileBuffer, logPrefix.c_str(), logPrefix.size());
-    logDescriptor.read(fileBuffer + logPrefix.size(), LogSize);
-    logDescriptor.close();
+// "$resume <last seen> [all]" sends only what was logged after <last seen>. Without "all", a gap over RESUME_LIMIT only
+// gets "RESUME_GAP <missed>", so a long absence never pulls the whole log.
+void Server::handleResumeRequest(Client* client, const std::string& notification) {
+    uint64_t lastSeen = notification.size() > 8 ? std::strtoull(notification.c_str() + 8, nullptr, 10) : 0;
+    bool everything = notification.size() > 4 && notification.compare(notification.size() - 4, 4, " all") == 0;
+    uint64_t lastSequence = chatLog.lastSequence();
+    // A client ahead of this log has nothing to catch up on.
+    lastSeen = std::min(lastSeen, lastSequence);
+    if (!everything && lastSequence - lastSeen > history::RESUME_LIMIT) {
+        diagnostics.write(diag::INFO, "resume gap too large", client->getUserAlias(), {}, static_cast<int64_t>(lastSeen));
+        transmitToClient("RESUME_GAP " + std::to_string(lastSequence - lastSeen), client);
+        return;
+    }
+    sendHistory(client, lastSeen + 1);
+}
 
-    std::string logString(fileBuffer, totalSize);
-    transmitToClient(logString, client);
-    delete[] fileBuffer;
+// "$search <words> [@user] [<minutes>m]": newest matching records first, as
+// "#<seq> <snippet>" lines. Records still queued for indexing are not found yet.
+void Server::handleSearchRequest(Client* client, const std::string& notification) {
+    SearchQuery query;
+    std::string words;
+    size_t position = 7;
+    while (position < notification.size()) {
+        size_t end = notification.find(' ', position);
+        end = end == std::string::npos ? notification.size() : end;
+        std::string token = notification.substr(position, end - position);
+        position = end + 1;
+        if (token.size() > 1 && token[0] == '@') {
+            query.alias = token.substr(1);
+        }
+        else if (token.size() > 1 && token.back() == 'm' && token.find_first_not_of("0123456789") == token.size() - 1) {
+            int minutes = std::atoi(token.c_str());
+            query.fromSequence = chatLog.sequenceSince(std::time(nullptr) - static_cast<std::time_t>(minutes) * 60);
+        }
+        else {
+            words += token + " ";
+        }
+    }
+    query.terms = SearchIndex::tokenize(words);
+
+    std::vector<uint64_t> matches = searchIndex.find(query, search::RESULT_LIMIT);
+    std::string reply = "SEARCH " + std::to_string(matches.size()) + " results";
+    for (uint64_t sequence : matches) {
+        reply += "\n#" + std::to_string(sequence) + " " + searchSnippet(sequence, query.terms);
+    }
+    transmitToClient(reply, client);
+}
+
+// One line of the record around the first matching term.
+std::string Server::searchSnippet(uint64_t sequence, const std::vector<std::string>& terms) {
+    LogIndexRecord record{};
+    if (!chatLog.findBySequence(sequence, record)) {
+        return std::string();
+    }
+    std::string text = chatLog.read(record.offset, record.offset + record.length);
+    std::replace(text.begin(), text.end(), '\n', ' ');
+    std::string lowered = text;
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    size_t hit = std::string::npos;
+    for (const auto& term : terms) {
+        hit = std::min(hit, lowered.find(term));
+    }
+    size_t start = hit == std::string::npos || hit < search::SNIPPET_LENGTH / 2 ? 0 : hit - search::SNIPPET_LENGTH / 2;
+    std::string snippet = text.substr(start, search::SNIPPET_LENGTH);
+    return (start > 0 ? "..." : "") + snippet + (start + search::SNIPPET_LENGTH < text.size() ? "..." : "");
+}
+
+CompressedSegments& Server::segmentsFor(compression::Codec codec) {
+    if (!compressedSegments[codec]) {
+        compressedSegments[codec].reset(new CompressedSegments(logPath, codec));
+    }
+    return *compressedSegments[codec];
 }
 
 void Server::handleExitRequest(Client* client) {
     std::string FinalMessage = "EXIT Goodbye! You have been disconnected.";
     transmitToClient(FinalMessage, client);
-    std::cout << "(" << client->getUserAlias() << ") HAS DISCONNECTED\n";
-    shutdown(client->retrieveEndpoint(), SD_SEND);
+    diagnostics.write(diag::INFO, "disconnected", client->getUserAlias());
+    shutdownAfterFlush(client);
+}
+
+// Moves a local client onto a pair of shared-memory rings. The answer is the
+// last frame on the socket; from then on it only carries doorbells.
+void Server::handleSharedMemoryRequest(Client* client) {
+    if (!client->isLocal() || client->sharedChannel() != nullptr) {
+        transmitToClient("SHM_REFUSED", client);
+        return;
+    }
+    std::string name = "Local\\ServerClientConsole-" + std::to_string(GetCurrentProcessId()) + "-" + std::to_string(client->retrieveEndpoint());
+    std::unique_ptr<SharedChannel> channel;
+    try {
+        channel = SharedChannel::create(name, client->retrieveEndpoint());
+    }
+    catch (const std::exception& ex) {
+        diagnostics.write(diag::WARNING, "shared memory unavailable", client->getUserAlias(), ex.what());
+        transmitToClient("SHM_REFUSED", client);
+        return;
+    }
+    transmitToClient("SHM " + name, client);
+    client->attachSharedChannel(std::move(channel));
+    diagnostics.write(diag::INFO, "shared memory attached", client->getUserAlias());
+}
+
+// "$upload <alias|all> <size> <name>" opens an upload; "$chunk <bytes>" frames
+// follow, each acknowledged so the sender keeps a bounded window in flight.
+// The server does not police that window: the uploadBytes budget stops
+// reading a sender that outruns it.
+void Server::handleUploadRequest(Client* client, const std::string& notification) {
+    std::istringstream request(notification.substr(7));
+    std::string recipient;
+    uint64_t size = 0;
+    std::string name;
+    request >> recipient >> size;
+    std::getline(request >> std::ws, name);
+    name = attachment::baseName(name);
+    std::vector<std::string> aliases = localAliases();
+    if (client->upload() != nullptr) {
+        transmitToClient("SEND_REFUSED An upload is already in progress", client);
+        return;
+    }
+    if (name.empty() || size == 0 || size > attachment::MAX_SIZE) {
+        transmitToClient("SEND_REFUSED Usage: $send <alias|all> <file>, up to " + std::to_string(attachment::MAX_SIZE >> 20) + " MB", client);
+        return;
+    }
+    if (recipient != "all" && std::find(aliases.begin(), aliases.end(), recipient) == aliases.end()) {
+        transmitToClient("SEND_REFUSED " + recipient + " is not connected to this server", client);
+        return;
+    }
+    if (!fileStore.hasRoomFor(size)) {
+        diagnostics.write(diag::WARNING, "attachment store full", client->getUserAlias(), name, static_cast<int64_t>(size));
+        transmitToClient("SEND_REFUSED The server has no room for more files", client);
+        return;
+    }
+    try {
+        client->upload() = fileStore.beginUpload(recipient, name, size);
+    }
+    catch (const std::exception& ex) {
+        diagnostics.write(diag::WARNING, "upload refused", client->getUserAlias(), ex.what());
+        transmitToClient("SEND_REFUSED The server cannot store files right now", client);
+        return;
+    }
+    diagnostics.write(diag::INFO, "upload started", client->getUserAlias(), name, static_cast<int64_t>(size));
+    transmitToClient("SEND_READY", client);
+}
+
+void Server::handleChunk(Client* client, const std::string& notification) {
+    std::unique_ptr<Upload>& upload = client->upload();
+    if (upload == nullptr) {
+        return;
+    }
+    if (notification.size() <= 7) {
+        diagnostics.write(diag::INFO, "upload cancelled", client->getUserAlias(), upload->name());
+        upload.reset();
+        transmitToClient("SEND_REFUSED Upload cancelled", client);
+        return;
+    }
+    uint64_t length = notification.size() - 7;
+    if (length > attachment::CHUNK_SIZE) {
+        diagnostics.write(diag::WARNING, "upload chunk too large", client->getUserAlias(), upload->name(), static_cast<int64_t>(length));
+        upload.reset();
+        transmitToClient("SEND_REFUSED Chunks may carry at most " + std::to_string(attachment::CHUNK_SIZE) + " bytes", client);
+        return;
+    }
+    try {
+        fileStore.append(*upload, notification.data() + 7, notification.size() - 7);
+    }
+    catch (const std::exception& ex) {
+        diagnostics.write(diag::WARNING, "upload failed", client->getUserAlias(), ex.what());
+        upload.reset();
+        transmitToClient("SEND_REFUSED The upload could not be stored", client);
+        return;
+    }
+    if (upload->complete()) {
+        completeUpload(client);
+        return;
+    }
+    transmitToClient("SEND_ACK " + std::to_string(upload->received()), client);
+}
+
+// Only a reference goes into the log and the broadcast; recipients fetch the
+// content by digest when they want it.
+void Server::completeUpload(Client* client) {
+    std::unique_ptr<Upload> upload = std::move(client->upload());
+    std::string digest;
+    try {
+        digest = fileStore.finishUpload(*upload);
+    }
+    catch (const std::exception& ex) {
+        diagnostics.write(diag::WARNING, "upload failed", client->getUserAlias(), ex.what());
+        transmitToClient("SEND_REFUSED The upload could not be stored", client);
+        return;
+    }
+    // The token goes to the sender and to the sessions the file was sent to,
+    // nowhere else.
+    std::string token;
+    try {
+        token = fileStore.issueToken(digest);
+    }
+    catch (const std::exception& ex) {
+        diagnostics.write(diag::WARNING, "upload failed", client->getUserAlias(), ex.what());
+        transmitToClient("SEND_REFUSED The upload could not be stored", client);
+        return;
+    }
+    metrics.attachmentsStored++;
+    std::string offer = "FILE " + digest + " " + token + " " + std::to_string(upload->size()) + " " + client->getUserAlias() + " " +
+        upload->name();
+    std::string logged = "FILE (" + client->getUserAlias() + ") sent " + upload->name() + " (" + std::to_string(upload->size()) + " bytes) to " +
+        upload->recipient();
+    if (upload->recipient() == "all") {
+        fileStore.grantEveryone(digest);
+        broadcastUdpMessage(offer, client);
+        logged += " sha256:" + digest;
+    }
+    else {
+        // Everyone can read the log: a private file's digest stays out of it.
+        for (auto& recipient : clientList) {
+            if (!recipient->isPeerLink() && recipient->getUserAlias() == upload->recipient()) {
+                transmitToClient(offer, recipient);
+            }
+        }
+    }
+    recordLog(logged);
+    diagnostics.write(diag::INFO, "upload stored", client->getUserAlias(), digest, static_cast<int64_t>(upload->size()));
+    transmitToClient("SEND_DONE " + upload->name() + " sha256:" + digest + " token:" + token, client);
+}
+
+// "$fetch <digest> [token]" queues the file behind any other fetch of this
+// session; the select() loop then sends it a chunk at a time. Only a file sent
+// to "all" is fetched without its token.
+void Server::handleFetchRequest(Client* client, const std::string& notification) {
+    std::istringstream request(notification.size() > 7 ? notification.substr(7) : "");
+    std::string digest;
+    std::string token;
+    request >> digest >> token;
+    // Refused the same way as a missing file, so a digest never confirms a
+    // private file exists.
+    std::unique_ptr<Download> download;
+    if (fileStore.mayFetch(digest, token)) {
+        download = fileStore.openDownload(digest);
+    }
+    if (download == nullptr) {
+        transmitToClient("FETCH_REFUSED No attachment " + digest, client);
+        return;
+    }
+    client->downloads().push_back(std::move(download));
+}
+
+// Returns true while some TransmitFile is still in flight.
+bool Server::pumpDownloads(const fd_set& writeSet) {
+    bool inFlight = false;
+    for (auto& client : clientList) {
+        if (!client->downloads().empty() && !pumpDownload(client, writeSet)) {
+            // The session notices the dead socket and drops itself.
+            diagnostics.write(diag::WARNING, "attachment delivery failed", client->getUserAlias(), {}, environment.sockets.lastError());
+            client->downloads().clear();
+        }
+        inFlight = inFlight || client->transmitting();
+    }
+    return inFlight;
+}
+
+// One chunk per session per pass, and only with nothing queued ahead of it,
+// so a large file never holds chat frames back by more than a chunk.
+bool Server::pumpDownload(Client* client, const fd_set& writeSet) {
+    Download& download = *client->downloads().front();
+    SOCKET destination = client->retrieveEndpoint();
+    if (download.pending()) {
+        if (!download.pollChunk(destination)) {
+            return false;
+        }
+        if (download.pending()) {
+            return true;
+        }
+    }
+    if (download.complete()) {
+        metrics.attachmentBytesSent += download.bytesSent();
+        diagnostics.write(diag::INFO, "attachment delivered", client->getUserAlias(), download.digest(), static_cast<int64_t>(download.bytesSent()));
+        client->downloads().pop_front();
+        return true;
+    }
+    if (client->sharedChannel() != nullptr) {
+        return client->outbox() != nullptr || sendChunkFrame(client, download);
+    }
+    if (client->outbox() != nullptr || rioSender.sending(destination) || !FD_ISSET(destination, &writeSet)) {
+        return true;
+    }
+    if (!environment.hostServices) {
+        // No TransmitFile on a simulated socket: the chunk goes out as a frame.
+        return sendChunkFrame(client, download);
+    }
+    return download.startChunk(destination);
+}
+
+// False if the session's socket failed, like startChunk().
+bool Server::sendChunkFrame(Client* client, Download& download) {
+    try {
+        sendFrameToClient(download.readChunk(), client);
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// Traffic per alias is for whoever runs the server, so only sessions on the
+// local listener, i.e. on this machine, get it.
+void Server::handleStatsRequest(Client* client) {
+    if (!client->isLocal()) {
+        transmitToClient("STATS_REFUSED Traffic statistics are only available to local sessions", client);
+        return;
+    }
+    transmitToClient(trafficStats.report(), client);
+}
 
-    char holder[256];
-    recv(client->retrieveEndpoint(), holder, sizeof(holder), 0);
-    int recvResult = recv(client->retrieveEndpoint(), holder, sizeof(holder), 0);
-    if (recvResult == SOCKET_ERROR) {
-        std::cerr << "Error receiving acknowledgment: " << WSAGetLastError() << std::endl;
+void Server::handleMetricsRequest(Client* client) {
+    std::string report = "METRICS clients=" + std::to_string(clientList.size());
+    report += " frames=" + std::to_string(metrics.framesProcessed);
+    report += " chat_throttled=" + std::to_string(metrics.chatThrottled);
+    report += " commands_throttled=" + std::to_string(metrics.commandsThrottled);
+    report += " sessions_yielded=" + std::to_string(metrics.sessionsYielded);
+    report += " memory_used=" + std::to_string(memoryBudget.used());
+    report += " memory_ceiling=" + std::to_string(memoryBudget.ceiling());
+    report += " search_index_bytes=" + std::to_string(searchIndex.bytesInMemory());
+    report += " broadcasts_shed=" + std::to_string(metrics.broadcastsShed);
+    report += " history_refused=" + std::to_string(metrics.historyRefused);
+    report += " connections_shed=" + std::to_string(metrics.connectionsShed);
+    report += " connections_deferred=" + std::to_string(metrics.connectionsDeferred);
+    report += " accept_batches_capped=" + std::to_string(metrics.acceptBatchesCapped);
+    report += " attachments_stored=" + std::to_string(metrics.attachmentsStored);
+    report += " attachment_bytes_sent=" + std::to_string(metrics.attachmentBytesSent);
+    transmitToClient(report, client);
+}
+
+// Charges the session's token buckets for a request. Chat over budget is
+// dropped, history requests over budget are refused; either way the client is
+// told once until it is back within its limits.
+bool Server::admitRequest(Client* client, const std::string& notification) {
+    SessionLimits& limits = client->limits();
+    if (notification.find("$exit") == 0 || notification.find("$metrics") == 0 ||
+        notification.find("$peer") == 0 || notification.find("$relay") == 0) {
+        return true;
+    }
+    // A chunk is never dropped, that would corrupt the file; its bytes are
+    // charged and runSession slows the session down once they run out.
+    if (notification.find("$chunk") == 0) {
+        limits.uploadBytes.charge(static_cast<double>(notification.size()));
+        return true;
+    }
+
+    if (notification.find("$ping") == 0) {
+        if (!limits.pings.tryTake(1)) {
+            metrics.commandsThrottled++;
+            notifyThrottled(client, "THROTTLED Too many pings, the run was stopped");
+            return false;
+        }
+    }
+    else if (notification.find("$getlog") == 0 || notification.find("$getlist") == 0 || notification.find("$resume") == 0 ||
+        notification.find("$search") == 0 || notification.find("$fetch") == 0 || notification.find("$presence") == 0 ||
+        notification.find("$stats") == 0 || notification.find("$upload") == 0 || notification.find("$register") == 0) {
+        if (!limits.commands.hasTokens() || !limits.commandBytes.hasTokens()) {
+            metrics.commandsThrottled++;
+            notifyThrottled(client, "THROTTLED Too many requests, try again later");
+            return false;
+        }
+        limits.commands.charge(1);
+    }
+    else {
+        if (!limits.chatMessages.hasTokens() || !limits.chatBytes.hasTokens()) {
+            metrics.chatThrottled++;
+            notifyThrottled(client, "THROTTLED You are sending messages too fast, some were dropped");
+            return false;
+        }
+        limits.chatMessages.charge(1);
+        limits.chatBytes.charge(static_cast<double>(notification.size()));
     }
-    closesocket(client->retrieveEndpoint());
-    FD_CLR(client->retrieveEndpoint(), &masterSet);
+    limits.throttleNotified = false;
+    return true;
+}
 
-    auto it = std::find_if(clientList.begin(), clientList.end(), [&client](const Client* c) { return c->retrieveEndpoint() == client->retrieveEndpoint(); });
-    if (it != clientList.end()) {
-        delete (*it);
-        clientList.erase(it);
+void Server::notifyThrottled(Client* client, const std::string& notification) {
+    if (!client->limits().throttleNotified) {
+        client->limits().throttleNotified = true;
+        transmitToClient(notification, client);
     }
 }
 
+// "$chat <text>"; a bare "$chat" has nothing to say and is ignored.
 void Server::handleChatRequest(Client* client, const std::string& notification) {
-    std::string CliBroadcastMsg = "(" + client->getUserAlias() + "): " + notification.substr(6);
+    if (notification.size() <= 6) {
+        return;
+    }
+    std::string text = notification.substr(6);
+    std::string CliBroadcastMsg = "(" + client->getUserAlias() + "): " + text;
     CliBroadcastMsg = "\nCHAT " + CliBroadcastMsg;
     broadcastUdpMessage(CliBroadcastMsg, client);
     recordLog(CliBroadcastMsg);
+    trafficStats.recordMessage(client->getUserAlias(), text.size());
+    if (!federation.queueChat(federation.nextMessageId(), CliBroadcastMsg)) {
+        diagnostics.write(diag::WARNING, "chat too large to relay", client->getUserAlias(), {}, static_cast<int64_t>(CliBroadcastMsg.size()));
+    }
 }
 
 void Server::handleDefaultChatRequest(Client* client, const std::string& notification) {
@@ -445,45 +1417,380 @@ void Server::handleDefaultChatRequest(Client* client, const std::string& notific
     CliBroadcastMsg = "CHAT " + CliBroadcastMsg;
     broadcastUdpMessage(CliBroadcastMsg, client);
     recordLog(CliBroadcastMsg);
+    trafficStats.recordMessage(client->getUserAlias(), notification.size());
+    if (!federation.queueChat(federation.nextMessageId(), CliBroadcastMsg)) {
+        diagnostics.write(diag::WARNING, "chat too large to relay", client->getUserAlias(), {}, static_cast<int64_t>(CliBroadcastMsg.size()));
+    }
+}
+
+// "$peer <node> [secret]". A link skips the session limits and may relay
+// chat under any alias, so only a configured peer host or a holder of the
+// shared secret gets one; anyone else is disconnected.
+bool Server::handlePeerRequest(Client* client, const std::string& notification) {
+    std::string remoteNode = notification.size() > 6 ? notification.substr(6) : std::string();
+    std::string secret;
+    size_t secretPos = remoteNode.find(' ');
+    if (secretPos != std::string::npos) {
+        secret = remoteNode.substr(secretPos + 1);
+        remoteNode.erase(secretPos);
+    }
+    if (!client->isPeerLink() && !federation.admitsPeer(client->remoteHost(), secret)) {
+        diagnostics.write(diag::WARNING, "rejected unauthorized peer link", {}, client->remoteHost());
+        return false;
+    }
+    if (remoteNode.empty() || remoteNode == federation.nodeId()) {
+        diagnostics.write(diag::WARNING, "rejected peer link with invalid node id", {}, remoteNode);
+        return true;
+    }
+    // The dialing side already announced itself; the accepting side answers.
+    if (!client->isPeerLink()) {
+        client->markPeerLink();
+        peerLinks++;
+        transmitToClient("$peer " + federation.nodeId(), client);
+    }
+    client->setPeerNode(remoteNode);
+    federation.attachLink(client, remoteNode);
+    federation.queueSnapshot(client, localAliases());
+    diagnostics.write(diag::INFO, "peer node linked", remoteNode);
+    return true;
+}
+
+void Server::handleRelayRequest(Client* client, const std::string& notification) {
+    if (!client->isPeerLink()) {
+        return;
+    }
+    for (const auto& entry : Federation::parseBatch(notification.substr(7))) {
+        if (!federation.markSeen(entry.messageId)) {
+            continue;
+        }
+        if (entry.type == "CHAT") {
+            broadcastUdpMessage(entry.payload, nullptr);
+            recordLog(entry.payload);
+        }
+        else if (federation.applyPresence(entry)) {
+            publishPresence(entry.type == "JOIN" ? roster.join(entry.payload) : roster.leave(entry.payload));
+        }
+    }
+}
+
+void Server::announceDeparture(Client* client) {
+    rioSender.forget(client->retrieveEndpoint());
+    roster.unsubscribe(client);
+    if (client->isPeerLink()) {
+        diagnostics.write(diag::INFO, "peer node unlinked", client->getPeerNode());
+        for (const auto& userAlias : federation.detachLink(client)) {
+            publishPresence(roster.leave(userAlias));
+        }
+    }
+    else if (!client->getUserAlias().empty()) {
+        if (!aliasHeldElsewhere(client->getUserAlias(), client)) {
+            federation.queuePresence("LEAVE", federation.nextMessageId(), client->getUserAlias());
+        }
+        publishPresence(roster.leave(client->getUserAlias()));
+    }
+}
+
+std::vector<std::string> Server::localAliases() const {
+    std::vector<std::string> aliases;
+    for (const auto& c : clientList) {
+        if (!c->isPeerLink() && !c->getUserAlias().empty()) {
+            aliases.push_back(c->getUserAlias());
+        }
+    }
+    return aliases;
+}
+
+bool Server::aliasHeldElsewhere(const std::string& alias, const Client* except) const {
+    return std::any_of(clientList.begin(), clientList.end(), [&](const Client* c) {
+        return c != except && !c->isPeerLink() && c->getUserAlias() == alias;
+    });
 }
 
 void Server::transmitToClient(const std::string& notification, Client* client) {
-    sendMessageToSocket(notification, client->retrieveEndpoint());
+    sendFrameToClient(encodeFrameFor(notification, client->getCompression()), client);
+}
+
+std::string Server::encodeFrameFor(const std::string& notification, compression::Codec codec) {
+    std::string block;
+    if (codec != compression::NONE && notification.size() >= compression::FRAME_THRESHOLD &&
+        compression::compressBlock(codec, notification.data(), notification.size(), block)) {
+        std::string payload;
+        compression::appendBlock(payload, block);
+        return compression::encodeFrame(payload);
+    }
+    return FanoutPool::encodeFrame(notification);
 }
 
 void Server::broadcastUdpMessage(const std::string& notification, Client* sender) {
+    // sender is null for chat relayed in from a peer node.
+    auto isRecipient = [&](const Client* client) {
+        return client->retrieveEndpoint() != tcpSocket && !client->isPeerLink()
+            && (sender == nullptr || client->retrieveEndpoint() != sender->retrieveEndpoint());
+    };
+    // Each frame is encoded once per codec in use, not once per recipient.
+    std::string frames[compression::CODEC_COUNT];
+    auto frameFor = [&](compression::Codec codec) -> const std::string& {
+        if (frames[codec].empty()) {
+            frames[codec] = encodeFrameFor(notification, codec);
+        }
+        return frames[codec];
+    };
+    if (!rioSender.isActive() && clientList.size() < fanout::PARALLEL_THRESHOLD) {
+        // A recipient that cannot be written to is dropped by its own session
+        // once it sees the disconnect; it must not fail the sender's request.
+        int failedSends = 0;
+        for (auto& client : clientList) {
+            if (isRecipient(client)) {
+                try {
+                    sendFrameToClient(frameFor(client->getCompression()), client, true);
+                }
+                catch (const std::exception&) {
+                    failedSends++;
+                }
+            }
+        }
+        if (failedSends > 0) {
+            diagnostics.write(diag::WARNING, "broadcast delivery failed", {}, {}, failedSends);
+        }
+        shedSlowReaders();
+        return;
+    }
+
+    // Registered I/O posts every send at once; otherwise large rooms are split
+    // across the fan-out pool. Either way, one batch per encoding.
+    std::vector<SOCKET> recipients[compression::CODEC_COUNT];
+    std::vector<Client*> recipientClients[compression::CODEC_COUNT];
+    int failedSends = 0;
+    for (auto& client : clientList) {
+        if (!isRecipient(client)) {
+            continue;
+        }
+        // Shared-memory rings have a single writer: this thread. A session
+        // with queued output or a file in flight must get this frame behind it.
+        if (client->sharedChannel() != nullptr || client->outbox() != nullptr || client->transmitting()) {
+            try {
+                sendFrameToClient(frameFor(client->getCompression()), client, true);
+            }
+            catch (const std::exception&) {
+                failedSends++;
+            }
+            continue;
+        }
+        recipients[client->getCompression()].push_back(client->retrieveEndpoint());
+        recipientClients[client->getCompression()].push_back(client);
+    }
+    std::vector<size_t> bytesSent;
+    for (int codec = 0; codec < compression::CODEC_COUNT; codec++) {
+        if (recipients[codec].empty()) {
+            continue;
+        }
+        const std::string& frame = frameFor(static_cast<compression::Codec>(codec));
+        if (rioSender.isActive()) {
+            // Recipients out of send slots, or a frame the buffer has no room
+            // for, go through their outbox instead.
+            std::vector<SOCKET> refused;
+            rioSender.sendFrame(frame, recipients[codec], refused);
+            std::unordered_set<SOCKET> fallback(refused.begin(), refused.end());
+            for (Client* client : recipientClients[codec]) {
+                if (fallback.count(client->retrieveEndpoint()) == 0) {
+                    continue;
+                }
+                try {
+                    sendFrameToClient(frame, client, true);
+                }
+                catch (const std::exception&) {
+                    failedSends++;
+                }
+            }
+            continue;
+        }
+        failedSends += fanoutPool.deliver(frame, recipients[codec], bytesSent);
+        for (size_t i = 0; i < bytesSent.size(); i++) {
+            if (bytesSent[i] != fanout::SEND_FAILED && bytesSent[i] < frame.size()) {
+                queueFrame(recipientClients[codec][i], frame, bytesSent[i], true);
+            }
+        }
+    }
+    if (failedSends > 0) {
+        diagnostics.write(diag::WARNING, "broadcast delivery failed", {}, {}, failedSends);
+    }
+    shedSlowReaders();
+}
+
+// Writes straight to the socket while nothing is queued for it; whatever the
+// socket cannot take now is queued and flushed once select() reports it
+// writable. Broadcasts are marked droppable for load shedding.
+void Server::sendFrameToClient(const std::string& frame, Client* client, bool droppable) {
+    if (client->outbox() != nullptr || writeInFlight(client)) {
+        queueFrame(client, frame, 0, droppable);
+        return;
+    }
+    if (client->sharedChannel() != nullptr) {
+        size_t written = client->sharedChannel()->write(frame.data(), frame.size());
+        if (written < frame.size()) {
+            queueFrame(client, frame, written, droppable);
+        }
+        return;
+    }
+    size_t bytesSent = 0;
+    while (bytesSent < frame.size()) {
+        int finalOutput = environment.sockets.send(client->retrieveEndpoint(), frame.data() + bytesSent, static_cast<int>(frame.size() - bytesSent));
+        if (finalOutput == SOCKET_ERROR) {
+            if (environment.sockets.lastError() == WSAEWOULDBLOCK) {
+                queueFrame(client, frame, bytesSent, droppable);
+                return;
+            }
+            throw std::runtime_error("Failed to send notification: " + std::to_string(environment.sockets.lastError()));
+        }
+        bytesSent += finalOutput;
+    }
+}
+
+void Server::queueFrame(Client* client, const std::string& frame, size_t alreadySent, bool droppable) {
+    Outbox& outbox = client->ensureOutbox();
+    if (outbox.frames.empty()) {
+        outbox.headOffset = alreadySent;
+    }
+    outbox.frames.push_back({ frame, droppable });
+    outbox.bytes += frame.size();
+    memoryBudget.charge(static_cast<int64_t>(frame.size()));
+    if (outbox.bytes > memory::SESSION_OUTBOX_LIMIT) {
+        dropQueuedBroadcasts(client, outbox.bytes - memory::SESSION_OUTBOX_LIMIT);
+    }
+}
+
+// Drops the oldest queued broadcasts until `bytesToFree` is released. The
+// frame being written and direct replies stay. Returns the bytes freed.
+size_t Server::dropQueuedBroadcasts(Client* client, size_t bytesToFree) {
+    Outbox* outbox = client->outbox();
+    if (outbox == nullptr) {
+        return 0;
+    }
+    size_t freed = 0;
+    auto frame = outbox->frames.begin();
+    if (outbox->headOffset > 0) {
+        ++frame;
+    }
+    while (frame != outbox->frames.end() && freed < bytesToFree) {
+        if (!frame->droppable) {
+            ++frame;
+            continue;
+        }
+        freed += frame->bytes.size();
+        frame = outbox->frames.erase(frame);
+        metrics.broadcastsShed++;
+    }
+    outbox->bytes -= freed;
+    memoryBudget.charge(-static_cast<int64_t>(freed));
+    return freed;
+}
+
+// First shedding stage: past the threshold, the sessions with the most queued
+// output lose their oldest broadcasts until the server is back under it.
+void Server::shedSlowReaders() {
+    uint64_t excess = memoryBudget.bytesOverShedding();
+    if (excess == 0) {
+        return;
+    }
+    std::vector<Client*> backlogged;
     for (auto& client : clientList) {
-        if (client->retrieveEndpoint() != tcpSocket && client->retrieveEndpoint() != sender->retrieveEndpoint()) {
-            sendMessageToSocket(notification, client->retrieveEndpoint());
+        if (client->outbox() != nullptr) {
+            backlogged.push_back(client);
         }
     }
+    std::sort(backlogged.begin(), backlogged.end(), [](Client* a, Client* b) { return a->outbox()->bytes > b->outbox()->bytes; });
+    for (size_t i = 0; i < backlogged.size() && excess > 0; i++) {
+        size_t freed = dropQueuedBroadcasts(backlogged[i], static_cast<size_t>(excess));
+        excess -= std::min<uint64_t>(excess, freed);
+    }
 }
 
-void Server::sendMessageToSocket(const std::string& notification, SOCKET soc_Client) {
-    uint32_t SizeOfMsg = static_cast<uint32_t>(notification.size());
-    int finalOutput = send(soc_Client, reinterpret_cast<const char*>(&SizeOfMsg), sizeof(SizeOfMsg), 0);
-    if (finalOutput == SOCKET_ERROR) {
-        throw std::runtime_error("Failed to send notification size: " + std::to_string(WSAGetLastError()));
+// A TransmitFile or RIO send is writing to the socket; anything else sent now
+// would interleave with it.
+bool Server::writeInFlight(Client* client) const {
+    return client->transmitting() || rioSender.sending(client->retrieveEndpoint());
+}
+
+void Server::flushWritable(const fd_set& writeSet) {
+    for (auto& client : clientList) {
+        bool writable = client->sharedChannel() != nullptr || FD_ISSET(client->retrieveEndpoint(), &writeSet);
+        if (client->outbox() != nullptr && !writeInFlight(client) && writable) {
+            flushOutbox(client);
+        }
     }
+}
 
-    finalOutput = send(soc_Client, notification.c_str(), SizeOfMsg, 0);
-    if (finalOutput == SOCKET_ERROR) {
-        throw std::runtime_error("Failed to send notification: " + std::to_string(WSAGetLastError()));
+void Server::flushOutbox(Client* client) {
+    Outbox& outbox = *client->outbox();
+    while (!outbox.frames.empty()) {
+        const std::string& frame = outbox.frames.front().bytes;
+        const char* pending = frame.data() + outbox.headOffset;
+        size_t remaining = frame.size() - outbox.headOffset;
+        int finalOutput = 0;
+        if (client->sharedChannel() != nullptr) {
+            try {
+                finalOutput = static_cast<int>(client->sharedChannel()->write(pending, remaining));
+            }
+            catch (const std::exception&) {
+                break;
+            }
+            if (finalOutput == 0) {
+                return;
+            }
+        }
+        else {
+            finalOutput = environment.sockets.send(client->retrieveEndpoint(), pending, static_cast<int>(remaining));
+            if (finalOutput == SOCKET_ERROR) {
+                if (environment.sockets.lastError() == WSAEWOULDBLOCK) {
+                    return;
+                }
+                // The session notices the dead socket and drops itself.
+                break;
+            }
+        }
+        outbox.headOffset += finalOutput;
+        if (outbox.headOffset == frame.size()) {
+            outbox.bytes -= frame.size();
+            memoryBudget.charge(-static_cast<int64_t>(frame.size()));
+            outbox.frames.pop_front();
+            outbox.headOffset = 0;
+        }
+    }
+    bool shutdownNow = outbox.shutdownWhenFlushed;
+    memoryBudget.charge(-static_cast<int64_t>(outbox.bytes));
+    client->releaseOutbox();
+    if (shutdownNow) {
+        environment.sockets.shutdown(client->retrieveEndpoint(), SD_SEND);
     }
 }
 
-void Server::recordLog(const std::string& notification) {
-    std::ofstream logDescriptor(logPath, std::ios::app);
-    if (!logDescriptor.good()) {
-        std::cerr << "Error opening log file." << std::endl;
+// Half-closes once everything queued for the client has been written.
+void Server::shutdownAfterFlush(Client* client) {
+    if (client->outbox() != nullptr) {
+        client->outbox()->shutdownWhenFlushed = true;
         return;
     }
-    std::time_t now = std::time(nullptr);
-    std::tm* CurrentTime = std::localtime(&now);
-    char holdTime[80];
-    std::strftime(holdTime, sizeof(holdTime), "[%Y-%m-%d %H:%M:%S]", CurrentTime);
-    logDescriptor << holdTime << " " << notification << std::endl;
-    logDescriptor.close();
+    environment.sockets.shutdown(client->retrieveEndpoint(), SD_SEND);
+}
+
+void Server::accountInput(Client* client) {
+    size_t capacity = client->inputBuffer().capacity();
+    memoryBudget.charge(static_cast<int64_t>(capacity) - static_cast<int64_t>(client->chargedInput()));
+    client->chargedInput() = capacity;
+}
+
+// An idle session keeps no receive buffer beyond a small one, unless low-latency
+// mode pre-faulted it to keep.
+void Server::releaseIdleInput(Client* client) {
+    std::string& input = client->inputBuffer();
+    if (input.empty() && input.capacity() > memory::IDLE_BUFFER_RETAIN && !latencyTuning.busyPoll) {
+        std::string().swap(input);
+        accountInput(client);
+    }
+}
+
+void Server::recordLog(const std::string& notification) {
+    searchIndex.add(chatLog.append(notification), notification);
 }
 
 void Server::setup() {
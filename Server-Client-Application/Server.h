@@ -2,63 +2,175 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <chrono>
+#include <unordered_set>
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include "Client.h"
+#include "FanoutPool.h"
+#include "Federation.h"
+#include "ChatLog.h"
+#include "ServerMetrics.h"
+#include "TrafficStats.h"
+#include "RioSender.h"
+#include "Reactor.h"
+#include "DiagnosticLog.h"
+#include "SearchIndex.h"
+#include "MemoryBudget.h"
+#include "FileStore.h"
+#include "Handover.h"
+#include "Environment.h"
+#include "Roster.h"
+#include "Admission.h"
+#include "LowLatency.h"
 
 #pragma comment(lib, "Ws2_32.lib")
 
 class Server {
 public:
-    Server(int clientLimit, const char* listeningPort);
+    // clientLimit: sessions accepted at once, peer links not counted; capped
+    // at capacity::MAX_CLIENTS.
+    // takeOver: start from the sockets and sessions of the server already
+    // running on this port instead of binding a new listener.
+    // environment: sockets, clock and discovery; a simulated network runs the
+    // same server in virtual time.
+    Server(int clientLimit, const char* listeningPort, io::Backend ioBackend = io::SELECT, bool takeOver = false,
+        Environment& environment = Environment::system());
     ~Server();
     void execution();
+    // execution() is start() followed by runOnce() forever; a harness calls
+    // them itself to step the loop.
+    void start();
+    void runOnce();
     void addNewClient();
-    bool processClientQuery(Client* client);
-    void sendUdpBroadcast();
+    bool processClientQuery(Client* client, const std::string& notification);
     void transmitToClient(const std::string& notification, Client* client);
     void broadcastUdpMessage(const std::string& notification, Client* sender);
     void recordLog(const std::string& notification);
-    
+    void addPeer(const std::string& address);
+    // Lets peers outside the configured addresses link with "$peer <node> <secret>".
+    void setPeerSecret(const std::string& secret);
+    void configureDiagnostics(diag::Level minimumLevel, bool includeBodies);
+    void setMemoryCeiling(uint64_t bytes);
+    // backlog: listen queue length, 0 for the system maximum. sessionsPerSecond:
+    // admission rate for new connections, 0 for unlimited. Call before start().
+    void configureAdmission(int backlog, double sessionsPerSecond);
+    // Opt-in low-latency mode; call before start(), from the thread that
+    // will run the loop.
+    void configureLatency(const LatencyTuning& tuning);
+
 
 private:
     bool initializeWinsock();
     bool setupServer();
-    bool setupUDPServer();
     void displayError(const char* errorMsg, int errorCode);
-    void cleanupSocketAndAddrInfo(SOCKET& socket, struct addrinfo* addrInfo);
     void cleanupClients();
-    void promptForServerIP();
     void displayServerInitialization();
     void setupServerSocketForListening();
-    void startUdpBroadcastThread();
+    void setupLocalListener();
     int getHighestFileDescriptor();
     void handleSocketErrors(int finalOutput);
     void checkAndHandleClientConnections();
     void removeDisconnectedClients();
     SOCKET createClientSocket(sockaddr_in& clientAddress, int& clientAddressLength);
+    size_t sessionCount() const;
     bool isServerFull() const;
-    void rejectClientDueToCapacity(SOCKET& clientSock);
-    void addClientToServer(SOCKET& clientSock, sockaddr_in& clientAddress);
+    SessionTask rejectClientDueToCapacity(SOCKET clientSock);
+    SessionTask deferClient(SOCKET clientSock, std::chrono::milliseconds retryAfter);
+    Client* addClientToServer(SOCKET& clientSock, const std::string& origin, const std::string& remoteHost = {});
+    void addLocalClient();
     void updateMaxFD(SOCKET& clientSock);
-    void handleRegisterRequest(Client* client, const std::string& notification);
+    bool handleRegisterRequest(Client* client, const std::string& notification);
     void handleGetListRequest(Client* client);
-    void handleGetLogRequest(Client* client);
+    void handlePresenceRequest(Client* client, const std::string& notification);
+    void publishPresence(const std::string& delta);
+    void handleGetLogRequest(Client* client, const std::string& notification);
+    void handleResumeRequest(Client* client, const std::string& notification);
+    void sendHistory(Client* client, uint64_t firstSequence);
+    void handleSearchRequest(Client* client, const std::string& notification);
+    std::string searchSnippet(uint64_t sequence, const std::vector<std::string>& terms);
     void handleExitRequest(Client* client);
+    void handleMetricsRequest(Client* client);
+    void handleStatsRequest(Client* client);
+    void applyLatencyTuning();
+    void handleSharedMemoryRequest(Client* client);
+    void handleUploadRequest(Client* client, const std::string& notification);
+    void handleChunk(Client* client, const std::string& notification);
+    void completeUpload(Client* client);
+    void handleFetchRequest(Client* client, const std::string& notification);
+    bool pumpDownloads(const fd_set& writeSet);
+    bool pumpDownload(Client* client, const fd_set& writeSet);
+    bool sendChunkFrame(Client* client, Download& download);
+    bool adoptPredecessor();
+    void resumeInheritedSessions();
+    void handOver();
+    std::unordered_set<Client*> settleTransmits();
+    bool collectHandover(DWORD successor, ServerHandover& state, const std::unordered_set<Client*>& abandoned);
+    bool admitRequest(Client* client, const std::string& notification);
+    void notifyThrottled(Client* client, const std::string& notification);
+    SessionTask runSession(Client* client);
+    void dropClient(Client* client);
+    void logReceived(Client* client, const std::string& notification);
     void handleChatRequest(Client* client, const std::string& notification);
     void handleDefaultChatRequest(Client* client, const std::string& notification);
-    void sendMessageToSocket(const std::string& notification, SOCKET soc_Client);
+    void sendFrameToClient(const std::string& frame, Client* client, bool droppable = false);
+    void queueFrame(Client* client, const std::string& frame, size_t alreadySent, bool droppable);
+    size_t dropQueuedBroadcasts(Client* client, size_t bytesToFree);
+    void shedSlowReaders();
+    bool writeInFlight(Client* client) const;
+    void flushWritable(const fd_set& writeSet);
+    void flushOutbox(Client* client);
+    void shutdownAfterFlush(Client* client);
+    void accountInput(Client* client);
+    void releaseIdleInput(Client* client);
+    bool admitConnection(SOCKET clientSock);
+    std::string encodeFrameFor(const std::string& notification, compression::Codec codec);
+    CompressedSegments& segmentsFor(compression::Codec codec);
+    void connectToPeers();
+    bool handlePeerRequest(Client* client, const std::string& notification);
+    void handleRelayRequest(Client* client, const std::string& notification);
+    void announceDeparture(Client* client);
+    void flushPeerBatches();
+    std::vector<std::string> localAliases() const;
+    // Whether a local session other than `except` goes by `alias`.
+    bool aliasHeldElsewhere(const std::string& alias, const Client* except) const;
     void setup();
+    Environment& environment;
     int clientLimit;
+    size_t peerLinks;
     std::vector<Client*> clientList;
     fd_set masterSet;
     fd_set activeSet;
     SOCKET tcpSocket;
-    SOCKET udpSocket;
     int maxFd;
     const char* listeningPort;
     std::string logPath;
     int logDescriptor;
     timeval waitDuration;
     std::string hostIP;
+    FanoutPool fanoutPool;
+    Federation federation;
+    ChatLog chatLog;
+    std::unique_ptr<CompressedSegments> compressedSegments[compression::CODEC_COUNT];
+    ServerMetrics metrics;
+    TrafficStats trafficStats;
+    io::Backend ioBackend;
+    RioSender rioSender;
+    Reactor reactor;
+    DiagnosticLog diagnostics;
+    SOCKET localSocket;
+    std::string localPath;
+    MemoryBudget memoryBudget;
+    SearchIndex searchIndex;
+    FileStore fileStore;
+    Roster roster;
+    AdmissionControl admissionControl;
+    int listenBacklog;
+    LatencyTuning latencyTuning;
+    HandoverPipe handoverPipe;
+    std::unique_ptr<HandoverPipe> predecessor;
+    std::unique_ptr<ServerHandover> inheritedState;
+    std::chrono::steady_clock::time_point takeoverStarted;
+    bool transmitsInFlight;
 };
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+// Counters reported by $metrics. Only touched from the network thread.
+struct ServerMetrics {
+    uint64_t framesProcessed = 0;
+    uint64_t chatThrottled = 0;
+    uint64_t commandsThrottled = 0;
+    uint64_t sessionsYielded = 0;
+    uint64_t broadcastsShed = 0;
+    uint64_t historyRefused = 0;
+    uint64_t connectionsShed = 0;
+    uint64_t connectionsDeferred = 0;
+    uint64_t acceptBatchesCapped = 0;
+    uint64_t attachmentsStored = 0;
+    uint64_t attachmentBytesSent = 0;
+};
@@ -0,0 +1,194 @@
+#include "SharedChannel.h"
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <cstring>
+#include <new>
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions must be lock-free to be shared across processes");
+
+namespace {
+    constexpr size_t RING_STRIDE = sizeof(RingHeader) + local::RING_CAPACITY;
+}
+
+std::string local::socketPath(const std::string& listeningPort) {
+    return "ServerClientConsole-" + listeningPort + ".sock";
+}
+
+SharedRing::SharedRing() : header(nullptr), data(nullptr) {
+}
+
+void SharedRing::attach(char* base, bool initialize) {
+    header = reinterpret_cast<RingHeader*>(base);
+    data = base + sizeof(RingHeader);
+    if (initialize) {
+        new (header) RingHeader();
+        header->writePos.store(0);
+        header->readPos.store(0);
+        header->readerWaiting.store(0);
+    }
+}
+
+size_t SharedRing::write(const char* bytes, size_t length) {
+    uint64_t writePos = header->writePos.load(std::memory_order_relaxed);
+    uint64_t readPos = header->readPos.load(std::memory_order_acquire);
+    size_t count = std::min(length, static_cast<size_t>(local::RING_CAPACITY - (writePos - readPos)));
+    size_t offset = static_cast<size_t>(writePos % local::RING_CAPACITY);
+    size_t firstPart = std::min(count, local::RING_CAPACITY - offset);
+    memcpy(data + offset, bytes, firstPart);
+    memcpy(data, bytes + firstPart, count - firstPart);
+    header->writePos.store(writePos + count);
+    return count;
+}
+
+size_t SharedRing::read(char* bytes, size_t length) {
+    uint64_t readPos = header->readPos.load(std::memory_order_relaxed);
+    uint64_t writePos = header->writePos.load();
+    size_t count = std::min(length, static_cast<size_t>(writePos - readPos));
+    size_t offset = static_cast<size_t>(readPos % local::RING_CAPACITY);
+    size_t firstPart = std::min(count, local::RING_CAPACITY - offset);
+    memcpy(bytes, data + offset, firstPart);
+    memcpy(bytes + firstPart, data, count - firstPart);
+    header->readPos.store(readPos + count, std::memory_order_release);
+    return count;
+}
+
+// The flag and the positions use sequentially consistent accesses on both
+// sides, so either the writer sees the flag or the reader sees the data.
+bool SharedRing::prepareToWait() {
+    header->readerWaiting.store(1);
+    if (header->writePos.load() != header->readPos.load(std::memory_order_relaxed)) {
+        header->readerWaiting.store(0);
+        return false;
+    }
+    return true;
+}
+
+void SharedRing::finishWait() {
+    header->readerWaiting.store(0);
+}
+
+bool SharedRing::takeWakeRequest() {
+    return header->readerWaiting.exchange(0) != 0;
+}
+
+size_t SharedChannel::mappingSize() {
+    return 2 * RING_STRIDE;
+}
+
+// Ring 0 carries server-to-client frames, ring 1 client-to-server.
+SharedChannel::SharedChannel(const std::string& name, HANDLE mapping, char* view, bool creator, bool initialize, SOCKET doorbell)
+    : channelName(name), mapping(mapping), view(view), doorbell(doorbell) {
+    outbound.attach(view + (creator ? 0 : RING_STRIDE), initialize);
+    inbound.attach(view + (creator ? RING_STRIDE : 0), initialize);
+}
+
+std::unique_ptr<SharedChannel> SharedChannel::create(const std::string& name, SOCKET doorbell) {
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, static_cast<DWORD>(mappingSize()), name.c_str());
+    if (mapping == NULL) {
+        throw std::runtime_error("Failed to create shared memory: " + std::to_string(GetLastError()));
+    }
+    char* view = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, mappingSize()));
+    if (view == NULL) {
+        CloseHandle(mapping);
+        throw std::runtime_error("Failed to map shared memory: " + std::to_string(GetLastError()));
+    }
+    return std::unique_ptr<SharedChannel>(new SharedChannel(name, mapping, view, true, true, doorbell));
+}
+
+std::unique_ptr<SharedChannel> SharedChannel::open(const std::string& name, SOCKET doorbell) {
+    return openExisting(name, doorbell, false);
+}
+
+std::unique_ptr<SharedChannel> SharedChannel::adopt(const std::string& name, SOCKET doorbell) {
+    return openExisting(name, doorbell, true);
+}
+
+std::unique_ptr<SharedChannel> SharedChannel::openExisting(const std::string& name, SOCKET doorbell, bool creator) {
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    if (mapping == NULL) {
+        throw std::runtime_error("Failed to open shared memory: " + std::to_string(GetLastError()));
+    }
+    char* view = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, mappingSize()));
+    if (view == NULL) {
+        CloseHandle(mapping);
+        throw std::runtime_error("Failed to map shared memory: " + std::to_string(GetLastError()));
+    }
+    return std::unique_ptr<SharedChannel>(new SharedChannel(name, mapping, view, creator, false, doorbell));
+}
+
+SharedChannel::~SharedChannel() {
+    UnmapViewOfFile(view);
+    CloseHandle(mapping);
+}
+
+const std::string& SharedChannel::name() const {
+    return channelName;
+}
+
+// Rings the reader's doorbell if it went to sleep. A doorbell socket too full
+// to take another byte already has one waiting.
+size_t SharedChannel::write(const char* bytes, size_t length) {
+    size_t written = outbound.write(bytes, length);
+    if (outbound.takeWakeRequest()) {
+        char bell = 1;
+        if (::send(doorbell, &bell, 1, 0) == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+            throw std::runtime_error("Failed to signal shared memory reader: " + std::to_string(WSAGetLastError()));
+        }
+    }
+    return written;
+}
+
+// Blocks like a send() on a full socket buffer: waits for the reader to make
+// room.
+void SharedChannel::send(const char* bytes, size_t length) {
+    auto deadline = std::chrono::steady_clock::now() + local::WRITE_TIMEOUT;
+    size_t written = 0;
+    while (true) {
+        written += write(bytes + written, length - written);
+        if (written == length) {
+            return;
+        }
+        if (std::chrono::steady_clock::now() > deadline) {
+            throw std::runtime_error("Shared memory reader stopped draining");
+        }
+        std::this_thread::yield();
+    }
+}
+
+void SharedChannel::receiveInto(std::string& buffer) {
+    char chunk[16 * 1024];
+    size_t count;
+    while ((count = inbound.read(chunk, sizeof(chunk))) > 0) {
+        buffer.append(chunk, count);
+    }
+}
+
+// Client side: blocks on the doorbell socket while the ring is empty.
+void SharedChannel::receiveExact(char* bytes, size_t length) {
+    size_t bytesRead = 0;
+    while (bytesRead < length) {
+        size_t count = inbound.read(bytes + bytesRead, length - bytesRead);
+        if (count > 0) {
+            bytesRead += count;
+            continue;
+        }
+        if (!inbound.prepareToWait()) {
+            continue;
+        }
+        char bells[64];
+        int nbytes = recv(doorbell, bells, sizeof(bells), 0);
+        inbound.finishWait();
+        if (nbytes <= 0) {
+            throw std::runtime_error("Error: Unable to receive notification. Code: " + std::to_string(WSAGetLastError()));
+        }
+    }
+}
+
+bool SharedChannel::prepareToWait() {
+    return inbound.prepareToWait();
+}
+
+void SharedChannel::finishWait() {
+    inbound.finishWait();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <winsock2.h>
+#include <windows.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace local {
+    // Bytes per direction; frames larger than this are streamed through.
+    constexpr size_t RING_CAPACITY{ 1 << 20 };
+    // How long the client waits for the server to make room before giving up.
+    // The server never waits: what does not fit goes to the session outbox.
+    constexpr std::chrono::seconds WRITE_TIMEOUT{ 5 };
+    // AF_UNIX listener path, relative to the working directory of both sides.
+    std::string socketPath(const std::string& listeningPort);
+}
+
+// Control block at the start of each ring, shared between the two processes.
+struct RingHeader {
+    alignas(64) std::atomic<uint64_t> writePos;
+    alignas(64) std::atomic<uint64_t> readPos;
+    alignas(64) std::atomic<uint32_t> readerWaiting;
+};
+
+// Single-producer single-consumer byte ring over shared memory. Frames keep
+// the socket framing, so either side reads it exactly like a stream.
+class SharedRing {
+public:
+    SharedRing();
+    void attach(char* base, bool initialize);
+    size_t write(const char* bytes, size_t length);
+    size_t read(char* bytes, size_t length);
+    // Flags the reader as asleep; false if data arrived meanwhile (flag cleared).
+    bool prepareToWait();
+    void finishWait();
+    // Writer side: true if the reader asked to be woken.
+    bool takeWakeRequest();
+
+private:
+    RingHeader* header;
+    char* data;
+};
+
+// Shared-memory transport negotiated with "$shm" by clients on the local
+// listener. A pair of rings carries the frames; the connection's socket stays
+// open and only carries one-byte doorbells when the other side is asleep,
+// so the server can keep waiting for it in select().
+class SharedChannel {
+public:
+    static std::unique_ptr<SharedChannel> create(const std::string& name, SOCKET doorbell);
+    static std::unique_ptr<SharedChannel> open(const std::string& name, SOCKET doorbell);
+    // Server side of an existing channel, e.g. after a hot restart: the rings
+    // keep whatever is in flight.
+    static std::unique_ptr<SharedChannel> adopt(const std::string& name, SOCKET doorbell);
+    ~SharedChannel();
+    const std::string& name() const;
+    // Writes what the ring has room for and returns how much that was.
+    size_t write(const char* bytes, size_t length);
+    void send(const char* bytes, size_t length);
+    void receiveInto(std::string& buffer);
+    void receiveExact(char* bytes, size_t length);
+    bool prepareToWait();
+    void finishWait();
+
+private:
+    SharedChannel(const std::string& name, HANDLE mapping, char* view, bool creator, bool initialize, SOCKET doorbell);
+    static std::unique_ptr<SharedChannel> openExisting(const std::string& name, SOCKET doorbell, bool creator);
+    static size_t mappingSize();
+    std::string channelName;
+    HANDLE mapping;
+    char* view;
+    SharedRing outbound;
+    SharedRing inbound;
+    SOCKET doorbell;
+};
@@ -0,0 +1,659 @@
+#include "SimulatedNetwork.h"
+#include "Compression.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+    // Per thread, like WSAGetLastError().
+    thread_local int simulatedError = 0;
+
+    TimeSource::time_point::duration seconds(double value) {
+        return std::chrono::duration_cast<TimeSource::time_point::duration>(std::chrono::duration<double>(value));
+    }
+
+    const char STAMP_PREFIX[] = "[t:";
+    const char GREETING[] = "SERVER_SUCCESS";
+}
+
+SimulatedNetwork::SimulatedNetwork(uint64_t seed)
+    : simulatedEnvironment{ *this, *this, *this, false }, seed(seed), pipesCreated(0), clock(),
+    nextSocket(simulation::FIRST_SOCKET), nextStamp(0) {
+}
+
+SimulatedNetwork::~SimulatedNetwork() = default;
+
+Environment& SimulatedNetwork::environment() {
+    return simulatedEnvironment;
+}
+
+SOCKET SimulatedNetwork::allocateSocket() {
+    SOCKET socket = nextSocket;
+    nextSocket += simulation::SOCKET_STEP;
+    return socket;
+}
+
+std::shared_ptr<SimulatedNetwork::Pipe> SimulatedNetwork::makePipe(const LinkProfile& profile) {
+    auto pipe = std::make_shared<Pipe>();
+    pipe->profile = profile;
+    std::seed_seq sequence{ seed, ++pipesCreated };
+    pipe->random.seed(sequence);
+    pipe->lastRead = clock;
+    return pipe;
+}
+
+SimulatedNetwork::Endpoint* SimulatedNetwork::find(SOCKET socket) {
+    auto it = endpoints.find(socket);
+    return it == endpoints.end() ? nullptr : &it->second;
+}
+
+int SimulatedNetwork::fail(int error) {
+    simulatedError = error;
+    return SOCKET_ERROR;
+}
+
+// Serializes the bytes onto the wire behind what is already on it, then adds
+// latency, jitter and a retransmit timeout per loss.
+size_t SimulatedNetwork::transmit(Pipe& pipe, const char* bytes, size_t length) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const LinkProfile& profile = pipe.profile;
+    for (size_t offset = 0; offset < length; offset += simulation::SEGMENT_SIZE) {
+        size_t segmentLength = std::min(simulation::SEGMENT_SIZE, length - offset);
+        time_point departure = std::max(clock, pipe.wireFree);
+        if (profile.bytesPerSecond > 0) {
+            departure += seconds(segmentLength / profile.bytesPerSecond);
+        }
+        pipe.wireFree = departure;
+        time_point arrival = departure + profile.latency;
+        if (profile.jitter.count() > 0) {
+            arrival += seconds(unit(pipe.random) * std::chrono::duration<double>(profile.jitter).count());
+        }
+        while (profile.lossRate > 0 && unit(pipe.random) < profile.lossRate) {
+            arrival += profile.retransmitTimeout;
+        }
+        arrival = std::max(arrival, pipe.lastArrival);
+        pipe.lastArrival = arrival;
+        pipe.inFlight.push_back(Segment{ arrival, std::string(bytes + offset, segmentLength), false });
+        pipe.inFlightBytes += segmentLength;
+    }
+    return length;
+}
+
+// FIN travels behind the data like any segment.
+void SimulatedNetwork::finish(Endpoint& endpoint) {
+    if (endpoint.sendShut) {
+        return;
+    }
+    endpoint.sendShut = true;
+    Pipe& pipe = *endpoint.outgoing;
+    time_point arrival = std::max(std::max(clock, pipe.wireFree) + pipe.profile.latency, pipe.lastArrival);
+    pipe.lastArrival = arrival;
+    pipe.inFlight.push_back(Segment{ arrival, std::string(), true });
+}
+
+// True if anything arrived.
+bool SimulatedNetwork::deliver(Pipe& pipe) {
+    bool arrived = false;
+    while (!pipe.inFlight.empty() && pipe.inFlight.front().arrival <= clock) {
+        arrived = true;
+        Segment& segment = pipe.inFlight.front();
+        pipe.arrived += segment.bytes;
+        pipe.inFlightBytes -= segment.bytes.size();
+        pipe.finished = pipe.finished || segment.finish;
+        pipe.inFlight.pop_front();
+    }
+    return arrived;
+}
+
+// Watchers run after the sweep; they may open and close endpoints.
+void SimulatedNetwork::settle() {
+    std::vector<SOCKET> woken;
+    for (auto& endpoint : endpoints) {
+        if (endpoint.second.incoming != nullptr && deliver(*endpoint.second.incoming) && endpoint.second.onData) {
+            woken.push_back(endpoint.first);
+        }
+    }
+    for (SOCKET socket : woken) {
+        notify(socket);
+    }
+}
+
+void SimulatedNetwork::notify(SOCKET endpoint) {
+    Endpoint* target = find(endpoint);
+    if (target != nullptr && target->onData) {
+        std::function<void()> onData = target->onData;
+        onData();
+    }
+}
+
+void SimulatedNetwork::runDue() {
+    while (!actions.empty() && actions.begin()->first <= clock) {
+        std::function<void()> action = std::move(actions.begin()->second);
+        actions.erase(actions.begin());
+        action();
+    }
+}
+
+// The earliest thing strictly after now: a scheduled action, a segment
+// arriving or a connection reaching a listener.
+SimulatedNetwork::time_point SimulatedNetwork::nextEvent() const {
+    time_point next = time_point::max();
+    if (!actions.empty()) {
+        next = actions.begin()->first;
+    }
+    for (const auto& endpoint : endpoints) {
+        const auto& pipe = endpoint.second.incoming;
+        if (pipe != nullptr && !pipe->inFlight.empty()) {
+            next = std::min(next, pipe->inFlight.front().arrival);
+        }
+    }
+    for (const auto& listener : listeners) {
+        for (const auto& connection : listener.second.backlog) {
+            if (connection.arrival > clock) {
+                next = std::min(next, connection.arrival);
+            }
+        }
+    }
+    return next;
+}
+
+bool SimulatedNetwork::readable(SOCKET socket) {
+    Endpoint* endpoint = find(socket);
+    if (endpoint == nullptr) {
+        return false;
+    }
+    if (endpoint->listener) {
+        const auto& backlog = listeners[endpoint->port].backlog;
+        return std::any_of(backlog.begin(), backlog.end(), [this](const PendingConnection& connection) { return connection.arrival <= clock; });
+    }
+    Pipe& incoming = *endpoint->incoming;
+    deliver(incoming);
+    return !incoming.arrived.empty() || incoming.finished;
+}
+
+bool SimulatedNetwork::writable(SOCKET socket) {
+    Endpoint* endpoint = find(socket);
+    if (endpoint == nullptr || endpoint->listener) {
+        return false;
+    }
+    Pipe& outgoing = *endpoint->outgoing;
+    return outgoing.reset || outgoing.inFlightBytes + outgoing.arrived.size() < outgoing.profile.receiveWindow;
+}
+
+SimulatedNetwork::time_point SimulatedNetwork::now() const {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return clock;
+}
+
+SOCKET SimulatedNetwork::openListener(const char* port, bool) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (listeners.count(port) != 0) {
+        fail(WSAEADDRINUSE);
+        return INVALID_SOCKET;
+    }
+    SOCKET socket = allocateSocket();
+    Endpoint& endpoint = endpoints[socket];
+    endpoint.listener = true;
+    endpoint.port = port;
+    listeners[port] = Listener{ socket, {} };
+    return socket;
+}
+
+int SimulatedNetwork::listen(SOCKET listener, int backlog) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* endpoint = find(listener);
+    if (endpoint == nullptr || !endpoint->listener) {
+        return fail(WSAENOTSOCK);
+    }
+    listeners[endpoint->port].backlogLimit = backlog > 0 ? static_cast<size_t>(backlog) : simulation::MAX_BACKLOG;
+    return 0;
+}
+
+SOCKET SimulatedNetwork::accept(SOCKET listener, sockaddr* address, int* addressLength) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* endpoint = find(listener);
+    if (endpoint == nullptr || !endpoint->listener) {
+        fail(WSAENOTSOCK);
+        return INVALID_SOCKET;
+    }
+    auto& backlog = listeners[endpoint->port].backlog;
+    auto ready = std::find_if(backlog.begin(), backlog.end(), [this](const PendingConnection& connection) { return connection.arrival <= clock; });
+    if (ready == backlog.end()) {
+        fail(WSAEWOULDBLOCK);
+        return INVALID_SOCKET;
+    }
+    SOCKET socket = ready->serverSide;
+    backlog.erase(ready);
+    if (address != nullptr && addressLength != nullptr && *addressLength >= static_cast<int>(sizeof(sockaddr_in))) {
+        // A made-up but stable peer address, derived from the handle.
+        sockaddr_in peer{};
+        peer.sin_family = AF_INET;
+        peer.sin_addr.s_addr = htonl(0x0A010000u | static_cast<u_long>(socket & 0xFFFF));
+        peer.sin_port = htons(static_cast<unsigned short>(49152 + socket % 16384));
+        memcpy(address, &peer, sizeof(peer));
+        *addressLength = sizeof(peer);
+    }
+    return socket;
+}
+
+int SimulatedNetwork::send(SOCKET socket, const char* bytes, int length) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* endpoint = find(socket);
+    if (endpoint == nullptr || endpoint->listener) {
+        return fail(WSAENOTSOCK);
+    }
+    if (endpoint->sendShut) {
+        return fail(WSAESHUTDOWN);
+    }
+    Pipe& outgoing = *endpoint->outgoing;
+    if (outgoing.reset) {
+        return fail(WSAECONNRESET);
+    }
+    size_t used = outgoing.inFlightBytes + outgoing.arrived.size();
+    if (used >= outgoing.profile.receiveWindow) {
+        return fail(WSAEWOULDBLOCK);
+    }
+    size_t accepted = std::min(static_cast<size_t>(length), outgoing.profile.receiveWindow - used);
+    traceSend(bytes, accepted);
+    return static_cast<int>(transmit(outgoing, bytes, accepted));
+}
+
+int SimulatedNetwork::recv(SOCKET socket, char* bytes, int length) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* endpoint = find(socket);
+    if (endpoint == nullptr || endpoint->listener) {
+        return fail(WSAENOTSOCK);
+    }
+    Pipe& incoming = *endpoint->incoming;
+    deliver(incoming);
+    if (incoming.arrived.empty()) {
+        return incoming.finished ? 0 : fail(WSAEWOULDBLOCK);
+    }
+    size_t taken = std::min(static_cast<size_t>(length), incoming.arrived.size());
+    memcpy(bytes, incoming.arrived.data(), taken);
+    incoming.arrived.erase(0, taken);
+    return static_cast<int>(taken);
+}
+
+int SimulatedNetwork::pending(SOCKET socket, u_long& bytes) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* endpoint = find(socket);
+    if (endpoint == nullptr || endpoint->listener) {
+        return fail(WSAENOTSOCK);
+    }
+    deliver(*endpoint->incoming);
+    bytes = static_cast<u_long>(endpoint->incoming->arrived.size());
+    return 0;
+}
+
+int SimulatedNetwork::setNonBlocking(SOCKET socket) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return find(socket) == nullptr ? fail(WSAENOTSOCK) : 0;
+}
+
+// Segments are never held back, so there is nothing to turn off.
+int SimulatedNetwork::tuneForLatency(SOCKET socket) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return find(socket) == nullptr ? fail(WSAENOTSOCK) : 0;
+}
+
+int SimulatedNetwork::select(int, fd_set* readSet, fd_set* writeSet, const timeval* timeout) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    fd_set watchedReads;
+    fd_set watchedWrites;
+    FD_ZERO(&watchedReads);
+    FD_ZERO(&watchedWrites);
+    if (readSet != nullptr) {
+        watchedReads = *readSet;
+    }
+    if (writeSet != nullptr) {
+        watchedWrites = *writeSet;
+    }
+    time_point deadline = timeout == nullptr ? time_point::max()
+        : clock + std::chrono::seconds(timeout->tv_sec) + std::chrono::microseconds(timeout->tv_usec);
+
+    while (true) {
+        runDue();
+        settle();
+        std::vector<SOCKET> readyReads;
+        std::vector<SOCKET> readyWrites;
+        for (const auto& endpoint : endpoints) {
+            if (FD_ISSET(endpoint.first, &watchedReads) && readable(endpoint.first)) {
+                readyReads.push_back(endpoint.first);
+            }
+            if (FD_ISSET(endpoint.first, &watchedWrites) && writable(endpoint.first)) {
+                readyWrites.push_back(endpoint.first);
+            }
+        }
+        time_point next = std::min(nextEvent(), deadline);
+        if (!readyReads.empty() || !readyWrites.empty() || clock >= deadline || next == time_point::max()) {
+            if (readSet != nullptr) {
+                FD_ZERO(readSet);
+                for (SOCKET socket : readyReads) {
+                    FD_SET(socket, readSet);
+                }
+            }
+            if (writeSet != nullptr) {
+                FD_ZERO(writeSet);
+                for (SOCKET socket : readyWrites) {
+                    FD_SET(socket, writeSet);
+                }
+            }
+            return static_cast<int>(readyReads.size() + readyWrites.size());
+        }
+        clock = std::max(clock, next);
+    }
+}
+
+int SimulatedNetwork::shutdown(SOCKET socket, int how) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* endpoint = find(socket);
+    if (endpoint == nullptr || endpoint->listener) {
+        return fail(WSAENOTSOCK);
+    }
+    if (how == SD_SEND || how == SD_BOTH) {
+        finish(*endpoint);
+    }
+    return 0;
+}
+
+// A stream closes gracefully: queued bytes still arrive, then end-of-stream.
+// Whatever the peer sends afterwards is refused.
+int SimulatedNetwork::close(SOCKET socket) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* endpoint = find(socket);
+    if (endpoint == nullptr) {
+        return fail(WSAENOTSOCK);
+    }
+    if (endpoint->listener) {
+        std::string port = endpoint->port;
+        for (const auto& connection : listeners[port].backlog) {
+            close(connection.serverSide);
+        }
+        listeners.erase(port);
+    }
+    else {
+        finish(*endpoint);
+        endpoint->incoming->reset = true;
+    }
+    endpoints.erase(socket);
+    return 0;
+}
+
+int SimulatedNetwork::lastError() {
+    return simulatedError;
+}
+
+std::string SimulatedNetwork::hostAddress() {
+    return simulation::HOST_ADDRESS;
+}
+
+void SimulatedNetwork::announce(const std::string& hostAddress, const std::string& listeningPort) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    announcement = hostAddress + ":" + listeningPort;
+}
+
+// The connection reaches the listener one latency after it is made; bytes
+// written before it is accepted wait in the pipe. A full listen queue refuses
+// it at once, as a reset SYN would.
+SOCKET SimulatedNetwork::connect(const std::string& port, const LinkProfile& toServer, const LinkProfile& fromServer) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    auto listener = listeners.find(port);
+    if (listener == listeners.end() || listener->second.backlog.size() >= listener->second.backlogLimit) {
+        fail(WSAECONNREFUSED);
+        return INVALID_SOCKET;
+    }
+    std::shared_ptr<Pipe> upstream = makePipe(toServer);
+    std::shared_ptr<Pipe> downstream = makePipe(fromServer);
+    SOCKET clientSide = allocateSocket();
+    SOCKET serverSide = allocateSocket();
+    Endpoint& client = endpoints[clientSide];
+    client.incoming = downstream;
+    client.outgoing = upstream;
+    Endpoint& server = endpoints[serverSide];
+    server.incoming = upstream;
+    server.outgoing = downstream;
+    listener->second.backlog.push_back(PendingConnection{ clock + toServer.latency, serverSide });
+    return clientSide;
+}
+
+void SimulatedNetwork::at(time_point when, std::function<void()> action) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    actions.emplace(when, std::move(action));
+}
+
+void SimulatedNetwork::after(std::chrono::microseconds delay, std::function<void()> action) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    actions.emplace(clock + delay, std::move(action));
+}
+
+// Harness endpoints behave like a blocking client: a write is never refused
+// for lack of window, it just queues on the wire.
+bool SimulatedNetwork::write(SOCKET endpoint, const std::string& bytes) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* source = find(endpoint);
+    if (source == nullptr || source->sendShut || source->outgoing->reset) {
+        return false;
+    }
+    transmit(*source->outgoing, bytes.data(), bytes.size());
+    return true;
+}
+
+std::string SimulatedNetwork::read(SOCKET endpoint) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* destination = find(endpoint);
+    if (destination == nullptr) {
+        return std::string();
+    }
+    Pipe& incoming = *destination->incoming;
+    deliver(incoming);
+    size_t taken = incoming.arrived.size();
+    if (incoming.profile.readBytesPerSecond > 0) {
+        std::chrono::duration<double> elapsed = clock - incoming.lastRead;
+        incoming.readBudget = std::min(incoming.readBudget + elapsed.count() * incoming.profile.readBytesPerSecond,
+            static_cast<double>(incoming.profile.receiveWindow));
+        taken = std::min(taken, static_cast<size_t>(incoming.readBudget));
+        incoming.readBudget -= taken;
+        if (taken < incoming.arrived.size() && destination->onData && !incoming.readRetryScheduled) {
+            // Wake the reader once it can take the rest.
+            double wait = (incoming.arrived.size() - taken - incoming.readBudget) / incoming.profile.readBytesPerSecond;
+            incoming.readRetryScheduled = true;
+            Pipe* retried = &incoming;
+            actions.emplace(clock + std::max(seconds(wait), time_point::duration(1)), [this, endpoint, retried] {
+                if (find(endpoint) != nullptr) {
+                    retried->readRetryScheduled = false;
+                    notify(endpoint);
+                }
+            });
+        }
+    }
+    incoming.lastRead = clock;
+    std::string bytes = incoming.arrived.substr(0, taken);
+    incoming.arrived.erase(0, taken);
+    return bytes;
+}
+
+void SimulatedNetwork::watch(SOCKET endpoint, std::function<void()> onData) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* target = find(endpoint);
+    if (target != nullptr) {
+        target->onData = std::move(onData);
+    }
+}
+
+bool SimulatedNetwork::peerClosed(SOCKET endpoint) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Endpoint* destination = find(endpoint);
+    if (destination == nullptr) {
+        return true;
+    }
+    deliver(*destination->incoming);
+    return destination->incoming->finished && destination->incoming->arrived.empty();
+}
+
+void SimulatedNetwork::advanceTo(time_point until) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    while (true) {
+        runDue();
+        settle();
+        time_point next = nextEvent();
+        if (next > until) {
+            break;
+        }
+        clock = std::max(clock, next);
+    }
+    clock = std::max(clock, until);
+    runDue();
+    settle();
+}
+
+// Called with the lock held, from whichever thread sends.
+void SimulatedNetwork::traceSend(const char* bytes, size_t length) {
+    if (stamps.empty()) {
+        return;
+    }
+    std::string_view sent(bytes, length);
+    size_t position = sent.find(STAMP_PREFIX);
+    if (position == std::string_view::npos) {
+        return;
+    }
+    size_t start = position + sizeof(STAMP_PREFIX) - 1;
+    size_t end = sent.find(']', start);
+    uint64_t id = 0;
+    if (end == std::string_view::npos || std::from_chars(sent.data() + start, sent.data() + end, id).ec != std::errc()) {
+        return;
+    }
+    auto wall = std::chrono::steady_clock::now();
+    auto span = sendSpans.try_emplace(id, wall, wall);
+    span.first->second.second = wall;
+}
+
+std::string SimulatedNetwork::stamp() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    uint64_t id = nextStamp++;
+    stamps[id] = clock;
+    return STAMP_PREFIX + std::to_string(id) + "]";
+}
+
+// Every delivery of a stamped message counts, so one broadcast yields one
+// sample per recipient.
+void SimulatedNetwork::observe(const std::string& frame) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    size_t position = frame.find(STAMP_PREFIX);
+    while (position != std::string::npos) {
+        size_t start = position + sizeof(STAMP_PREFIX) - 1;
+        size_t end = frame.find(']', start);
+        if (end == std::string::npos) {
+            break;
+        }
+        try {
+            auto sent = stamps.find(std::stoull(frame.substr(start, end - start)));
+            if (sent != stamps.end()) {
+                deliveryLatency.record(std::chrono::duration_cast<std::chrono::microseconds>(clock - sent->second));
+            }
+        }
+        catch (const std::exception&) {
+            // Not a stamp, just text that looks like one.
+        }
+        position = frame.find(STAMP_PREFIX, end);
+    }
+}
+
+LatencyHistogram& SimulatedNetwork::latencies() {
+    return deliveryLatency;
+}
+
+std::string SimulatedNetwork::latencyReport() const {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return "LATENCY seed=" + std::to_string(seed) + " " + deliveryLatency.report();
+}
+
+LatencyHistogram SimulatedNetwork::fanoutSpread() const {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    LatencyHistogram spread;
+    for (const auto& span : sendSpans) {
+        spread.record(std::chrono::duration_cast<std::chrono::microseconds>(span.second.second - span.second.first));
+    }
+    return spread;
+}
+
+SimulatedClient::SimulatedClient(SimulatedNetwork& network, const std::string& port, const LinkProfile& toServer, const LinkProfile& fromServer)
+    : network(network), socket(network.connect(port, toServer, fromServer)), greeted(false) {
+    if (socket == INVALID_SOCKET) {
+        throw std::runtime_error("Simulated port " + port + " refused the connection");
+    }
+    network.watch(socket, [this] { drain(); });
+}
+
+void SimulatedClient::sendFrame(const std::string& notification) {
+    uint32_t SizeOfMsg = static_cast<uint32_t>(notification.size());
+    std::string frame(sizeof(SizeOfMsg), '\0');
+    memcpy(&frame[0], &SizeOfMsg, sizeof(SizeOfMsg));
+    network.write(socket, frame + notification);
+}
+
+void SimulatedClient::sendTimed(const std::string& text) {
+    sendFrame(text + " " + network.stamp());
+}
+
+// The server greets with a raw "SERVER_SUCCESS\0"; a full server answers with
+// a framed "SERVER_LIMIT_REACHED" instead, and a busy one "SERVER_BUSY <ms>". Frames are never compressed, since
+// the harness registers without a codec. "$register" is answered with a raw
+// "SERVER_SUCCESS" too, without a length prefix; read as one it would announce
+// far more than MAX_FRAME_SIZE, so the two cannot be confused.
+void SimulatedClient::drain() {
+    input += network.read(socket);
+    if (!greeted && input.size() >= sizeof(GREETING)) {
+        if (input.compare(0, sizeof(GREETING), GREETING, sizeof(GREETING)) == 0) {
+            input.erase(0, sizeof(GREETING));
+        }
+        greeted = true;
+    }
+    uint32_t SizeOfMsg = 0;
+    while (greeted && input.size() >= sizeof(SizeOfMsg)) {
+        if (input.compare(0, sizeof(SizeOfMsg), GREETING, sizeof(SizeOfMsg)) == 0) {
+            if (input.size() < sizeof(GREETING) - 1) {
+                break;
+            }
+            received.push_back(input.substr(0, sizeof(GREETING) - 1));
+            input.erase(0, sizeof(GREETING) - 1);
+            continue;
+        }
+        memcpy(&SizeOfMsg, input.data(), sizeof(SizeOfMsg));
+        SizeOfMsg &= ~compression::COMPRESSED_FLAG;
+        if (input.size() < sizeof(SizeOfMsg) + SizeOfMsg) {
+            break;
+        }
+        received.push_back(input.substr(sizeof(SizeOfMsg), SizeOfMsg));
+        input.erase(0, sizeof(SizeOfMsg) + SizeOfMsg);
+        network.observe(received.back());
+        if (received.back().find("SERVER_BUSY ") == 0) {
+            deferredFor = std::chrono::milliseconds(std::stoll(received.back().substr(12)));
+        }
+    }
+}
+
+std::chrono::milliseconds SimulatedClient::retryAfter() const {
+    return deferredFor;
+}
+
+std::vector<std::string> SimulatedClient::receiveFrames() {
+    drain();
+    std::vector<std::string> frames;
+    frames.swap(received);
+    return frames;
+}
+
+bool SimulatedClient::disconnected() {
+    return network.peerClosed(socket) && input.empty();
+}
+
+void SimulatedClient::disconnect() {
+    network.close(socket);
+}
+
+SOCKET SimulatedClient::endpoint() const {
+    return socket;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "Environment.h"
+#include "LatencyHistogram.h"
+
+namespace simulation {
+    constexpr uint64_t DEFAULT_SEED{ 1 };
+    // Simulated handles are numbered like Winsock's, well clear of zero.
+    constexpr SOCKET FIRST_SOCKET{ 1000 };
+    constexpr SOCKET SOCKET_STEP{ 4 };
+    // Sends are cut into segments of this size; loss is decided per segment.
+    constexpr size_t SEGMENT_SIZE{ 1460 };
+    constexpr const char* HOST_ADDRESS{ "10.0.0.1" };
+    // Listen queue length for listen(socket, 0); connections beyond it are refused.
+    constexpr size_t MAX_BACKLOG{ 200 };
+}
+
+// One direction of a simulated connection.
+struct LinkProfile {
+    std::chrono::microseconds latency{ 200 };
+    // Added to each segment's latency, uniform in [0, jitter]. Segments are
+    // still delivered in order, as TCP would.
+    std::chrono::microseconds jitter{ 0 };
+    // Wire rate; 0 for unlimited.
+    double bytesPerSecond = 0;
+    // Chance that a segment is lost. A lost segment arrives one retransmit
+    // timeout later, and holds back everything behind it.
+    double lossRate = 0;
+    std::chrono::microseconds retransmitTimeout{ 200000 };
+    // Bytes in flight plus unread before send() reports WSAEWOULDBLOCK.
+    size_t receiveWindow = 64 * 1024;
+    // How fast the receiving application reads; 0 reads whatever arrived.
+    // Only used for harness endpoints, the server reads as fast as it can.
+    double readBytesPerSecond = 0;
+};
+
+// An in-process network with a virtual clock, standing in for Winsock, the
+// steady clock and discovery at once. The server runs on it unchanged; the
+// harness drives the other end of each connection through SimulatedClient.
+//
+// Time only moves inside select(): when nothing the server waits for is
+// ready, the clock jumps to the next delivery, accept or scheduled harness
+// action, or to the end of the timeout. A run is therefore a pure function of
+// the seed, the link profiles and the schedule, and an hour of traffic takes
+// as long as the work the server does in it.
+class SimulatedNetwork : public SocketLayer, public TimeSource, public Discovery {
+public:
+    explicit SimulatedNetwork(uint64_t seed = simulation::DEFAULT_SEED);
+    ~SimulatedNetwork() override;
+    // An Environment for Server with host-bound services turned off.
+    Environment& environment();
+
+    // Harness side.
+    SOCKET connect(const std::string& port, const LinkProfile& toServer, const LinkProfile& fromServer);
+    void at(time_point when, std::function<void()> action);
+    void after(std::chrono::microseconds delay, std::function<void()> action);
+    // Send and receive for harness endpoints; read honours the slow-reader rate.
+    bool write(SOCKET endpoint, const std::string& bytes);
+    std::string read(SOCKET endpoint);
+    // Called, in virtual time, whenever bytes reach the endpoint and whenever
+    // a slow reader may read again, so arrivals are timed when they happen
+    // rather than when the harness next looks.
+    void watch(SOCKET endpoint, std::function<void()> onData);
+    bool peerClosed(SOCKET endpoint);
+    // Runs scheduled actions and deliveries without a server, up to `until`.
+    void advanceTo(time_point until);
+    // Marks a message as sent now; the returned tag, placed in the message,
+    // lets observe() time each delivery of it.
+    std::string stamp();
+    void observe(const std::string& frame);
+    LatencyHistogram& latencies();
+    std::string latencyReport() const;
+    // Wall-clock time from the server's first send of each stamped message to
+    // its last: how long fan-out takes to reach the final recipient. Virtual
+    // time cannot show this, since the server's own work takes none of it.
+    LatencyHistogram fanoutSpread() const;
+
+    // TimeSource
+    time_point now() const override;
+
+    // SocketLayer
+    SOCKET openListener(const char* port, bool registeredIo) override;
+    int listen(SOCKET listener, int backlog) override;
+    SOCKET accept(SOCKET listener, sockaddr* address, int* addressLength) override;
+    int send(SOCKET socket, const char* bytes, int length) override;
+    int recv(SOCKET socket, char* bytes, int length) override;
+    int pending(SOCKET socket, u_long& bytes) override;
+    int setNonBlocking(SOCKET socket) override;
+    int tuneForLatency(SOCKET socket) override;
+    int select(int highestSocket, fd_set* readSet, fd_set* writeSet, const timeval* timeout) override;
+    int shutdown(SOCKET socket, int how) override;
+    int close(SOCKET socket) override;
+    int lastError() override;
+
+    // Discovery
+    std::string hostAddress() override;
+    void announce(const std::string& hostAddress, const std::string& listeningPort) override;
+
+private:
+    struct Segment {
+        time_point arrival;
+        std::string bytes;
+        bool finish;
+    };
+    // Bytes travelling one way. Each pipe has its own generator, seeded from
+    // the network seed and its number, so fan-out threads writing different
+    // sockets cannot change each other's draws.
+    struct Pipe {
+        LinkProfile profile;
+        std::mt19937_64 random;
+        std::deque<Segment> inFlight;
+        size_t inFlightBytes = 0;
+        std::string arrived;
+        time_point wireFree{};
+        time_point lastArrival{};
+        bool finished = false;
+        bool reset = false;
+        double readBudget = 0;
+        time_point lastRead{};
+        bool readRetryScheduled = false;
+    };
+    struct Endpoint {
+        bool listener = false;
+        std::string port;
+        std::shared_ptr<Pipe> incoming;
+        std::shared_ptr<Pipe> outgoing;
+        bool sendShut = false;
+        std::function<void()> onData;
+    };
+    struct PendingConnection {
+        time_point arrival;
+        SOCKET serverSide;
+    };
+    // Connections are refused until listen() sets a backlog limit.
+    struct Listener {
+        SOCKET socket;
+        std::deque<PendingConnection> backlog;
+        size_t backlogLimit = 0;
+    };
+
+    SOCKET allocateSocket();
+    std::shared_ptr<Pipe> makePipe(const LinkProfile& profile);
+    Endpoint* find(SOCKET socket);
+    int fail(int error);
+    size_t transmit(Pipe& pipe, const char* bytes, size_t length);
+    void finish(Endpoint& endpoint);
+    bool deliver(Pipe& pipe);
+    void notify(SOCKET endpoint);
+    bool readable(SOCKET socket);
+    bool writable(SOCKET socket);
+    time_point nextEvent() const;
+    void runDue();
+    void settle();
+    void traceSend(const char* bytes, size_t length);
+
+    Environment simulatedEnvironment;
+    mutable std::recursive_mutex mutex;
+    uint64_t seed;
+    uint64_t pipesCreated;
+    time_point clock;
+    SOCKET nextSocket;
+    std::map<SOCKET, Endpoint> endpoints;
+    std::map<std::string, Listener> listeners;
+    std::multimap<time_point, std::function<void()>> actions;
+    std::map<uint64_t, time_point> stamps;
+    std::map<uint64_t, std::pair<std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point>> sendSpans;
+    uint64_t nextStamp;
+    LatencyHistogram deliveryLatency;
+    std::string announcement;
+};
+
+// The far end of one simulated connection, speaking the chat protocol the way
+// Client does: length-prefixed frames, "SERVER_SUCCESS" greeting, "$register".
+class SimulatedClient {
+public:
+    SimulatedClient(SimulatedNetwork& network, const std::string& port, const LinkProfile& toServer, const LinkProfile& fromServer);
+    SimulatedClient(const SimulatedClient&) = delete;
+    SimulatedClient& operator=(const SimulatedClient&) = delete;
+    void sendFrame(const std::string& notification);
+    // A chat line carrying a delivery stamp.
+    void sendTimed(const std::string& text);
+    // Frames received since the last call; each was passed to observe() on
+    // arrival.
+    std::vector<std::string> receiveFrames();
+    bool disconnected();
+    void disconnect();
+    SOCKET endpoint() const;
+    // The hint of a "SERVER_BUSY <ms>" refusal; 0 while not refused. A storm
+    // harness reconnects after it and times how long until everyone is in.
+    std::chrono::milliseconds retryAfter() const;
+
+private:
+    void drain();
+    SimulatedNetwork& network;
+    SOCKET socket;
+    std::string input;
+    bool greeted;
+    std::vector<std::string> received;
+    std::chrono::milliseconds deferredFor{ 0 };
+};
@@ -0,0 +1,340 @@
+#include "Simulation.h"
+#include "Server.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <windows.h>
+
+namespace {
+    // A LAN with some jitter and the odd lost segment.
+    LinkProfile chatLink() {
+        LinkProfile link;
+        link.latency = std::chrono::microseconds(2000);
+        link.jitter = std::chrono::microseconds(1000);
+        link.bytesPerSecond = 12.5 * 1024 * 1024;
+        link.lossRate = 0.001;
+        return link;
+    }
+
+    // Writes `megabytes` of fixed-length chat lines and the matching index, in
+    // the format ChatLog leaves behind, without going through the server.
+    void writeHistory(const StoragePaths& storage, uint64_t megabytes) {
+        const uint64_t lines = megabytes * 1024 * 1024 / scenario::STARTUP_LINE_LENGTH;
+        // 2026-01-01, the date written into every line.
+        const uint32_t timestamp = 1767225600;
+        std::ofstream log(storage.chatLog, std::ios::binary);
+        std::ofstream index(storage.chatLog + ".idx", std::ios::binary);
+        std::string chunk;
+        std::vector<LogIndexRecord> records;
+        for (uint64_t sequence = 1; sequence <= lines; sequence++) {
+            std::string line = "[2026-01-01 00:00:00] sim (10.0.0.1): history line " + std::to_string(sequence) + " ";
+            line.resize(scenario::STARTUP_LINE_LENGTH - 1, 'x');
+            line += "\n";
+            records.push_back(LogIndexRecord{ (sequence - 1) * scenario::STARTUP_LINE_LENGTH,
+                static_cast<uint32_t>(scenario::STARTUP_LINE_LENGTH), timestamp });
+            chunk += line;
+            if (records.size() == 8192 || sequence == lines) {
+                log.write(chunk.data(), chunk.size());
+                index.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(LogIndexRecord));
+                chunk.clear();
+                records.clear();
+            }
+        }
+        if (!log.good() || !index.good()) {
+            throw std::runtime_error("Could not write " + std::to_string(megabytes) + " MB of history to " + storage.chatLog);
+        }
+    }
+
+    // Wall-clock time from constructing the server until it listens.
+    std::chrono::milliseconds timeStartup(SimulatedNetwork& network) {
+        auto begin = std::chrono::steady_clock::now();
+        Server server(scenario::CHAT_CLIENTS, scenario::PORT, io::SELECT, false, network.environment());
+        server.start();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    }
+}
+
+ScenarioDirectory::ScenarioDirectory(uint64_t seed) {
+    std::filesystem::path directory = std::filesystem::temp_directory_path() /
+        ("chat-simulation-" + std::to_string(GetCurrentProcessId()) + "-" + std::to_string(seed));
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    path = directory.string();
+}
+
+ScenarioDirectory::~ScenarioDirectory() {
+    std::error_code error;
+    std::filesystem::remove_all(path, error);
+}
+
+StoragePaths ScenarioDirectory::storage() const {
+    std::filesystem::path directory(path);
+    StoragePaths paths;
+    paths.chatLog = (directory / storage::CHAT_LOG).string();
+    paths.attachments = (directory / storage::ATTACHMENTS).string();
+    paths.diagnostics = (directory / "diagnostics.log").string();
+    return paths;
+}
+
+void runChatScenario(uint64_t seed) {
+    ScenarioDirectory directory(seed);
+    SimulatedNetwork network(seed);
+    network.environment().storage = directory.storage();
+    LinkProfile link = chatLink();
+    std::vector<std::unique_ptr<SimulatedClient>> clients;
+    uint64_t sent = 0;
+    {
+        Server server(scenario::CHAT_CLIENTS, scenario::PORT, io::SELECT, false, network.environment());
+        // Every session is admitted at once; admission has a scenario of its own.
+        server.configureAdmission(admission::DEFAULT_BACKLOG, 0);
+        server.start();
+
+        auto end = network.now() + scenario::CHAT_DURATION;
+        // Talkers start at seeded offsets so their messages do not line up.
+        std::mt19937_64 random(seed);
+        std::uniform_int_distribution<long long> offset(0, scenario::CHAT_INTERVAL.count() - 1);
+        std::function<void(size_t)> talk = [&](size_t index) {
+            if (network.now() >= end) {
+                return;
+            }
+            clients[index]->sendTimed("$chat hello from " + std::to_string(index));
+            clients[index]->receiveFrames();
+            sent++;
+            network.after(scenario::CHAT_INTERVAL, [&talk, index] { talk(index); });
+        };
+        for (int i = 0; i < scenario::CHAT_CLIENTS; i++) {
+            auto start = std::chrono::milliseconds(offset(random));
+            network.after(scenario::CONNECT_SPACING * i, [&, i, start] {
+                clients.push_back(std::make_unique<SimulatedClient>(network, scenario::PORT, link, link));
+                clients.back()->sendFrame("$register sim" + std::to_string(i));
+                size_t index = clients.size() - 1;
+                network.after(scenario::CONNECT_SPACING * scenario::CHAT_CLIENTS + start, [&talk, index] { talk(index); });
+            });
+        }
+        while (network.now() < end) {
+            server.runOnce();
+        }
+    }
+    std::cout << "SCENARIO chat clients=" << clients.size() << " messages=" << sent << "\n"
+        << network.latencyReport() << std::endl;
+}
+
+void runStormScenario(uint64_t seed) {
+    ScenarioDirectory directory(seed);
+    SimulatedNetwork network(seed);
+    network.environment().storage = directory.storage();
+    LinkProfile link = chatLink();
+    struct Session {
+        std::unique_ptr<SimulatedClient> client;
+        SimulatedNetwork::time_point firstAttempt{};
+        int attempts = 0;
+        bool admitted = false;
+    };
+    std::vector<Session> sessions(scenario::STORM_CLIENTS);
+    LatencyHistogram timeToAdmit;
+    int admitted = 0;
+    int deferred = 0;
+    int refused = 0;
+    SimulatedNetwork::time_point stormStart = network.now();
+    SimulatedNetwork::time_point recovered{};
+    {
+        Server server(scenario::STORM_CLIENTS, scenario::PORT, io::SELECT, false, network.environment());
+        server.configureAdmission(admission::DEFAULT_BACKLOG, admission::SESSIONS_PER_SECOND);
+        server.start();
+
+        std::mt19937_64 random(seed);
+        std::uniform_real_distribution<double> backoff(0.5, 1.5);
+        std::function<void(size_t)> connect;
+        std::function<void(size_t)> poll = [&](size_t index) {
+            Session& session = sessions[index];
+            for (const std::string& frame : session.client->receiveFrames()) {
+                if (frame == "SERVER_SUCCESS") {
+                    session.admitted = true;
+                    admitted++;
+                    recovered = network.now();
+                    timeToAdmit.record(std::chrono::duration_cast<std::chrono::microseconds>(recovered - session.firstAttempt));
+                    return;
+                }
+            }
+            if (session.client->retryAfter().count() > 0) {
+                deferred++;
+                session.client->disconnect();
+                network.after(session.client->retryAfter(), [&connect, index] { connect(index); });
+            }
+            else if (session.client->disconnected()) {
+                refused++;
+                session.client->disconnect();
+                network.after(std::chrono::duration_cast<std::chrono::microseconds>(scenario::RECONNECT_BACKOFF * backoff(random)),
+                    [&connect, index] { connect(index); });
+            }
+            else {
+                network.after(scenario::STORM_POLL, [&poll, index] { poll(index); });
+            }
+        };
+        connect = [&](size_t index) {
+            Session& session = sessions[index];
+            if (session.attempts++ == 0) {
+                session.firstAttempt = network.now();
+            }
+            try {
+                session.client = std::make_unique<SimulatedClient>(network, scenario::PORT, link, link);
+            }
+            catch (const std::exception&) {
+                // The listen queue is full.
+                refused++;
+                network.after(std::chrono::duration_cast<std::chrono::microseconds>(scenario::RECONNECT_BACKOFF * backoff(random)),
+                    [&connect, index] { connect(index); });
+                return;
+            }
+            session.client->sendFrame("$register storm" + std::to_string(index));
+            network.after(scenario::STORM_POLL, [&poll, index] { poll(index); });
+        };
+        std::uniform_int_distribution<long long> spread(0, std::chrono::microseconds(scenario::STORM_SPREAD).count() - 1);
+        for (size_t i = 0; i < sessions.size(); i++) {
+            network.after(std::chrono::microseconds(spread(random)), [&connect, i] { connect(i); });
+        }
+        auto deadline = stormStart + scenario::STORM_DEADLINE;
+        while (admitted < scenario::STORM_CLIENTS && network.now() < deadline) {
+            server.runOnce();
+        }
+    }
+    int attempts = 0;
+    for (const Session& session : sessions) {
+        attempts += session.attempts;
+    }
+    std::cout << "SCENARIO storm seed=" << seed << " clients=" << sessions.size() << " admitted=" << admitted
+        << " attempts=" << attempts << " deferred=" << deferred << " refused=" << refused << "\n";
+    if (admitted == scenario::STORM_CLIENTS) {
+        std::cout << "RECOVERY recovery_ms="
+            << std::chrono::duration_cast<std::chrono::milliseconds>(recovered - stormStart).count() << "\n";
+    }
+    else {
+        std::cout << "RECOVERY incomplete after " << scenario::STORM_DEADLINE.count() << "s\n";
+    }
+    std::cout << "ADMISSION " << timeToAdmit.report() << std::endl;
+}
+
+void runFanoutScenario(uint64_t seed) {
+    // A clean link, so the spread is the server's work and not the network's.
+    LinkProfile link;
+    for (int recipients : scenario::FANOUT_RECIPIENTS) {
+        ScenarioDirectory directory(seed);
+        SimulatedNetwork network(seed);
+        network.environment().storage = directory.storage();
+        std::vector<std::unique_ptr<SimulatedClient>> listeners;
+        std::unique_ptr<SimulatedClient> sender;
+        int sent = 0;
+        {
+            Server server(recipients + 1, scenario::PORT, io::SELECT, false, network.environment());
+            server.configureAdmission(admission::DEFAULT_BACKLOG, 0);
+            server.start();
+
+            for (int i = 0; i < recipients; i++) {
+                network.after(scenario::BULK_CONNECT_SPACING * i, [&, i] {
+                    listeners.push_back(std::make_unique<SimulatedClient>(network, scenario::PORT, link, link));
+                    listeners.back()->sendFrame("$register fan" + std::to_string(i));
+                });
+            }
+            std::function<void()> talk = [&] {
+                sender->sendTimed("$chat fan-out " + std::to_string(sent));
+                sender->receiveFrames();
+                // Listeners only collect; keep them from growing without bound.
+                for (auto& listener : listeners) {
+                    listener->receiveFrames();
+                }
+                if (++sent < scenario::FANOUT_MESSAGES) {
+                    network.after(scenario::FANOUT_INTERVAL, talk);
+                }
+            };
+            auto ready = scenario::BULK_CONNECT_SPACING * recipients + scenario::FANOUT_INTERVAL;
+            network.after(ready, [&] {
+                sender = std::make_unique<SimulatedClient>(network, scenario::PORT, link, link);
+                sender->sendFrame("$register sender");
+                network.after(scenario::FANOUT_INTERVAL, talk);
+            });
+            auto end = network.now() + ready + scenario::FANOUT_INTERVAL * (scenario::FANOUT_MESSAGES + 2);
+            while (network.now() < end) {
+                server.runOnce();
+            }
+        }
+        LatencyHistogram spread = network.fanoutSpread();
+        std::cout << "FANOUT recipients=" << recipients << " messages=" << sent << " spread " << spread.report() << std::endl;
+    }
+}
+
+void runStartupScenario(uint64_t seed) {
+    for (uint64_t megabytes : scenario::STARTUP_LOG_MEGABYTES) {
+        ScenarioDirectory directory(seed);
+        StoragePaths storage = directory.storage();
+        writeHistory(storage, megabytes);
+        std::chrono::milliseconds indexed;
+        std::chrono::milliseconds rebuilt;
+        {
+            SimulatedNetwork network(seed);
+            network.environment().storage = storage;
+            indexed = timeStartup(network);
+        }
+        std::filesystem::remove(storage.chatLog + ".idx");
+        {
+            SimulatedNetwork network(seed);
+            network.environment().storage = storage;
+            rebuilt = timeStartup(network);
+        }
+        std::cout << "STARTUP log_mb=" << megabytes << " indexed_ms=" << indexed.count()
+            << " rebuild_ms=" << rebuilt.count() << std::endl;
+    }
+}
+
+void runIdleScenario(uint64_t seed) {
+    ScenarioDirectory directory(seed);
+    SimulatedNetwork network(seed);
+    network.environment().storage = directory.storage();
+    LinkProfile link;
+    std::vector<std::unique_ptr<SimulatedClient>> sessions;
+    std::unique_ptr<SimulatedClient> probe;
+    std::string metrics;
+    {
+        Server server(scenario::IDLE_CLIENTS + 1, scenario::PORT, io::SELECT, false, network.environment());
+        server.configureAdmission(admission::DEFAULT_BACKLOG, 0);
+        server.start();
+
+        for (int i = 0; i < scenario::IDLE_CLIENTS; i++) {
+            network.after(scenario::BULK_CONNECT_SPACING * i, [&, i] {
+                sessions.push_back(std::make_unique<SimulatedClient>(network, scenario::PORT, link, link));
+                sessions.back()->sendFrame("$register idle" + std::to_string(i));
+            });
+        }
+        auto settled = scenario::BULK_CONNECT_SPACING * scenario::IDLE_CLIENTS + scenario::IDLE_SETTLE;
+        network.after(settled, [&] {
+            for (auto& session : sessions) {
+                session->receiveFrames();
+            }
+            probe = std::make_unique<SimulatedClient>(network, scenario::PORT, link, link);
+            probe->sendFrame("$register probe");
+            probe->sendFrame("$metrics");
+        });
+        auto end = network.now() + settled + std::chrono::seconds(1);
+        while (network.now() < end) {
+            server.runOnce();
+        }
+        for (const std::string& frame : probe->receiveFrames()) {
+            if (frame.find("METRICS") == 0) {
+                metrics = frame;
+            }
+        }
+    }
+    size_t used = metrics.find("memory_used=");
+    if (used == std::string::npos) {
+        throw std::runtime_error("The probe session got no $metrics reply");
+    }
+    uint64_t budgeted = std::strtoull(metrics.c_str() + used + 12, nullptr, 10);
+    std::cout << "IDLE sessions=" << sessions.size() << " budget_bytes=" << budgeted
+        << " budget_bytes_per_session=" << budgeted / (sessions.size() + 1)
+        << " session_object_bytes=" << sizeof(Client) << std::endl;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include "SimulatedNetwork.h"
+
+namespace scenario {
+    constexpr const char* PORT{ "5000" };
+    constexpr int CHAT_CLIENTS{ 50 };
+    // Sessions connect this far apart, then talk until the run ends.
+    constexpr std::chrono::milliseconds CONNECT_SPACING{ 20 };
+    constexpr std::chrono::milliseconds CHAT_INTERVAL{ 500 };
+    constexpr std::chrono::seconds CHAT_DURATION{ 60 };
+    // Sessions reconnecting at once, as after a restart, spread over STORM_SPREAD.
+    constexpr int STORM_CLIENTS{ 1000 };
+    constexpr std::chrono::milliseconds STORM_SPREAD{ 100 };
+    // Wait before trying again after a refused connect, scaled by a seeded
+    // factor in [0.5, 1.5) so the retries do not arrive together.
+    constexpr std::chrono::milliseconds RECONNECT_BACKOFF{ 250 };
+    // How often a connecting session checks for its answer; recovery time is
+    // measured to this resolution.
+    constexpr std::chrono::milliseconds STORM_POLL{ 5 };
+    // Gives up on recovery after this long.
+    constexpr std::chrono::seconds STORM_DEADLINE{ 120 };
+    // Recipient counts for the fan-out runs, either side of
+    // fanout::PARALLEL_THRESHOLD, and the broadcasts timed at each.
+    constexpr std::array<int, 4> FANOUT_RECIPIENTS{ 100, 500, 1000, 10000 };
+    constexpr int FANOUT_MESSAGES{ 50 };
+    // Thousands of sessions connect this far apart, so the listen backlog
+    // never overflows.
+    constexpr std::chrono::microseconds BULK_CONNECT_SPACING{ 200 };
+    // Inside the chat bucket's sustained rate.
+    constexpr std::chrono::milliseconds FANOUT_INTERVAL{ 150 };
+    // History sizes the startup runs boot over. 50 GB needs a disk set aside
+    // for it; the trend from 1 MB to 1 GB shows whether boot depends on size.
+    constexpr std::array<uint64_t, 4> STARTUP_LOG_MEGABYTES{ 1, 10, 100, 1000 };
+    // Length of each generated log line, newline included.
+    constexpr size_t STARTUP_LINE_LENGTH{ 128 };
+    // Idle sessions held open, short of capacity::MAX_CLIENTS, and how long
+    // they sit before the server's memory is read.
+    constexpr int IDLE_CLIENTS{ 10000 };
+    constexpr std::chrono::seconds IDLE_SETTLE{ 5 };
+}
+
+// A fresh directory for one run's chat log, attachments and diagnostics,
+// removed again when the run ends, so runs never see each other's history.
+class ScenarioDirectory {
+public:
+    explicit ScenarioDirectory(uint64_t seed);
+    ~ScenarioDirectory();
+    ScenarioDirectory(const ScenarioDirectory&) = delete;
+    ScenarioDirectory& operator=(const ScenarioDirectory&) = delete;
+    StoragePaths storage() const;
+
+private:
+    std::string path;
+};
+
+// Runs the server on a simulated network with CHAT_CLIENTS sessions chatting
+// for CHAT_DURATION of virtual time, then prints the delivery latency
+// distribution. The same seed gives the same network.
+void runChatScenario(uint64_t seed);
+// STORM_CLIENTS sessions connect at once under the default admission rate and
+// listen backlog, retrying after "SERVER_BUSY" hints and refused connects.
+// Prints the recovery time, from the first connect until every session is
+// registered, and the distribution of each session's time to get in.
+void runStormScenario(uint64_t seed);
+// For each of FANOUT_RECIPIENTS, one session sends FANOUT_MESSAGES chat lines
+// to that many idle listeners. Prints, per recipient count, the wall-clock
+// spread from the server's first send of a line to its last, which is the
+// tail the last recipient waits on.
+void runFanoutScenario(uint64_t seed);
+// For each of STARTUP_LOG_MEGABYTES, writes a history of that size with its
+// index and times the server from construction until it listens: once as
+// after a clean shutdown, once with the index deleted so it is rebuilt.
+void runStartupScenario(uint64_t seed);
+// IDLE_CLIENTS sessions register and go quiet; after IDLE_SETTLE a probe
+// session asks for $metrics. Prints the budgeted bytes per idle session and
+// the size of the session object itself, which the budget does not count.
+void runIdleScenario(uint64_t seed);
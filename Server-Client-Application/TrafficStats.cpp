@@ -0,0 +1,137 @@
+#include "TrafficStats.h"
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+namespace {
+    // std::hash on strings can be weak in the low bits; HyperLogLog needs all 64.
+    uint64_t mixHash(uint64_t value) {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdULL;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ULL;
+        value ^= value >> 33;
+        return value;
+    }
+}
+
+void TopTalkers::add(const std::string& key) {
+    auto found = slots.find(key);
+    if (found != slots.end()) {
+        counters[found->second].count++;
+        return;
+    }
+    size_t victim = 0;
+    for (size_t i = 1; i < stats::TOP_TALKERS; i++) {
+        if (counters[i].count < counters[victim].count) {
+            victim = i;
+        }
+    }
+    Counter& counter = counters[victim];
+    if (counter.count > 0) {
+        slots.erase(counter.key);
+    }
+    counter.key = key;
+    counter.error = counter.count;
+    counter.count++;
+    slots[key] = victim;
+}
+
+std::string TopTalkers::report(size_t entries) const {
+    std::vector<const Counter*> ordered;
+    for (const auto& counter : counters) {
+        if (counter.count > 0) {
+            ordered.push_back(&counter);
+        }
+    }
+    std::sort(ordered.begin(), ordered.end(), [](const Counter* a, const Counter* b) { return a->count > b->count; });
+    std::string result;
+    for (size_t i = 0; i < ordered.size() && i < entries; i++) {
+        result += " " + ordered[i]->key + "=" + std::to_string(ordered[i]->count);
+        if (ordered[i]->error > 0) {
+            result += "(+-" + std::to_string(ordered[i]->error) + ")";
+        }
+    }
+    return result;
+}
+
+HyperLogLog::HyperLogLog() {
+    clear();
+}
+
+void HyperLogLog::add(uint64_t hash) {
+    size_t index = static_cast<size_t>(hash >> (64 - stats::HLL_PRECISION));
+    uint64_t rest = hash << stats::HLL_PRECISION;
+    uint8_t rank = 1;
+    while (rank <= 64 - stats::HLL_PRECISION && (rest & (1ULL << 63)) == 0) {
+        rank++;
+        rest <<= 1;
+    }
+    registers[index] = std::max(registers[index], rank);
+}
+
+uint64_t HyperLogLog::estimate() const {
+    const double m = static_cast<double>(stats::HLL_REGISTERS);
+    double sum = 0;
+    size_t zeros = 0;
+    for (uint8_t value : registers) {
+        sum += std::ldexp(1.0, -value);
+        zeros += value == 0;
+    }
+    double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    // Small-range correction: linear counting while registers are still empty.
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * std::log(m / static_cast<double>(zeros));
+    }
+    return static_cast<uint64_t>(estimate + 0.5);
+}
+
+void HyperLogLog::clear() {
+    memset(registers, 0, sizeof(registers));
+}
+
+TrafficStats::TrafficStats(const TimeSource& clock)
+    : clock(clock), previousActiveUsers(0), windowStart(clock.now()), sizeBuckets{}, messages(0), bytes(0) {
+}
+
+void TrafficStats::recordMessage(const std::string& alias, size_t size) {
+    rotateWindow(clock.now());
+    talkers.add(alias);
+    activeUsers.add(mixHash(std::hash<std::string>{}(alias)));
+    int bucket = 0;
+    while (bucket < stats::SIZE_BUCKETS - 1 && (size_t(16) << bucket) < size) {
+        bucket++;
+    }
+    sizeBuckets[bucket]++;
+    messages++;
+    bytes += size;
+}
+
+void TrafficStats::rotateWindow(TimeSource::time_point now) {
+    if (now - windowStart < stats::WINDOW) {
+        return;
+    }
+    // An idle gap longer than a window leaves nothing to carry over.
+    previousActiveUsers = now - windowStart < 2 * stats::WINDOW ? activeUsers.estimate() : 0;
+    activeUsers.clear();
+    windowStart = now;
+}
+
+std::string TrafficStats::report() {
+    rotateWindow(clock.now());
+    std::string result = "STATS messages=" + std::to_string(messages) + " bytes=" + std::to_string(bytes);
+    result += " active_users=" + std::to_string(activeUsers.estimate());
+    result += " previous_window=" + std::to_string(previousActiveUsers);
+    result += " window_minutes=" + std::to_string(stats::WINDOW.count());
+    result += "\ntop_talkers:" + talkers.report(stats::TOP_REPORTED);
+    result += "\nsizes:";
+    for (int bucket = 0; bucket < stats::SIZE_BUCKETS; bucket++) {
+        if (sizeBuckets[bucket] == 0) {
+            continue;
+        }
+        result += bucket == stats::SIZE_BUCKETS - 1 ? " >" + std::to_string(size_t(16) << (bucket - 1)) : " <=" + std::to_string(size_t(16) << bucket);
+        result += ":" + std::to_string(sizeBuckets[bucket]);
+    }
+    return result;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include "Environment.h"
+
+namespace stats {
+    // Aliases tracked by the space-saving summary; heavier hitters are exact
+    // up to the reported error.
+    constexpr size_t TOP_TALKERS{ 32 };
+    constexpr size_t TOP_REPORTED{ 10 };
+    // 2^10 one-byte registers: about 3% error on distinct counts.
+    constexpr int HLL_PRECISION{ 10 };
+    constexpr size_t HLL_REGISTERS{ size_t(1) << HLL_PRECISION };
+    constexpr std::chrono::minutes WINDOW{ 5 };
+    // Power-of-two size buckets, the last one open-ended.
+    constexpr int SIZE_BUCKETS{ 16 };
+}
+
+// Space-saving top-K: a fixed set of counters, the smallest one is recycled
+// for an unseen key and inherits its count as the error bound.
+class TopTalkers {
+public:
+    void add(const std::string& key);
+    std::string report(size_t entries) const;
+
+private:
+    struct Counter {
+        std::string key;
+        uint64_t count = 0;
+        uint64_t error = 0;
+    };
+    Counter counters[stats::TOP_TALKERS];
+    std::unordered_map<std::string, size_t> slots;
+};
+
+class HyperLogLog {
+public:
+    HyperLogLog();
+    void add(uint64_t hash);
+    uint64_t estimate() const;
+    void clear();
+
+private:
+    uint8_t registers[stats::HLL_REGISTERS];
+};
+
+// Constant-memory traffic summaries updated on the chat path and reported by
+// $stats. Only touched from the network thread.
+class TrafficStats {
+public:
+    explicit TrafficStats(const TimeSource& clock);
+    void recordMessage(const std::string& alias, size_t size);
+    std::string report();
+
+private:
+    void rotateWindow(TimeSource::time_point now);
+    const TimeSource& clock;
+    TopTalkers talkers;
+    HyperLogLog activeUsers;
+    uint64_t previousActiveUsers;
+    TimeSource::time_point windowStart;
+    uint64_t sizeBuckets[stats::SIZE_BUCKETS];
+    uint64_t messages;
+    uint64_t bytes;
+};